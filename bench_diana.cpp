@@ -0,0 +1,104 @@
+#include "diana/diana_server.hpp"
+#include "diana/token_tree.hpp"
+
+#include <sse/crypto/utils.hpp>
+#include <sse/crypto/random.hpp>
+
+#include <iostream>
+#include <chrono>
+#include <vector>
+
+using namespace std;
+using namespace sse::diana;
+
+static void print_rate(const string& name, uint64_t leaves, std::chrono::duration<double> time) {
+    cout << name << ": " << leaves << " leaves in " << time.count() * 1000 << " ms ("
+            << (uint64_t) (leaves / time.count()) << " leaves/sec)" << endl;
+}
+
+/*
+ * Leaf derivation throughput: recursive per-leaf callbacks vs. the
+ * breadth-first expansion into a contiguous buffer.
+ */
+static void bench_leaves(uint8_t depth) {
+    TokenTree::token_type root;
+    sse::crypto::random_bytes(root);
+
+    uint64_t leaf_count = 1UL << depth;
+    vector<uint8_t> leaves(leaf_count * TokenTree::kTokenSize);
+    uint64_t acc = 0;
+
+    auto begin = std::chrono::high_resolution_clock::now();
+    TokenTree::derive_all_leaves(root, depth, [&acc](const uint8_t * leaf) {
+        acc += leaf[0];
+    });
+    auto end = std::chrono::high_resolution_clock::now();
+    print_rate("depth " + to_string(depth) + ", callbacks", leaf_count, end - begin);
+
+    begin = std::chrono::high_resolution_clock::now();
+    TokenTree::derive_all_leaves(root, depth, leaves.data());
+    end = std::chrono::high_resolution_clock::now();
+    print_rate("depth " + to_string(depth) + ", buffer   ", leaf_count, end - begin);
+
+    // a range that does not start nor end on a subtree boundary
+    uint64_t start = leaf_count / 3;
+    uint64_t stop = leaf_count - leaf_count / 5;
+
+    begin = std::chrono::high_resolution_clock::now();
+    TokenTree::derive_leaves(root, depth, start, stop, leaves.data());
+    end = std::chrono::high_resolution_clock::now();
+    print_rate("depth " + to_string(depth) + ", range    ", stop - start + 1, end - begin);
+}
+
+/*
+ * End to end server search (leaf derivation, unmasking and lookups) on an
+ * in-memory index.
+ */
+static void bench_search(uint32_t add_count, uint8_t threads_count) {
+    DianaServer<uint64_t> server("diana_bench.dat", false);
+
+    TokenTree::token_type root;
+    sse::crypto::random_bytes(root);
+
+    SearchRequest req;
+    req.add_count = add_count;
+    req.token_list = TokenTree::covering_list(root, add_count, 48);
+
+    // fill the index with one entry per leaf
+    vector<uint8_t> leaves(TokenTree::kTokenSize * add_count);
+    uint64_t offset = 0;
+    for (auto& node : req.token_list) {
+        TokenTree::derive_all_leaves(node.first, node.second, leaves.data() + offset * TokenTree::kTokenSize);
+        offset += 1UL << node.second;
+    }
+    for (uint64_t i = 0; i < add_count; i++) {
+        UpdateRequest<uint64_t> u_req;
+        uint64_t mask;
+        gen_update_token_mask(leaves.data() + i * TokenTree::kTokenSize, u_req.token, mask);
+        u_req.index = xor_mask(i, mask);
+        server.update(u_req);
+    }
+
+    auto begin = std::chrono::high_resolution_clock::now();
+    vector<uint64_t> res = server.search_simple_parallel(req, threads_count, false);
+    auto end = std::chrono::high_resolution_clock::now();
+    print_rate("search, " + to_string(threads_count) + " thread(s)", add_count, end - begin);
+
+    if (res.size() != add_count) {
+        cout << "Invalid result count: " << res.size() << endl;
+    }
+}
+
+int main(int argc, char** argv) {
+    sse::crypto::init_crypto_lib();
+
+    for (uint8_t depth = 10; depth <= 22; depth += 4) {
+        bench_leaves(depth);
+    }
+
+    bench_search(1 << 20, 1);
+    bench_search(1 << 20, 4);
+
+    sse::crypto::cleanup_crypto_lib();
+    return 0;
+}
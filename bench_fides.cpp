@@ -0,0 +1,155 @@
+#include "fides/sophos_client.hpp"
+
+#include <sse/crypto/utils.hpp>
+#include <sse/crypto/tdp.hpp>
+
+#include <iostream>
+#include <chrono>
+#include <vector>
+
+using namespace std;
+using namespace sse::sophos;
+
+/*
+ * Update throughput of the Sophos client (the insertion side of Fides) on a
+ * few hot keywords, with and without the search token cache. Both clients
+ * share their keys, so their requests must be identical.
+ */
+static void bench_updates(size_t keyword_count, size_t updates_per_keyword) {
+    SophosClient cached("", 0);
+    SophosClient uncached("", cached.private_key(), cached.master_derivation_key(), cached.rsa_prg_key());
+    uncached.set_token_cache_capacity(0);
+
+    vector<string> keywords;
+    for (size_t i = 0; i < keyword_count; i++) {
+        keywords.push_back("keyword_" + to_string(i));
+    }
+
+    array<uint8_t, kUpdateTokenSize> index;
+    index.fill(0);
+    size_t mismatches = 0;
+    chrono::duration<double> cached_time(0), uncached_time(0);
+
+    for (size_t round = 0; round < updates_per_keyword; round++) {
+        for (const string& kw : keywords) {
+            auto begin = chrono::high_resolution_clock::now();
+            UpdateRequest u1 = uncached.update_request(kw, index);
+            auto middle = chrono::high_resolution_clock::now();
+            UpdateRequest u2 = cached.update_request(kw, index);
+            auto end = chrono::high_resolution_clock::now();
+
+            uncached_time += middle - begin;
+            cached_time += end - middle;
+            if (u1.token != u2.token || u1.index != u2.index) {
+                mismatches++;
+            }
+        }
+    }
+    for (const string& kw : keywords) {
+        if (uncached.search_request(kw).token != cached.search_request(kw).token) {
+            mismatches++;
+        }
+    }
+
+    size_t n = keyword_count * updates_per_keyword;
+    cout << keyword_count << " keywords, " << updates_per_keyword << " updates each" << endl;
+    cout << "  without cache: " << (uint64_t) (n / uncached_time.count()) << " updates/sec" << endl;
+    cout << "  with cache:    " << (uint64_t) (n / cached_time.count()) << " updates/sec" << endl;
+    if (mismatches > 0) {
+        cout << "Invalid requests: " << mismatches << endl;
+    }
+}
+
+// f(0), ..., f(n-1) in rounds, for at least kMinBenchTime: best of 3 runs
+template <typename F>
+static double ops_per_sec(size_t n, F f) {
+    const chrono::duration<double> kMinBenchTime(0.2);
+    double best = 0;
+
+    for (int run = 0; run < 3; run++) {
+        size_t ops = 0;
+        chrono::duration<double> time(0);
+        auto begin = chrono::high_resolution_clock::now();
+        while (time < kMinBenchTime) {
+            for (size_t i = 0; i < n; i++) {
+                f(i);
+            }
+            ops += n;
+            time = chrono::high_resolution_clock::now() - begin;
+        }
+        best = max(best, ops / time.count());
+    }
+    return best;
+}
+
+/*
+ * Throughput of the TDP operations of Fides with each backend: evaluations
+ * (server side: search tokens walked one by one, by a pool order, or as one
+ * strided chain) and inversions (client side: one update, or the ST0 to
+ * STc jump of invert_mult). The modulus size is the one the library was
+ * built with.
+ */
+static void bench_tdp(uint32_t public_exponent, size_t n) {
+    const uint8_t kPoolSize = 16;
+    const uint32_t kInverseOrder = 1000;
+    typedef array<uint8_t, sse::crypto::Tdp::kMessageSize> message_type;
+
+    sse::crypto::TdpInverse inverse(public_exponent);
+    sse::crypto::TdpMultPool pool(inverse.public_key(), kPoolSize);
+
+    vector<message_type> samples(n);
+    for (auto& sample : samples) {
+        sample = pool.sample_array();
+    }
+    vector<message_type> chain(n);
+    vector<message_type> results[2];
+
+    cout << sse::crypto::Tdp::kModulusBits << " bits modulus, e = " << public_exponent << endl;
+
+    const sse::crypto::TdpBackend backends[] = {sse::crypto::TdpBackend::kOpenSSL, sse::crypto::TdpBackend::kMontgomery};
+    for (size_t b = 0; b < 2; b++) {
+        inverse.set_backend(backends[b]);
+        pool.set_backend(backends[b]);
+        results[b].resize(4 * n);
+        vector<message_type>& res = results[b];
+
+        double eval = ops_per_sec(n, [&](size_t i) {
+            res[i] = pool.eval(samples[i]);
+        });
+        double eval_pool = ops_per_sec(n, [&](size_t i) {
+            res[n + i] = pool.eval(samples[i], kPoolSize);
+        });
+        double eval_chain = ops_per_sec(1, [&](size_t) {
+            pool.eval_chain(samples[0], kPoolSize, n, chain.data());
+        }) * n;
+        double invert = ops_per_sec(n, [&](size_t i) {
+            res[2 * n + i] = inverse.invert(samples[i]);
+        });
+        double invert_mult = ops_per_sec(n, [&](size_t i) {
+            res[3 * n + i] = inverse.invert_mult(samples[i], kInverseOrder);
+        });
+
+        cout << "  " << (backends[b] == sse::crypto::TdpBackend::kOpenSSL ? "openssl:    " : "montgomery: ");
+        cout << (uint64_t) eval << " eval/sec, ";
+        cout << (uint64_t) eval_pool << " eval(" << (int) kPoolSize << ")/sec, ";
+        cout << (uint64_t) eval_chain << " chain steps/sec, ";
+        cout << (uint64_t) invert << " invert/sec, ";
+        cout << (uint64_t) invert_mult << " invert_mult(" << kInverseOrder << ")/sec" << endl;
+    }
+    if (results[0] != results[1]) {
+        cout << "The backends do not match" << endl;
+    }
+}
+
+int main(int argc, char** argv) {
+    sse::crypto::init_crypto_lib();
+
+    bench_updates(16, 64);
+    bench_updates(4, 256);
+
+    bench_tdp(3, 200);
+    bench_tdp(65537, 200);
+
+    sse::crypto::cleanup_crypto_lib();
+    return 0;
+}
@@ -0,0 +1,73 @@
+#include "orion/Orion.h"
+
+#include <chrono>
+#include <random>
+#include <set>
+#include <tuple>
+#include <vector>
+
+using namespace std;
+
+/*
+ * Streaming ingestion: the same updates applied one at a time with
+ * insert/remove and as batches with batchUpdate, on two fresh in-memory
+ * instances. A third of the updates remove an id inserted earlier.
+ */
+static void bench_updates(int update_count, int batch_size) {
+    Orion single(false, 4 * update_count);
+    Orion batched(false, 4 * update_count);
+
+    mt19937 rng(7);
+    map<string, vector<int> > inserted;
+    vector<tuple<string, int, Orion::OP> > updates;
+    for (int i = 0; i < update_count; i++) {
+        string keyword = "kw" + to_string(rng() % 16);
+        if (rng() % 3 == 0 && !inserted[keyword].empty()) {
+            updates.push_back(make_tuple(keyword, inserted[keyword].back(), Orion::DEL));
+            inserted[keyword].pop_back();
+        } else {
+            updates.push_back(make_tuple(keyword, i + 1, Orion::INS));
+            inserted[keyword].push_back(i + 1);
+        }
+    }
+
+    auto begin = chrono::high_resolution_clock::now();
+    for (auto& update : updates) {
+        if (get<2>(update) == Orion::INS) {
+            single.insert(get<0>(update), get<1>(update));
+        } else {
+            single.remove(get<0>(update), get<1>(update));
+        }
+    }
+    chrono::duration<double> single_time = chrono::high_resolution_clock::now() - begin;
+
+    begin = chrono::high_resolution_clock::now();
+    for (size_t i = 0; i < updates.size(); i += batch_size) {
+        auto last = updates.begin() + min(updates.size(), i + batch_size);
+        batched.batchUpdate(vector<tuple<string, int, Orion::OP> >(updates.begin() + i, last));
+    }
+    chrono::duration<double> batched_time = chrono::high_resolution_clock::now() - begin;
+
+    cout << update_count << " updates, batches of " << batch_size << ": "
+            << (uint64_t) (update_count / single_time.count()) << " updates/sec one by one, "
+            << (uint64_t) (update_count / batched_time.count()) << " updates/sec batched ("
+            << single_time.count() / batched_time.count() << "x)" << endl;
+
+    // both instances must agree
+    for (auto& keyword : inserted) {
+        auto a = single.search(keyword.first);
+        auto b = batched.search(keyword.first);
+        if (set<int>(a.begin(), a.end()) != set<int>(b.begin(), b.end())) {
+            cout << "Mismatch on " << keyword.first << endl;
+        }
+    }
+}
+
+int main(int argc, char** argv) {
+    int update_count = (argc > 1) ? atoi(argv[1]) : 1000;
+
+    for (int batch_size : {16, 64, 256}) {
+        bench_updates(update_count, batch_size);
+    }
+    return 0;
+}
@@ -14,18 +14,20 @@
 #include <string>
 #include <thread>
 #include <fstream>
+#include <unordered_map>
 
 #include <grpc/grpc.h>
 #include <grpc++/client_context.h>
+#include <grpc++/completion_queue.h>
 #include <grpc++/create_channel.h>
 #include <grpc++/security/credentials.h>
 
-DianaClientRunner::DianaClientRunner(string address,bool usehdd, bool deleteItems) {
+DianaClientRunner::DianaClientRunner(string address,bool usehdd, bool deleteItems, sse::sophos::CounterStore::Backend stateBackend) {
     this->deleteItem = deleteItems;
     this->usehdd=usehdd;
     std::shared_ptr<grpc::Channel> channel(grpc::CreateChannel(address, grpc::InsecureChannelCredentials()));
     stub_ = Diana::NewStub(channel);
-    client_ = make_unique<DianaInterface>(usehdd, false, deleteItems);
+    client_ = make_unique<DianaInterface>(usehdd, false, deleteItems, stateBackend);
 }
 
 void DianaClientRunner::setup() {
@@ -70,6 +72,89 @@ void DianaClientRunner::insertKeyword(string keyword, index_type index) {
     totalUpdateTime = Utilities::stopTimer(2);
 }
 
+static void appendBatchInsert(const UpdateRequest<index_type>* reqs, const pair<update_token_type, update_token_type>* delCnts, size_t count, BatchInsertRequestMessage* message) {
+    for (size_t i = 0; i < count; i++) {
+        message->add_update_token(reqs[i].token.data(), reqs[i].token.size());
+        message->add_index(reqs[i].index);
+        message->add_delete_key(delCnts[i].first.data(), delCnts[i].first.size());
+        message->add_delete_value(delCnts[i].second.data(), delCnts[i].second.size());
+    }
+}
+
+void DianaClientRunner::bulkInsertKeywords(const vector<pair<string, index_type> >& updates) {
+    clientUpdateComputationTime = 0;
+    serverUpdateComputationTime = 0;
+    Utilities::startTimer(2);
+
+    // one asynchronous call per batch, completed through the queue
+    struct PendingBatch {
+        grpc::ClientContext context;
+        UpdateResponse response;
+        grpc::Status status;
+        std::unique_ptr<grpc::ClientAsyncResponseReader<UpdateResponse> > rpc;
+    };
+    grpc::CompletionQueue cq;
+    size_t pending = 0;
+
+    auto completeOne = [&]() {
+        void* tag;
+        bool ok;
+        if (!cq.Next(&tag, &ok)) {
+            return;
+        }
+        std::unique_ptr<PendingBatch> batch(static_cast<PendingBatch*> (tag));
+        pending--;
+        if (!ok || !batch->status.ok()) {
+            cout << "Batch update failed:" << std::endl;
+            return;
+        }
+        serverUpdateComputationTime += batch->response.comptime();
+    };
+
+    BatchInsertRequestMessage message;
+    auto sendBatch = [&]() {
+        if (pending == kMaxPendingBatches) {
+            completeOne();
+        }
+        PendingBatch* batch = new PendingBatch;
+        batch->rpc = stub_->AsyncbatchInsertKeyword(&batch->context, message, &cq);
+        batch->rpc->Finish(&batch->response, &batch->status, batch);
+        pending++;
+        message.Clear();
+    };
+
+    Utilities::startTimer(1);
+    unordered_map<string, vector<index_type> > groups;
+    for (const auto& update : updates) {
+        groups[update.first].push_back(update.second);
+    }
+    clientUpdateComputationTime += Utilities::stopTimer(1);
+
+    vector<UpdateRequest<index_type> > reqs(kBulkBatchSize);
+    vector<pair<update_token_type, update_token_type> > delCnts(kBulkBatchSize);
+    for (const auto& group : groups) {
+        // large groups are split over several batches
+        for (size_t done = 0; done < group.second.size();) {
+            size_t count = std::min(group.second.size() - done, kBulkBatchSize - message.index_size());
+            Utilities::startTimer(1);
+            client_->bulkInsertKeyword(group.first, group.second.data() + done, count, reqs.data(), delCnts.data());
+            appendBatchInsert(reqs.data(), delCnts.data(), count, &message);
+            clientUpdateComputationTime += Utilities::stopTimer(1);
+            done += count;
+            if ((size_t) message.index_size() == kBulkBatchSize) {
+                sendBatch();
+            }
+        }
+    }
+    if (message.index_size() > 0) {
+        sendBatch();
+    }
+    while (pending > 0) {
+        completeOne();
+    }
+    totalUpdateTime = Utilities::stopTimer(2);
+}
+
 void DianaClientRunner::deleteKeyword(string keyword, index_type index) {
     clientUpdateComputationTime = 0;
     Utilities::startTimer(2);
@@ -93,84 +178,74 @@ void DianaClientRunner::deleteKeyword(string keyword, index_type index) {
     totalUpdateTime = Utilities::stopTimer(2);
 }
 
-list<index_type> DianaClientRunner::searchKeyword(string keyword) {
-    clientSearchComputationTime = 0;
-    Utilities::startTimer(2);
-    Utilities::startTimer(1);
-    SearchRequest delReq, insReq;
-    client_->searchDeletedKeyword(keyword, delReq);
-    clientSearchComputationTime += Utilities::stopTimer(1);
-
-    grpc::ClientContext delContext, insContext;
-    SearchRequestMessage delMessage, insMessage;
-    SearchDelReply delReply;
-    SearchInsReply insReply;
-
-    delMessage.set_add_count(delReq.add_count);
-    delMessage.set_kw_token(delReq.kw_token.data(), delReq.kw_token.size());
-    for (auto it : delReq.token_list) {
-        SearchToken* searchToken = delMessage.add_token_list();
+static void toSearchRequestMessage(const SearchRequest& req, SearchRequestMessage* message) {
+    message->set_add_count(req.add_count);
+    message->set_kw_token(req.kw_token.data(), req.kw_token.size());
+    for (auto it : req.token_list) {
+        SearchToken* searchToken = message->add_token_list();
         searchToken->set_depth(it.second);
         searchToken->set_token(it.first.data(), it.first.size());
     }
-    grpc::Status status = stub_->searchDelete(&delContext, delMessage, &delReply);
-    serverSearchComputationTime = delReply.comptime();
+}
 
-    if (!status.ok()) {
-        cout << "search delete failed:" << std::endl;
-    }
-    list<std::array<uint8_t, kUpdateTokenSize> > ciphers;
-    for (int i = 0; i < delReply.result_size(); i++) {
-        std::array<uint8_t, kUpdateTokenSize> cipher;
-        std::copy(delReply.result(i).begin(), delReply.result(i).end(), cipher.begin());
-        ciphers.push_back(cipher);
-    }
+vector<index_type> DianaClientRunner::searchKeyword(string keyword) {
+    clientSearchComputationTime = 0;
+    serverSearchComputationTime = 0;
+    Utilities::startTimer(2);
     Utilities::startTimer(1);
-    client_->searchInsertedKeyword(keyword, ciphers, insReq);
-    clientSearchComputationTime += Utilities::stopTimer(1);
-    insMessage.set_add_count(insReq.add_count);
-    insMessage.set_kw_token(insReq.kw_token.data(), insReq.kw_token.size());
-    for (auto it : insReq.token_list) {
-        SearchToken* searchToken = insMessage.add_token_list();
-        searchToken->set_depth(it.second);
-        searchToken->set_token(it.first.data(), it.first.size());
-    }
-
-    status = stub_->searchInsert(&insContext, insMessage, &insReply);
-    serverSearchComputationTime += insReply.comptime();
+    SearchRequest delReq, insReq;
+    client_->searchKeywordRequests(keyword, delReq, insReq);
 
-    if (!status.ok()) {
-        cout << "search delete failed:" << std::endl;
-    }
-    std::list<uint64_t> results;
-    for (int i = 0; i < insReply.result_size(); i++) {
-        results.push_back(insReply.result(i));
-    }
-    Utilities::startTimer(1);
-    client_->processSearch(results, keyword);
+    SearchStreamRequest request;
+    toSearchRequestMessage(delReq, request.mutable_search()->mutable_delete_request());
+    toSearchRequestMessage(insReq, request.mutable_search()->mutable_insert_request());
     clientSearchComputationTime += Utilities::stopTimer(1);
 
-    if (deleteItem) {
-        grpc::ClientContext batchContext;
-        BatchInsertRequestMessage batchMessage;
-        UpdateResponse batchResponse;
-        for (auto item : results) {
-            UpdateRequest<index_type> breq;
-            update_token_type delCntMapKey, delCntMapValue;
+    grpc::ClientContext context;
+    std::unique_ptr<grpc::ClientReaderWriter<SearchStreamRequest, SearchStreamReply> > stream(stub_->search(&context));
+    stream->Write(request);
+
+    std::vector<index_type> results;
+    results.reserve(insReq.add_count);
+    SearchStreamReply reply;
+    // the keyword only moves to its re-inserted results once they are all sent
+    bool complete = false;
+    while (stream->Read(&reply)) {
+        if (deleteItem && reply.result_size() > 0) {
+            // re-insert this chunk while the next ones are on their way
+            SearchStreamRequest reinsert;
+            BatchInsertRequestMessage* batchMessage = reinsert.mutable_reinsert();
             Utilities::startTimer(1);
-            client_->insertKeyword(keyword, item, breq, delCntMapKey, delCntMapValue);
-            batchMessage.add_update_token(breq.token.data(), breq.token.size());
+            vector<UpdateRequest<index_type> > breqs(reply.result_size());
+            vector<pair<update_token_type, update_token_type> > delCnts(reply.result_size());
+            client_->reinsertKeyword(keyword, reply.result().data(), reply.result_size(), breqs.data(), delCnts.data());
+            appendBatchInsert(breqs.data(), delCnts.data(), breqs.size(), batchMessage);
             clientSearchComputationTime += Utilities::stopTimer(1);
-            batchMessage.add_index(breq.index);
-            batchMessage.add_delete_key(delCntMapKey.data(), delCntMapKey.size());
-            batchMessage.add_delete_value(delCntMapValue.data(), delCntMapValue.size());
+            if (!stream->Write(reinsert)) {
+                break;
+            }
         }
-        grpc::Status status = stub_->batchInsertKeyword(&batchContext, batchMessage, &batchResponse);
-        serverSearchComputationTime += batchResponse.comptime();
-        if (!status.ok()) {
-            cout << "Update failed:" << std::endl;
+        results.insert(results.end(), reply.result().begin(), reply.result().end());
+        if (reply.last()) {
+            serverSearchComputationTime += reply.comptime();
+            complete = true;
+            break;
         }
     }
+    stream->WritesDone();
+    // the final reply comes once the server applied all the re-insertions
+    complete = complete && stream->Read(&reply);
+    if (complete) {
+        serverSearchComputationTime += reply.comptime();
+    }
+    grpc::Status status = stream->Finish();
+    if (!status.ok()) {
+        cout << "search failed:" << std::endl;
+    }
+    if (deleteItem) {
+        client_->finishCleaning(keyword, complete && status.ok());
+    }
+    client_->processSearchResults(results.size());
     totalSearchTime = Utilities::stopTimer(2);
     return results;
 }
@@ -4,18 +4,23 @@
 #include "diana.grpc.pb.h"
 #include <iostream>
 #include <list>
+#include <vector>
 #include "DianaInterface.h"
 using namespace std;
 
 
 class DianaClientRunner : public Diana::Service {
 public:
-    DianaClientRunner(string address,bool usehdd,bool deleteItems);
+    DianaClientRunner(string address,bool usehdd,bool deleteItems, sse::sophos::CounterStore::Backend stateBackend = sse::sophos::CounterStore::Backend::kMemory);
     virtual ~DianaClientRunner();
     void insertKeyword(string key, index_type ind);    
+    // Initial load: the updates are grouped by keyword and sent in batches,
+    // with up to kMaxPendingBatches requests in flight while the next batch
+    // is computed.
+    void bulkInsertKeywords(const vector<pair<string, index_type> >& updates);
     void deleteKeyword(string key, index_type ind);
     void setup();
-    list<index_type> searchKeyword(string key);
+    vector<index_type> searchKeyword(string key);
     double getTotalSearchCommSize();
     double getTotalUpdateCommSize();
     std::unique_ptr<DianaInterface> client_;
@@ -25,6 +30,10 @@ public:
     double serverSearchComputationTime;
     double clientUpdateComputationTime;
     double serverUpdateComputationTime;
+
+    // entries per BatchInsertRequestMessage (about 1MB)
+    static const size_t kBulkBatchSize = 16384;
+    static const size_t kMaxPendingBatches = 8;
 private:
     bool deleteItem,usehdd;
     std::unique_ptr<Diana::Stub> stub_;
@@ -3,18 +3,23 @@
 #include <random>
 #include <iostream>
 #include <string>
+#include <algorithm>
 #include <map>
+#include <unordered_map>
 #include <math.h>
 #include <random>
 #include <stdlib.h>
 #include <sse/crypto/hash.hpp>
+#include <sse/crypto/block_hash.hpp>
 #include <openssl/conf.h>
 #include <openssl/evp.h>
 #include <openssl/err.h>
 #include <string.h>
 
-DianaInterface::DianaInterface(bool usehdd, bool initialize, bool deleteResults) {
+DianaInterface::DianaInterface(bool usehdd, bool initialize, bool deleteResults, sse::sophos::CounterStore::Backend stateBackend, uint8_t searchThreads) {
     this->deleteResults = deleteResults;
+    states = sse::sophos::RecordStore<KeywordState>::open(stateBackend, "diana_client_state.sav");
+    this->searchThreads = (searchThreads > 0) ? searchThreads : DianaServer<index_type>::default_threads_count();
     if (initialize) {
         initializeClientAndServer(usehdd);
     } else {
@@ -63,7 +68,9 @@ void DianaInterface::initializeClientAndServer(bool usehdd) {
 
         serverIns.reset(new DianaServer<index_type>("diana_server_ins.dat", 1000, usehdd));
 
-        clientDel.reset(new DianaClient<update_token_type>("diana_client_del.sav"));
+        // only the keys of clientIns are written, and a restart builds
+        // clientDel from them: the two trees differ by their treeIndex
+        clientDel.reset(new DianaClient<update_token_type>("diana_client_del.sav", clientIns->master_derivation_key(), clientIns->kw_token_master_key()));
 
         serverDel.reset(new DianaServer<update_token_type>("diana_server_del.dat", 1000, usehdd));
 
@@ -115,7 +122,9 @@ void DianaInterface::initializeClient() {
 
         clientIns.reset(new DianaClient<index_type>("diana_client_ins.sav"));
 
-        clientDel.reset(new DianaClient<update_token_type>("diana_client_del.sav"));
+        // only the keys of clientIns are written, and a restart builds
+        // clientDel from them: the two trees differ by their treeIndex
+        clientDel.reset(new DianaClient<update_token_type>("diana_client_del.sav", clientIns->master_derivation_key(), clientIns->kw_token_master_key()));
 
         // write keys to files
 
@@ -135,155 +144,217 @@ DianaInterface::~DianaInterface() {
 
 }
 
+DianaInterface::keyword_id_type DianaInterface::keywordId(const string& keyword) {
+    keyword_id_type id;
+    string hash_string = sse::crypto::Hash::hash(keyword);
+    std::copy_n(hash_string.begin(), kKeywordIdSize, id.begin());
+    return id;
+}
+
+// index of the insertion or deletion tree of a keyword generation
+DianaInterface::keyword_index_type DianaInterface::treeIndex(const keyword_id_type& id, uint32_t generation, uint8_t tree) {
+    keyword_index_type block, index;
+    std::copy(id.begin(), id.end(), block.begin());
+    for (size_t i = 0; i < sizeof (generation); i++) {
+        block[i] ^= (uint8_t) (generation >> (8 * i));
+    }
+    block[sizeof (generation)] ^= tree;
+    sse::crypto::BlockHash::hash(block.data(), index.data());
+    return index;
+}
+
+// key of an insertion in the delCntMap
+update_token_type DianaInterface::deleteKey(const keyword_index_type& insIndex, index_type ind) {
+    update_token_type block, key;
+    block.fill(0);
+    for (size_t i = 0; i < sizeof (ind); i++) {
+        block[i] = (uint8_t) (ind >> (8 * i));
+    }
+    sse::crypto::BlockHash::hash(block.data(), block.data());
+    for (size_t i = 0; i < kUpdateTokenSize; i++) {
+        block[i] ^= insIndex[i];
+    }
+    sse::crypto::BlockHash::hash(block.data(), key.data());
+    return key;
+}
+
+DianaInterface::KeywordState DianaInterface::keywordState(const keyword_id_type& id) const {
+    KeywordState state{0, 0, 0, 1};
+    states->get(id, state);
+    return state;
+}
+
 //This function is used for the client and server mode
 void DianaInterface::insertKeyword(string keyword, index_type ind, UpdateRequest<index_type>& u_req, update_token_type& delCntMapKey, update_token_type& delCntMapValue) {
     totalUpdateCommSize = 0;
-    string key;
-    if (keywordsToken.count(keyword) != 0) {
-        key = keywordsToken[keyword];
-    } else {
-        keywordsCounter[keyword] = 1;
-        key = keyword + to_string(keywordsCounter[keyword]);
-        keywordsToken[keyword] = key;
-    }
-    uint32_t kw_counter;
-    u_req = clientIns->update_request(key, ind, kw_counter);
-    string hash_string = sse::crypto::Hash::hash(key + "|" + to_string(ind));
-    std::copy_n(hash_string.begin(), kUpdateTokenSize, delCntMapKey.begin());
-    delCntMapValue = Utilities::encode(to_string(kw_counter));
+    keyword_id_type id = keywordId(keyword);
+    KeywordState state = keywordState(id);
+    keyword_index_type insIndex = treeIndex(id, state.generation, kInsertionTree);
+    uint32_t kw_counter = state.insCount++;
+    u_req = clientIns->update_request(insIndex, kw_counter, ind);
+    states->set(id, state);
+    delCntMapKey = deleteKey(insIndex, ind);
+    delCntMapValue = CounterCodec(clientIns->keyword_token(insIndex)).encode(delCntMapKey, kw_counter);
     totalUpdateCommSize = (sizeof (u_req.index) + kUpdateTokenSize) + kUpdateTokenSize * 2;
 }
 
 //This function is used for the single machine mode
 void DianaInterface::insertKeyword(string keyword, index_type ind) {
-    totalUpdateCommSize = 0;
-    string key;
-    if (keywordsToken.count(keyword) != 0) {
-        key = keywordsToken[keyword];
-    } else {
-        keywordsCounter[keyword] = 1;
-        key = keyword + to_string(keywordsCounter[keyword]);
-        keywordsToken[keyword] = key;
-    }
     UpdateRequest<index_type> u_req;
-    uint32_t kw_counter;
-    u_req = clientIns->update_request(key, ind, kw_counter);
+    update_token_type delCntMapKey, delCntMapValue;
+    insertKeyword(keyword, ind, u_req, delCntMapKey, delCntMapValue);
     if (!setupMode) {
         serverIns->update(u_req);
+        serverDel->put_del_counter(delCntMapKey, delCntMapValue);
     }
-    string hash_string = sse::crypto::Hash::hash(key + "|" + to_string(ind));
-    update_token_type delCntMapKey;
-    std::copy_n(hash_string.begin(), kUpdateTokenSize, delCntMapKey.begin());
-    update_token_type delCntMapValue = Utilities::encode(to_string(kw_counter));
-    if (!setupMode) {
-        serverDel->delCntMap[delCntMapKey] = delCntMapValue;
+}
+
+//This function is used for the client and server mode
+void DianaInterface::bulkInsertKeyword(const string& keyword, const index_type* inds, size_t count, UpdateRequest<index_type>* u_reqs, pair<update_token_type, update_token_type>* delCnts) {
+    keyword_id_type id = keywordId(keyword);
+    KeywordState state = keywordState(id);
+    bulkInsert(id, state, inds, count, u_reqs, delCnts);
+    states->set(id, state);
+}
+
+void DianaInterface::bulkInsert(const keyword_id_type& id, KeywordState& state, const index_type* inds, size_t count, UpdateRequest<index_type>* u_reqs, pair<update_token_type, update_token_type>* delCnts) {
+    totalUpdateCommSize = 0;
+    if (count == 0) {
+        return;
     }
-    totalUpdateCommSize = (sizeof (u_req.index) + kUpdateTokenSize) + kUpdateTokenSize * 2;
+    keyword_index_type insIndex = treeIndex(id, state.generation, kInsertionTree);
+    uint32_t firstCounter = state.insCount;
+    clientIns->bulk_update_request(insIndex, firstCounter, inds, count, u_reqs);
+    state.insCount += count;
+
+    CounterCodec codec(clientIns->keyword_token(insIndex));
+    for (size_t i = 0; i < count; i++) {
+        delCnts[i].first = deleteKey(insIndex, inds[i]);
+        delCnts[i].second = codec.encode(delCnts[i].first, firstCounter + i);
+    }
+    totalUpdateCommSize = count * ((sizeof (index_type) + kUpdateTokenSize) + kUpdateTokenSize * 2);
 }
 
 //This function is used for the single machine mode
-list<index_type> DianaInterface::searchKeyword(string keyword) {
-    totalSearchCommSize = 0;
-    string key = keywordsToken[keyword];
-    SearchRequest del_s_req;
-    std::list<update_token_type> resDel;
-    del_s_req = clientDel->search_request(key);
-    totalSearchCommSize += sizeof (del_s_req.add_count) + sizeof (del_s_req.kw_token) + del_s_req.token_list.size()*(1 + sizeof (search_token_key_type));
-    resDel = serverDel->search_simple_parallel(del_s_req, 1, false);
-    totalSearchCommSize += resDel.size() * sizeof (update_token_type);
-    std::vector<uint32_t> delCnts;
-    for (auto item : resDel) {
-        string cnt = Utilities::decode(serverDel->delCntMap[item]);
-        delCnts.push_back(stoi(cnt));
+void DianaInterface::bulkInsertKeywords(const vector<pair<string, index_type> >& updates) {
+    unordered_map<string, vector<index_type> > groups;
+    for (const auto& update : updates) {
+        groups[update.first].push_back(update.second);
     }
-    SearchRequest ins_s_req;
-    std::list<index_type> resIns;
-    ins_s_req = clientIns->search_request(key, delCnts);
-    totalSearchCommSize += sizeof (ins_s_req.add_count) + sizeof (ins_s_req.kw_token) + ins_s_req.token_list.size()*(1 + sizeof (search_token_key_type));
-    resIns = serverIns->search_simple_parallel(ins_s_req, 1, false);
-    totalSearchCommSize += resIns.size() * sizeof (index_type);
-    if (deleteResults) {
-        keywordsCounter[keyword]++;
-        keywordsToken[keyword] = keyword + to_string(keywordsCounter[keyword]);
-        for (auto item : resIns) {
-            insertKeyword(keyword, item);
-            totalSearchCommSize += totalUpdateCommSize;
+
+    vector<UpdateRequest<index_type> > u_reqs;
+    vector<pair<update_token_type, update_token_type> > delCnts;
+    double commSize = 0;
+    for (const auto& group : groups) {
+        u_reqs.resize(group.second.size());
+        delCnts.resize(group.second.size());
+        bulkInsertKeyword(group.first, group.second.data(), group.second.size(), u_reqs.data(), delCnts.data());
+        commSize += totalUpdateCommSize;
+        if (!setupMode) {
+            serverIns->bulk_update(u_reqs);
+            serverDel->put_del_counters(delCnts);
         }
     }
+    totalUpdateCommSize = commSize;
+}
+
+//This function is used for the single machine mode
+vector<index_type> DianaInterface::searchKeyword(string keyword) {
+    SearchRequest del_s_req, ins_s_req;
+    searchKeywordRequests(keyword, del_s_req, ins_s_req);
+    std::vector<index_type> resIns = search_with_deletions(*serverDel, *serverIns, del_s_req, ins_s_req, searchThreads);
+    processSearchResults(resIns.size());
+    if (deleteResults && !resIns.empty()) {
+        vector<UpdateRequest<index_type> > u_reqs(resIns.size());
+        vector<pair<update_token_type, update_token_type> > delCnts(resIns.size());
+        reinsertKeyword(keyword, resIns.data(), resIns.size(), u_reqs.data(), delCnts.data());
+        totalSearchCommSize += totalUpdateCommSize;
+        if (!setupMode) {
+            serverIns->bulk_update(u_reqs);
+            serverDel->put_del_counters(delCnts);
+        }
+    }
+    if (deleteResults) {
+        finishCleaning(keyword, true);
+    }
     return resIns;
 }
 
 //This function is used for the client and server mode
-void DianaInterface::searchDeletedKeyword(string keyword, SearchRequest& del_s_req) {
+void DianaInterface::searchKeywordRequests(string keyword, SearchRequest& del_s_req, SearchRequest& ins_s_req) {
     totalSearchCommSize = 0;
-    string key = keywordsToken[keyword];
-    std::list<update_token_type> resDel;
-    del_s_req = clientDel->search_request(key);
+    keyword_id_type id = keywordId(keyword);
+    KeywordState state;
+    if (!states->get(id, state)) {
+        del_s_req = clientDel->search_request(keyword_index_type(), 0);
+        ins_s_req = clientIns->search_request(keyword_index_type(), 0);
+        return;
+    }
+    del_s_req = clientDel->search_request(treeIndex(id, state.generation, kDeletionTree), state.delCount);
+    ins_s_req = clientIns->search_request(treeIndex(id, state.generation, kInsertionTree), state.insCount);
     totalSearchCommSize += sizeof (del_s_req.add_count) + sizeof (del_s_req.kw_token) + del_s_req.token_list.size()*(1 + sizeof (search_token_key_type));
+    totalSearchCommSize += sizeof (ins_s_req.add_count) + sizeof (ins_s_req.kw_token) + ins_s_req.token_list.size()*(1 + sizeof (search_token_key_type));
+    if (deleteResults) {
+        // the results go to fresh trees, the current ones stay until the end
+        uint32_t generation = state.nextGeneration;
+        cleanings.put(id, KeywordState{generation, 0, 0, generation + 1});
+        state.nextGeneration = generation + 1;
+        states->set(id, state);
+    }
 }
 
 //This function is used for the client and server mode
-void DianaInterface::searchInsertedKeyword(string keyword, std::list<update_token_type>& resDel, SearchRequest& ins_s_req) {
-    totalSearchCommSize += resDel.size() * sizeof (update_token_type);
-    string key = keywordsToken[keyword];
-    std::vector<uint32_t> delCnts;
-    for (auto item : resDel) {
-        string cnt = Utilities::decode(item);
-        delCnts.push_back(stoi(cnt));
+void DianaInterface::reinsertKeyword(const string& keyword, const index_type* inds, size_t count, UpdateRequest<index_type>* u_reqs, pair<update_token_type, update_token_type>* delCnts) {
+    keyword_id_type id = keywordId(keyword);
+    KeywordState* next = cleanings.find(id);
+    if (next == nullptr) {
+        throw std::logic_error("No cleaning search is running for this keyword");
     }
-    ins_s_req = clientIns->search_request(key, delCnts);
-    totalSearchCommSize += sizeof (ins_s_req.add_count) + sizeof (ins_s_req.kw_token) + ins_s_req.token_list.size()*(1 + sizeof (search_token_key_type));
+    bulkInsert(id, *next, inds, count, u_reqs, delCnts);
 }
 
 //This function is used for the client and server mode
-void DianaInterface::processSearch(std::list<index_type>& resIns, string keyword) {
-    totalSearchCommSize += resIns.size() * sizeof (index_type);
-    if (deleteResults) {
-        keywordsCounter[keyword]++;
-        keywordsToken[keyword] = keyword + to_string(keywordsCounter[keyword]);
+void DianaInterface::finishCleaning(const string& keyword, bool complete) {
+    keyword_id_type id = keywordId(keyword);
+    KeywordState next;
+    if (!cleanings.get(id, next)) {
+        return;
+    }
+    if (complete) {
+        // later cleanings can have been started meanwhile
+        next.nextGeneration = std::max(next.nextGeneration, keywordState(id).nextGeneration);
+        states->set(id, next);
     }
+    cleanings.remove(id);
+}
+
+void DianaInterface::writeStateSnapshot(const string& path) const {
+    states->write_snapshot(path);
 }
 
 //This function is used for the client and server mode
-void DianaInterface::deleteKeyword(string keyword, index_type ind) {
-    totalUpdateCommSize = 0;
-    string key;
-    if (keywordsToken.count(keyword) != 0) {
-        key = keywordsToken[keyword];
-    } else {
-        keywordsCounter[keyword] = 1;
-        key = keyword + to_string(keywordsCounter[keyword]);
-        keywordsToken[keyword] = key;
-    }
-    UpdateRequest<update_token_type> u_req;
-    string hash_string = sse::crypto::Hash::hash(key + "|" + to_string(ind));
-    update_token_type delCntMapKey;
-    std::copy_n(hash_string.begin(), kUpdateTokenSize, delCntMapKey.begin());
-    uint32_t kw_counter;
-    u_req = clientDel->update_request(key, delCntMapKey, kw_counter);
-    serverDel->update(u_req);
-    totalUpdateCommSize = (2 * kUpdateTokenSize);
+void DianaInterface::processSearchResults(size_t resultCount) {
+    totalSearchCommSize += resultCount * sizeof (index_type);
 }
 
-//This function is used for the single machine mode
+//This function is used for the client and server mode
 void DianaInterface::deleteKeyword(string keyword, index_type ind, UpdateRequest<update_token_type>& u_req) {
     totalUpdateCommSize = 0;
-    string key;
-    if (keywordsToken.count(keyword) != 0) {
-        key = keywordsToken[keyword];
-    } else {
-        keywordsCounter[keyword] = 1;
-        key = keyword + to_string(keywordsCounter[keyword]);
-        keywordsToken[keyword] = key;
-    }
-    string hash_string = sse::crypto::Hash::hash(key + "|" + to_string(ind));
-    update_token_type delCntMapKey;
-    std::copy_n(hash_string.begin(), kUpdateTokenSize, delCntMapKey.begin());
-    uint32_t kw_counter;
-    u_req = clientDel->update_request(key, delCntMapKey, kw_counter);
+    keyword_id_type id = keywordId(keyword);
+    KeywordState state = keywordState(id);
+    update_token_type delCntMapKey = deleteKey(treeIndex(id, state.generation, kInsertionTree), ind);
+    u_req = clientDel->update_request(treeIndex(id, state.generation, kDeletionTree), state.delCount++, delCntMapKey);
+    states->set(id, state);
     totalUpdateCommSize = (2 * kUpdateTokenSize);
 }
 
+//This function is used for the single machine mode
+void DianaInterface::deleteKeyword(string keyword, index_type ind) {
+    UpdateRequest<update_token_type> u_req;
+    deleteKeyword(keyword, ind, u_req);
+    serverDel->update(u_req);
+}
+
 int DianaInterface::getTotalSearchCommSize() const {
     return totalSearchCommSize;
 }
@@ -4,6 +4,7 @@
 #include <fstream>
 #include <memory>
 #include <map>
+#include <vector>
 
 #include "diana/diana_client.hpp"
 #include "diana/diana_server.hpp"
@@ -17,30 +18,76 @@ typedef uint64_t index_type;
 
 class DianaInterface {
 private:
+    static const size_t kKeywordIdSize = 16;
+    static const uint8_t kInsertionTree = 0;
+    static const uint8_t kDeletionTree = 1;
+    typedef std::array<uint8_t, kKeywordIdSize> keyword_id_type;
+    typedef DianaClient<index_type>::keyword_index_type keyword_index_type;
+
+    // Keyword state, keyed by the hash of the keyword: its generation
+    // (bumped by the cleaning searches), the number of leaves used in the
+    // insertion and deletion trees of that generation, and the generation of
+    // the next cleaning. The latter is taken when a cleaning starts, so that
+    // a retry never writes to the trees of an abandoned one: the server keeps
+    // the first value of a leaf token. It is one packed record of the state
+    // store.
+    struct KeywordState {
+        uint32_t generation;
+        uint32_t insCount;
+        uint32_t delCount;
+        uint32_t nextGeneration;
+    };
+
+    static keyword_id_type keywordId(const string& keyword);
+    static keyword_index_type treeIndex(const keyword_id_type& id, uint32_t generation, uint8_t tree);
+    static update_token_type deleteKey(const keyword_index_type& insIndex, index_type ind);
+    // the state of a keyword never updated is all zeros
+    KeywordState keywordState(const keyword_id_type& id) const;
+    void bulkInsert(const keyword_id_type& id, KeywordState& state, const index_type* inds, size_t count, UpdateRequest<index_type>* u_reqs, pair<update_token_type, update_token_type>* delCnts);
+
     void initializeClient();
     bool deleteResults;
-    map< string, string> keywordsToken;
-    map< string, int> keywordsCounter;
+    unique_ptr<sse::sophos::RecordStore<KeywordState> > states;
+    // next generation of the keywords whose cleaning search is running
+    sse::sophos::FlatTokenMap<kKeywordIdSize, KeywordState> cleanings;
     double totalUpdateCommSize;
     int totalSearchCommSize;
     bool setupMode;
+    uint8_t searchThreads;
     unique_ptr<DianaClient<update_token_type>> clientDel;
     unique_ptr<DianaServer<update_token_type>> serverDel;
     unique_ptr<DianaClient<index_type>> clientIns;
     unique_ptr<DianaServer<index_type>> serverIns;
 
 public:
-    DianaInterface(bool usehdd, bool initialize, bool deleteResults);
+    // The keyword states are kept in stateBackend at diana_client_state.sav
+    // (kRocksDB keeps them across restarts, like the key files; kSnapshot
+    // opens a writeStateSnapshot file for searches only).
+    // Single-threaded searches by default, like the single machine benchmarks
+    // always ran; searchThreads = 0 uses one search worker per core.
+    DianaInterface(bool usehdd, bool initialize, bool deleteResults, sse::sophos::CounterStore::Backend stateBackend = sse::sophos::CounterStore::Backend::kMemory, uint8_t searchThreads = 1);
     void initializeClientAndServer(bool usehdd);
     virtual ~DianaInterface();
     void insertKeyword(string key, index_type ind);
     void insertKeyword(string key, index_type ind, UpdateRequest<index_type>& u_req, update_token_type& delCntMapKey, update_token_type& delCntMapValue);
+    // Requests inserting the count indexes for the same keyword: the keyword
+    // is looked up once and its leaves are derived together.
+    void bulkInsertKeyword(const string& key, const index_type* inds, size_t count, UpdateRequest<index_type>* u_reqs, pair<update_token_type, update_token_type>* delCnts);
+    void bulkInsertKeywords(const vector<pair<string, index_type> >& updates);
     void deleteKeyword(string key, index_type ind);
     void deleteKeyword(string key, index_type ind, UpdateRequest<update_token_type>& u_req);
-    void searchDeletedKeyword(string key, SearchRequest& del_s_req);
-    void searchInsertedKeyword(string key, std::list<update_token_type>& resDel, SearchRequest& ins_s_req);
-    void processSearch(std::list<index_type>& resIns, string keyword);
-    list<index_type> searchKeyword(string key);
+    // Both requests of a single round trip search (see search_with_deletions).
+    void searchKeywordRequests(string key, SearchRequest& del_s_req, SearchRequest& ins_s_req);
+    // In cleaning mode, the results of a search are re-inserted in the next
+    // generation of the keyword. The keyword only moves to it with
+    // finishCleaning(key, true), once all the results were received and
+    // re-inserted: until then, and after finishCleaning(key, false), it keeps
+    // its current trees.
+    void reinsertKeyword(const string& key, const index_type* inds, size_t count, UpdateRequest<index_type>* u_reqs, pair<update_token_type, update_token_type>* delCnts);
+    void finishCleaning(const string& key, bool complete);
+    void processSearchResults(size_t resultCount);
+    void writeStateSnapshot(const string& path) const;
+    vector<index_type> searchKeyword(string key);
     int getTotalSearchCommSize() const;
     double getTotalUpdateCommSize() const;
     bool isSetupMode() const; 
@@ -1,6 +1,20 @@
 #include "DianaServerRunner.h"
 
-DianaServerRunner::DianaServerRunner() {
+#include <chrono>
+#include <thread>
+
+static void toSearchRequest(const SearchRequestMessage& mes, SearchRequest& req) {
+    req.add_count = mes.add_count();
+    for (auto it = mes.token_list().begin(); it != mes.token_list().end(); ++it) {
+        search_token_key_type st;
+        std::copy(it->token().begin(), it->token().end(), st.begin());
+        req.token_list.push_back(std::make_pair(st, it->depth()));
+    }
+    std::copy(mes.kw_token().begin(), mes.kw_token().end(), req.kw_token.begin());
+}
+
+DianaServerRunner::DianaServerRunner(uint8_t searchThreads, size_t resultCacheSize) : resultCacheSize(resultCacheSize) {
+    this->searchThreads = (searchThreads > 0) ? searchThreads : DianaServer<index_type>::default_threads_count();
 }
 
 DianaServerRunner::~DianaServerRunner() {
@@ -44,6 +58,9 @@ grpc::Status DianaServerRunner::setup(grpc::ServerContext* context, const SetupM
     }
     client_master_key_in.close();
     client_kw_token_master_key_in.close();
+
+    serverDel->set_result_cache_capacity(resultCacheSize);
+    serverIns->set_result_cache_capacity(resultCacheSize);
     return grpc::Status::OK;
 }
 
@@ -51,6 +68,7 @@ grpc::Status DianaServerRunner::deleteKeyword(grpc::ServerContext* context, cons
     UpdateRequest<update_token_type> req;
     std::copy(mes->update_token().begin(), mes->update_token().end(), req.token.begin());
     std::copy(mes->index().begin(), mes->index().end(), req.index.begin());
+    std::lock_guard<std::shared_timed_mutex> lock(indexMutex);
     Utilities::startTimer(10);
     serverDel->update(req);
     auto t = Utilities::stopTimer(10);
@@ -65,74 +83,90 @@ grpc::Status DianaServerRunner::insertKeyword(grpc::ServerContext* context, cons
     std::copy(mes->update_token().begin(), mes->update_token().end(), req.token.begin());
     std::copy(mes->delete_key().begin(), mes->delete_key().end(), delCntMapKey.begin());
     std::copy(mes->delete_value().begin(), mes->delete_value().end(), delCntMapValue.begin());
+    std::lock_guard<std::shared_timed_mutex> lock(indexMutex);
     Utilities::startTimer(10);
     serverIns->update(req);
-    serverDel->delCntMap[delCntMapKey] = delCntMapValue;
+    serverDel->put_del_counter(delCntMapKey, delCntMapValue);
     auto t = Utilities::stopTimer(10);
     response->set_comptime(t);
     return grpc::Status::OK;
 }
 
 grpc::Status DianaServerRunner::batchInsertKeyword(grpc::ServerContext* context, const BatchInsertRequestMessage* mes, UpdateResponse* response) {
-    double totalTime=0;
-    for (int i = 0; i < mes->index_size(); i++) {
-        update_token_type delCntMapKey, delCntMapValue;
-        UpdateRequest<index_type> req;
-        req.index = mes->index(i);
-        std::copy(mes->update_token(i).begin(), mes->update_token(i).end(), req.token.begin());
-        std::copy(mes->delete_key(i).begin(), mes->delete_key(i).end(), delCntMapKey.begin());
-        std::copy(mes->delete_value(i).begin(), mes->delete_value(i).end(), delCntMapValue.begin());
-        Utilities::startTimer(10);
-        serverIns->update(req);
-        serverDel->delCntMap[delCntMapKey] = delCntMapValue;
-        auto t = Utilities::stopTimer(10);
-        totalTime+=t;
-    }
-    response->set_comptime(totalTime);
+    response->set_comptime(applyBatchInsert(*mes));
     return grpc::Status::OK;
 }
 
-grpc::Status DianaServerRunner::searchDelete(grpc::ServerContext* context, const SearchRequestMessage* mes, SearchDelReply* reply) {
-    SearchRequest req;
-    std::list<update_token_type> resDel;
-    req.add_count = mes->add_count();
-    for (auto it = mes->token_list().begin(); it != mes->token_list().end(); ++it) {
-        search_token_key_type st;
-        std::copy(it->token().begin(), it->token().end(), st.begin());
-        req.token_list.push_back(std::make_pair(st, it->depth()));
+double DianaServerRunner::applyBatchInsert(const BatchInsertRequestMessage& mes) {
+    std::vector<UpdateRequest<index_type> > reqs(mes.index_size());
+    std::vector<std::pair<update_token_type, update_token_type> > delCnts(mes.index_size());
+    for (int i = 0; i < mes.index_size(); i++) {
+        reqs[i].index = mes.index(i);
+        std::copy(mes.update_token(i).begin(), mes.update_token(i).end(), reqs[i].token.begin());
+        std::copy(mes.delete_key(i).begin(), mes.delete_key(i).end(), delCnts[i].first.begin());
+        std::copy(mes.delete_value(i).begin(), mes.delete_value(i).end(), delCnts[i].second.begin());
     }
-    std::copy(mes->kw_token().begin(), mes->kw_token().end(), req.kw_token.begin());
+    std::lock_guard<std::shared_timed_mutex> lock(indexMutex);
     Utilities::startTimer(10);
-    resDel = serverDel->search_simple_parallel(req, 1, false);
-    auto t = Utilities::stopTimer(10);
-    reply->set_comptime(t);
-    for (auto it : resDel) {
-        auto targetValue = serverDel->delCntMap[it];
-        reply->add_result(targetValue.data(), targetValue.size());
-    }
-    return grpc::Status::OK;
+    serverIns->bulk_update(reqs);
+    serverDel->put_del_counters(delCnts);
+    return Utilities::stopTimer(10);
 }
 
-grpc::Status DianaServerRunner::searchInsert(grpc::ServerContext* context, const SearchRequestMessage* mes, SearchInsReply* reply) {
-    SearchRequest req;
-    std::list<index_type> resIns;
-    req.add_count = mes->add_count();
-    for (int i = 0; i < mes->token_list_size(); i++) {
-        SearchToken searchToen = mes->token_list(i);
-        search_token_key_type st;
-        std::copy(searchToen.token().begin(), searchToen.token().end(), st.begin());
-        req.token_list.push_back(std::make_pair(st, searchToen.depth()));
+grpc::Status DianaServerRunner::search(grpc::ServerContext* context, grpc::ServerReaderWriter<SearchStreamReply, SearchStreamRequest>* stream) {
+    SearchStreamRequest request;
+    if (!stream->Read(&request) || !request.has_search()) {
+        return grpc::Status(grpc::StatusCode::INVALID_ARGUMENT, "The stream must start with a search request");
+    }
+    SearchRequest delReq, insReq;
+    toSearchRequest(request.search().delete_request(), delReq);
+    toSearchRequest(request.search().insert_request(), insReq);
+
+    std::vector<index_type> resIns;
+    double t;
+    {
+        std::shared_lock<std::shared_timed_mutex> lock(indexMutex);
+        // the Utilities timers are not thread safe, and searches run together
+        auto begin = std::chrono::high_resolution_clock::now();
+        resIns = search_with_deletions(*serverDel, *serverIns, delReq, insReq, searchThreads);
+        t = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - begin).count();
     }
 
-    std::copy(mes->kw_token().begin(), mes->kw_token().end(), req.kw_token.begin());
-    Utilities::startTimer(10);
-    resIns = serverIns->search_simple_parallel(req, 1, false);
-    auto t = Utilities::stopTimer(10);
-    reply->set_comptime(t);
-    for (auto it : resIns) {
-        reply->add_result((uint64_t) it);
+    // Re-insertions of the cleaning mode, until the client closes its side.
+    // They are read while the results are written: the client sends one per
+    // chunk it gets, and would stop reading if they were left in flight.
+    double totalTime = 0;
+    std::thread reinsertReader([this, stream, &totalTime]() {
+        SearchStreamRequest reinsert;
+        while (stream->Read(&reinsert)) {
+            if (reinsert.has_reinsert()) {
+                totalTime += applyBatchInsert(reinsert.reinsert());
+            }
+        }
+    });
+
+    SearchStreamReply reply;
+    size_t sent = 0;
+    bool writing = true;
+    do {
+        size_t count = std::min(resIns.size() - sent, (size_t) kResultChunkSize);
+        reply.Clear();
+        reply.mutable_result()->Resize(count, 0);
+        std::copy(resIns.begin() + sent, resIns.begin() + sent + count, reply.mutable_result()->mutable_data());
+        sent += count;
+        if (sent == resIns.size()) {
+            reply.set_last(true);
+            reply.set_comptime(t);
+        }
+        writing = stream->Write(reply);
+    } while (writing && sent < resIns.size());
+
+    reinsertReader.join();
+    if (!writing) {
+        return grpc::Status(grpc::StatusCode::CANCELLED, "The client went away during the search");
     }
+    reply.Clear();
+    reply.set_comptime(totalTime);
+    stream->Write(reply);
     return grpc::Status::OK;
 }
-
-
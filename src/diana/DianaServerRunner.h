@@ -6,6 +6,7 @@
 #include <string>
 #include <memory>
 #include <mutex>
+#include <shared_mutex>
 #include <string>
 #include <iostream>
 #include <grpc++/server.h>
@@ -18,18 +19,29 @@ typedef uint64_t index_type;
 
 class DianaServerRunner : public Diana::Service {
 public:
-    DianaServerRunner();
+    // searchThreads = 0 uses one search worker per core; resultCacheSize is
+    // the capacity (in results) of the search result caches, 0 disables them
+    DianaServerRunner(uint8_t searchThreads = 0, size_t resultCacheSize = 0);
     virtual ~DianaServerRunner();
     grpc::Status setup(grpc::ServerContext* context, const SetupMessage* request, google::protobuf::Empty* e) ;
     grpc::Status insertKeyword(grpc::ServerContext* context, const InsertRequestMessage* request, UpdateResponse* response) ;
     grpc::Status batchInsertKeyword(grpc::ServerContext* context, const BatchInsertRequestMessage* request, UpdateResponse* response) ;
     grpc::Status deleteKeyword(grpc::ServerContext* context, const DeleteRequestMessage* request, UpdateResponse* response) ;
-    grpc::Status searchDelete(grpc::ServerContext* context, const SearchRequestMessage* mes, SearchDelReply* res) ;
-    grpc::Status searchInsert(grpc::ServerContext* context, const SearchRequestMessage* mes, SearchInsReply* res) ;
+    grpc::Status search(grpc::ServerContext* context, grpc::ServerReaderWriter<SearchStreamReply, SearchStreamRequest>* stream) ;
+
+    // number of results per streamed reply
+    static const int kResultChunkSize = 16384;
 private:
+    double applyBatchInsert(const BatchInsertRequestMessage& mes);
     unique_ptr<DianaServer<update_token_type> > serverDel;
     unique_ptr<DianaServer<index_type> > serverIns;
+    // the calls run on several gRPC threads (pipelined batch inserts), while
+    // the indexes are not synchronized: the searches only read them and can
+    // run together, the updates run alone
+    std::shared_timed_mutex indexMutex;
     bool deleteItem;
+    uint8_t searchThreads;
+    size_t resultCacheSize;
 };
 
 #endif /* DIANASERVERRUNNER_H */
\ No newline at end of file
@@ -28,10 +28,13 @@
 #include "diana_common.hpp"
 
 #include "utils/rocksdb_wrapper.hpp"
+#include "utils/counter_store.hpp"
 #include "utils/utils.hpp"
 #include "utils/logger.hpp"
 #include <stdlib.h>
 #include <map>
+#include <vector>
+#include <algorithm>
 #include <string>
 #include <sse/crypto/block_hash.hpp>
 
@@ -57,23 +60,45 @@ namespace sse {
 
             static constexpr size_t kTreeDepth = 48;
 
-            DianaClient(const std::string& token_map_path);
-            DianaClient(const std::string& token_map_path, const std::string& derivation_master_key, const std::string& kw_token_master_key);
+            typedef sophos::CounterStore CounterStore;
+
+            // the keyword counters are kept in a counter_backend store at token_map_path;
+            // a kSnapshot client can only search
+            DianaClient(const std::string& token_map_path, const CounterStore::Backend counter_backend = CounterStore::Backend::kMemory);
+            DianaClient(const std::string& token_map_path, const std::string& derivation_master_key, const std::string& kw_token_master_key, const CounterStore::Backend counter_backend = CounterStore::Backend::kMemory);
             ~DianaClient();
 
             size_t keyword_count() const;
+            // the counters, for a search-only client opened with kSnapshot
+            void write_counter_snapshot(const std::string& path) const;
 
             const std::string master_derivation_key() const;
             const std::string kw_token_master_key() const;
 
             keyword_index_type get_keyword_index(const std::string &kw) const;
 
+            // the kw_token sent in the search requests for keyword
+            keyword_token_type keyword_token(const std::string &keyword) const;
+
             uint32_t get_match_count(const std::string &kw) const;
 
             SearchRequest search_request(const std::string &keyword, bool log_not_found = true) const;
             SearchRequest search_request(const std::string &keyword, std::vector<uint32_t> delCnts, bool log_not_found = true) const;
             UpdateRequest<T> update_request(const std::string &keyword, const index_type index, uint32_t& kw_counter);
-            std::list<UpdateRequest<T>> bulk_update_request(const std::list<std::pair<std::string, index_type>> &update_list);
+
+            // Stateless variants, for callers keeping the counters themselves:
+            // kw_index selects the tree, kw_counter is the leaf of the update
+            // and add_count the number of leaves used so far.
+            UpdateRequest<T> update_request(const keyword_index_type &kw_index, const uint32_t kw_counter, const index_type index) const;
+            SearchRequest search_request(const keyword_index_type &kw_index, const uint32_t add_count, std::vector<uint32_t> delCnts = std::vector<uint32_t>()) const;
+            keyword_token_type keyword_token(const keyword_index_type &kw_index) const;
+
+            // Requests for the count consecutive leaves of the tree kw_index
+            // starting at first_counter, written to out[0..count)
+            void bulk_update_request(const keyword_index_type &kw_index, const uint32_t first_counter, const index_type* indexes, const size_t count, UpdateRequest<T>* out) const;
+            // same as update_request for every pair of the list (in order), but
+            // each keyword's tree is derived once
+            std::vector<UpdateRequest<T>> bulk_update_request(const std::list<std::pair<std::string, index_type>> &update_list);
 
             bool remove_keyword(const std::string &kw);
 
@@ -86,18 +111,16 @@ namespace sse {
             const crypto::Prf<kKeywordTokenSize>& kw_token_prf() const;
 
             static const std::string derivation_keys_file__;
-            std::map<const std::string , uint32_t> ramCounter;
 
         private:
 
-            std::list<std::tuple<std::string, T, uint32_t>> get_counters_and_increment(const std::list<std::pair<std::string, index_type>> &update_list);
+            // number of leaves expanded at once by bulk_update_request
+            static constexpr size_t kBulkLeafBatch = 4096;
 
             crypto::Prf<kSearchTokenKeySize> root_prf_;
             crypto::Prf<kKeywordTokenSize> kw_token_prf_;
 
-
-
-            std::atomic_uint keyword_counter_;
+            std::unique_ptr<CounterStore> counters_;
         };
 
 
@@ -110,14 +133,14 @@ namespace sse {
     namespace diana {
 
         template <typename T>
-        DianaClient<T>::DianaClient(const std::string& token_map_path) :
-        root_prf_(), kw_token_prf_() {
+        DianaClient<T>::DianaClient(const std::string& token_map_path, const CounterStore::Backend counter_backend) :
+        root_prf_(), kw_token_prf_(), counters_(CounterStore::open(counter_backend, token_map_path)) {
 
         }
 
         template <typename T>
-        DianaClient<T>::DianaClient(const std::string& token_map_path, const std::string& derivation_master_key, const std::string& kw_token_master_key) :
-        root_prf_(derivation_master_key), kw_token_prf_(kw_token_master_key) {
+        DianaClient<T>::DianaClient(const std::string& token_map_path, const std::string& derivation_master_key, const std::string& kw_token_master_key, const CounterStore::Backend counter_backend) :
+        root_prf_(derivation_master_key), kw_token_prf_(kw_token_master_key), counters_(CounterStore::open(counter_backend, token_map_path)) {
         }
 
         template <typename T>
@@ -146,15 +169,53 @@ namespace sse {
         }
 
         template <typename T>
-        uint32_t DianaClient<T>::get_match_count(const std::string &kw) const {
-            uint32_t kw_counter;            
-            bool found = false;
-            if (ramCounter.count(kw) != 0) {
-                found = true;
-                kw_counter = ramCounter.at(kw);
+        keyword_token_type DianaClient<T>::keyword_token(const std::string &keyword) const {
+            return keyword_token(get_keyword_index(keyword));
+        }
+
+        template <typename T>
+        keyword_token_type DianaClient<T>::keyword_token(const keyword_index_type &kw_index) const {
+            return kw_token_prf_.prf(kw_index);
+        }
+
+        template <typename T>
+        UpdateRequest<T> DianaClient<T>::update_request(const keyword_index_type &kw_index, const uint32_t kw_counter, const index_type index) const {
+            UpdateRequest<T> req;
+            index_type mask;
+
+            TokenTree::token_type root = root_prf_.prf(kw_index.data(), kw_index.size());
+            search_token_key_type st = TokenTree::derive_node(root, kw_counter, kTreeDepth);
+
+            uint8_t stream[crypto::Prg::kBatchOutputSize];
+            std::copy(st.begin(), st.end(), stream);
+            gen_update_tokens_masks(stream, 1, &req.token, &mask);
+            req.index = xor_mask(index, mask);
+
+            return req;
+        }
+
+        template <typename T>
+        SearchRequest DianaClient<T>::search_request(const keyword_index_type &kw_index, const uint32_t add_count, std::vector<uint32_t> delCnts) const {
+            SearchRequest req;
+            req.add_count = add_count;
+
+            if (add_count > 0) {
+                TokenTree::token_type root = root_prf_.prf(kw_index.data(), kw_index.size());
+                if (delCnts.size() == 0) {
+                    req.token_list = TokenTree::covering_list(root, add_count, kTreeDepth);
+                } else {
+                    req.token_list = TokenTree::covering_list(root, add_count, kTreeDepth, delCnts);
+                }
+                req.kw_token = kw_token_prf_.prf(kw_index);
             }
+            return req;
+        }
+
+        template <typename T>
+        uint32_t DianaClient<T>::get_match_count(const std::string &kw) const {
+            uint32_t kw_counter;
 
-            return (found) ? kw_counter : 0;
+            return counters_->get(get_keyword_index(kw), kw_counter) ? kw_counter : 0;
         }
 
         template <typename T>
@@ -166,9 +227,8 @@ namespace sse {
             SearchRequest req;
             req.add_count = 0;
 
-            if (ramCounter.count(keyword) != 0) {
+            if (counters_->get(kw_index, kw_counter)) {
                 found = true;
-                kw_counter = ramCounter.at(keyword);
             }
 
             if (!found) {
@@ -200,9 +260,8 @@ namespace sse {
             SearchRequest req;
             req.add_count = 0;
 
-            if (ramCounter.count(keyword) != 0) {
+            if (counters_->get(kw_index, kw_counter)) {
                 found = true;
-                kw_counter = ramCounter.at(keyword);
             }
 
             if (!found) {
@@ -231,116 +290,79 @@ namespace sse {
 
         template <typename T>
         UpdateRequest<T> DianaClient<T>::update_request(const std::string &keyword, const index_type index, uint32_t& kw_counter) {
-            UpdateRequest<T> req;
-            search_token_key_type st;
-            index_type mask;
-
-            // get (and possibly construct) the keyword index
             keyword_index_type kw_index = get_keyword_index(keyword);
-            std::string seed(kw_index.begin(), kw_index.end());
 
-            if (ramCounter.count(keyword) != 0) {
-                kw_counter = ramCounter.at(keyword);
+            if (counters_->get(kw_index, kw_counter)) {
                 kw_counter++;
-                ramCounter.at(keyword) = kw_counter;
             } else {
-                ramCounter.insert(std::make_pair(keyword, 0));
                 kw_counter = 0;
             }
+            counters_->set(kw_index, kw_counter);
 
-            TokenTree::token_type root = root_prf_.prf(kw_index.data(), kw_index.size());
-
-            st = TokenTree::derive_node(root, kw_counter, kTreeDepth);
-
-            if (logger::severity() <= logger::DBG) {
-                logger::log(logger::DBG) << "New ST " << hex_string(st) << std::endl;
-            }
-
-
-            gen_update_token_mask(st, req.token, mask);
-
-            req.index = xor_mask(index, mask);
-
-            //            if (logger::severity() <= logger::DBG) {
-            //                logger::log(logger::DBG) << "Update Request: (" << hex_string(ut) << ", " << std::hex << req.index << ")" << std::endl;
-            //            }
-
-            return req;
+            return update_request(kw_index, kw_counter, index);
         }
 
         template <typename T>
-        std::list<UpdateRequest<T>> DianaClient<T>::bulk_update_request(const std::list<std::pair<std::string, index_type>> &update_list) {
-            std::string keyword;
-            index_type index;
-
-            std::list<UpdateRequest < T>> req_list;
-
-            std::list<std::tuple < std::string, T, uint32_t>> counter_list = get_counters_and_increment(update_list);
-
-            for (auto it = counter_list.begin(); it != counter_list.end(); ++it) {
-
-                keyword = std::get<0>(*it);
-                index = std::get<1>(*it);
-                UpdateRequest<T> req;
-                search_token_key_type st;
-                index_type mask;
-
-                // get (and possibly construct) the keyword index
-                keyword_index_type kw_index = get_keyword_index(keyword);
-                std::string seed(kw_index.begin(), kw_index.end());
-
-                // retrieve the counter
-                uint32_t kw_counter = std::get<2>(*it);
-
-
-                TokenTree::token_type root = root_prf_.prf(kw_index.data(), kw_index.size());
-
-                st = TokenTree::derive_node(root, kw_counter, kTreeDepth);
+        void DianaClient<T>::bulk_update_request(const keyword_index_type &kw_index, const uint32_t first_counter, const index_type* indexes, const size_t count, UpdateRequest<T>* out) const {
+            if (count == 0) {
+                return;
+            }
+            if (first_counter + (count - 1) < first_counter) {
+                throw std::out_of_range("Too many updates for a single keyword");
+            }
 
-                if (logger::severity() <= logger::DBG) {
-                    logger::log(logger::DBG) << "New ST " << hex_string(st) << std::endl;
+            // the root is derived once, and the consecutive leaves are expanded
+            // from their common subtrees instead of from the root one by one
+            TokenTree::token_type root = root_prf_.prf(kw_index.data(), kw_index.size());
+            const size_t batch_size = std::min<size_t>(count, kBulkLeafBatch);
+            std::vector<uint8_t> leaves(batch_size * crypto::Prg::kBatchOutputSize);
+            std::vector<update_token_type> tokens(batch_size);
+            std::vector<index_type> masks(batch_size);
+
+            for (size_t begin = 0; begin < count; begin += kBulkLeafBatch) {
+                const size_t n = std::min<size_t>(count - begin, kBulkLeafBatch);
+                TokenTree::derive_leaves(root, kTreeDepth, first_counter + begin, first_counter + begin + n - 1, leaves.data());
+                gen_update_tokens_masks(leaves.data(), n, tokens.data(), masks.data());
+
+                for (size_t i = 0; i < n; i++) {
+                    out[begin + i].token = tokens[i];
+                    out[begin + i].index = xor_mask(indexes[begin + i], masks[i]);
                 }
-
-
-                gen_update_token_mask(st, req.token, mask);
-
-                req.index = xor_mask(index, mask);
-
-                req_list.push_back(req);
             }
-
-            return req_list;
         }
 
         template <typename T>
-        std::list<std::tuple<std::string, T, uint32_t>> DianaClient<T>::get_counters_and_increment(const std::list<std::pair<std::string, index_type>> &update_list) {
-            std::string keyword;
-            index_type index;
-
-            std::list<std::tuple < std::string, index_type, uint32_t>> res;
-
-
-            for (auto it = update_list.begin(); it != update_list.end(); ++it) {
-
-
+        std::vector<UpdateRequest<T>> DianaClient<T>::bulk_update_request(const std::list<std::pair<std::string, index_type>> &update_list) {
+            // group the updates by keyword, remembering their position in the list
+            std::map<std::string, std::vector<std::pair<size_t, index_type>>> groups;
+            size_t pos = 0;
+            for (const auto& update : update_list) {
+                groups[update.first].push_back(std::make_pair(pos++, update.second));
+            }
 
-                keyword = it->first;
-                index = it->second;
+            std::vector<UpdateRequest<T>> res(update_list.size());
+            std::vector<index_type> indexes;
+            std::vector<UpdateRequest<T>> reqs;
 
-                // retrieve the counter
-                uint32_t kw_counter;
+            for (const auto& group : groups) {
+                keyword_index_type kw_index = get_keyword_index(group.first);
+                uint32_t first_counter = 0;
+                if (counters_->get(kw_index, first_counter)) {
+                    first_counter++;
+                }
+                counters_->set(kw_index, first_counter + group.second.size() - 1);
 
-                if (ramCounter.count(keyword) != 0) {
-                    kw_counter = ramCounter.at(keyword);
-                    kw_counter++;
-                    ramCounter.at(keyword) = kw_counter;
-                } else {
-                    ramCounter.insert(std::make_pair(keyword, 0));
-                    kw_counter=0;
+                indexes.resize(group.second.size());
+                reqs.resize(group.second.size());
+                for (size_t i = 0; i < group.second.size(); i++) {
+                    indexes[i] = group.second[i].second;
                 }
 
-                res.push_back(std::make_tuple(keyword, index, kw_counter));
+                bulk_update_request(kw_index, first_counter, indexes.data(), indexes.size(), reqs.data());
 
+                for (size_t i = 0; i < group.second.size(); i++) {
+                    res[group.second[i].first] = reqs[i];
+                }
             }
 
             return res;
@@ -348,8 +370,7 @@ namespace sse {
 
         template <typename T>
         bool DianaClient<T>::remove_keyword(const std::string &kw) {
-            ramCounter.erase(kw);
-            return true;
+            return counters_->remove(get_keyword_index(kw));
         }
 
         template <typename T>
@@ -361,7 +382,12 @@ namespace sse {
 
         template <typename T>
         size_t DianaClient<T>::keyword_count() const {
-            return ramCounter.size();
+            return counters_->size();
+        }
+
+        template <typename T>
+        void DianaClient<T>::write_counter_snapshot(const std::string& path) const {
+            counters_->write_snapshot(path);
         }
 
     }
@@ -28,9 +28,42 @@ namespace sse {
     namespace diana {
 
         void gen_update_token_mask(const uint8_t* search_token, update_token_type &update_token, const size_t mask_len, uint8_t *mask) {
-            crypto::Prg prg(search_token);
-            prg.derive(0, kUpdateTokenSize, update_token.data());
-            prg.derive(kUpdateTokenSize, mask_len, mask);
+            if (kUpdateTokenSize + mask_len > crypto::Prg::kBatchOutputSize) {
+                crypto::Prg prg(search_token);
+                prg.derive(0, kUpdateTokenSize, update_token.data());
+                prg.derive(kUpdateTokenSize, mask_len, mask);
+                return;
+            }
+
+            // token and mask from a single PRG call
+            uint8_t stream[crypto::Prg::kBatchOutputSize];
+            crypto::Prg::derive_batch(search_token, 1, stream);
+            memcpy(update_token.data(), stream, kUpdateTokenSize);
+            memcpy(mask, stream + kUpdateTokenSize, mask_len);
+        }
+
+        CounterCodec::CounterCodec(const keyword_token_type& kw_token) : prf_(kw_token.data(), kw_token.size()) {
+        }
+
+        update_token_type CounterCodec::encode(const update_token_type& del_key, const uint32_t counter) const {
+            update_token_type mask = prf_.prf(del_key);
+            sophos::Payload payload;
+            payload.id = 0;
+            payload.counter = counter;
+            payload.insertion = true;
+
+            return sophos::PayloadCodec::encode(payload, mask.data());
+        }
+
+        bool CounterCodec::decode(const update_token_type& del_key, const update_token_type& value, uint32_t& counter) const {
+            update_token_type mask = prf_.prf(del_key);
+            sophos::Payload payload;
+
+            if (!sophos::PayloadCodec::decode(value, mask.data(), payload) || payload.id != 0) {
+                return false;
+            }
+            counter = payload.counter;
+            return true;
         }
 
     }
@@ -22,8 +22,11 @@
 #pragma once
 
 #include "types.hpp"
+#include "utils/payload_codec.hpp"
 
 #include <sse/crypto/block_hash.hpp>
+#include <sse/crypto/prf.hpp>
+#include <sse/crypto/prg.hpp>
 
 #include <cstring>
 
@@ -32,6 +35,27 @@ namespace sse {
 
         void gen_update_token_mask(const uint8_t* search_token, update_token_type &update_token, const size_t mask_len, uint8_t *mask);
 
+        /*
+         * Values of the delCntMap: a Payload holding the counter of an
+         * insertion (and a zero id), masked with a PRF of its delete key. The
+         * PRF is keyed with the keyword token of the insertion tree, which the
+         * server only learns when the keyword is searched, so that it can map
+         * the results of the deletion tree to counters without another round
+         * trip.
+         */
+        class CounterCodec {
+        public:
+            explicit CounterCodec(const keyword_token_type& kw_token);
+
+            update_token_type encode(const update_token_type& del_key, const uint32_t counter) const;
+
+            // returns false if the value was not encoded under this keyword token
+            bool decode(const update_token_type& del_key, const update_token_type& value, uint32_t& counter) const;
+
+        private:
+            crypto::Prf<kUpdateTokenSize> prf_;
+        };
+
         template <typename T>
         inline void gen_update_token_mask(const search_token_key_type &search_token, update_token_type &update_token, T &mask) {
             static_assert(crypto::Prg::kKeySize == kSearchTokenKeySize, "Invalid search token size");
@@ -49,6 +73,27 @@ namespace sse {
             gen_update_token_mask(search_token.data(), update_token, N, mask.data());
         }
 
+        /*
+         * Batch version of gen_update_token_mask. stream holds count consecutive
+         * search tokens and must have room for count*kStreamSize bytes: every
+         * token is expanded in place into a single two block PRG output,
+         * holding both the update token and the mask (no Prg object nor
+         * allocation, and the keys are processed 8 at a time).
+         */
+        template <typename T>
+        inline void gen_update_tokens_masks(uint8_t* stream, const size_t count, update_token_type* update_tokens, T* masks) {
+            constexpr size_t kStreamSize = crypto::Prg::kBatchOutputSize;
+            static_assert(crypto::Prg::kKeySize == kSearchTokenKeySize, "Invalid search token size");
+            static_assert(kUpdateTokenSize + sizeof (T) <= kStreamSize, "Mask too large for a batch derivation");
+
+            crypto::Prg::derive_batch(stream, count, stream);
+
+            for (size_t i = 0; i < count; i++) {
+                memcpy(update_tokens[i].data(), stream + i * kStreamSize, kUpdateTokenSize);
+                memcpy((uint8_t*) & masks[i], stream + i * kStreamSize + kUpdateTokenSize, sizeof (T));
+            }
+        }
+
 
     }
 }
@@ -28,14 +28,22 @@
 #include "utils/thread_pool.hpp"
 
 #include "utils/rocksdb_wrapper.hpp"
+#include "utils/flat_token_map.hpp"
+#include "utils/result_cache.hpp"
+#include "utils/work_stealing_pool.hpp"
 #include "../utils/Utilities.h"
 
 #include <map>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <algorithm>
 #include <sse/crypto/prf.hpp>
 //#include <param.h>
 using namespace std;
 
 #define DIANA_MIN(a,b) (((a) > (b)) ? (b) : (a))
+#define DIANA_MAX(a,b) (((a) < (b)) ? (b) : (a))
 
 namespace sse {
     namespace diana {
@@ -45,26 +53,52 @@ namespace sse {
         public:
 
             typedef T index_type;
+            static constexpr uint64_t kLeafBatchSize = 1024;
+
+            // one search worker per core (the calling thread included)
+            static uint8_t default_threads_count();
             bool usehdd;
 
             DianaServer(const std::string& db_path, bool usehdd);
             DianaServer(const std::string& db_path, const size_t tm_setup_size, bool usehdd);
 
 
-            std::list<index_type> search(const SearchRequest& req, bool delete_results = false);
+            std::vector<index_type> search(const SearchRequest& req, bool delete_results = false);
             void search(const SearchRequest& req, const std::function<void(index_type)> &post_callback, bool delete_results = false);
             void search_simple(const SearchRequest& req, const std::function<void(index_type)> &post_callback, bool delete_results = false);
 
-            std::list<index_type> search_simple_parallel(const SearchRequest& req, uint8_t threads_count, bool delete_results = false);
+            // Several threads can run parallel searches at the same time: they
+            // share the pool of the server. Updates must not run meanwhile.
+            std::vector<index_type> search_simple_parallel(const SearchRequest& req, uint8_t threads_count, bool delete_results = false);
+            // appends the matches to results, in leaf order
             void search_simple_parallel(const SearchRequest& req, uint8_t threads_count, std::vector<index_type> &results, bool delete_results = false);
             void search_simple_parallel(const SearchRequest& req, const std::function<void(index_type)> &post_callback, uint8_t threads_count, bool delete_results = false);
             void search_simple_parallel(const SearchRequest& req, const std::function<void(index_type, uint8_t)> &post_callback, uint8_t threads_count, bool delete_results = false);
 
-            map<update_token_type, T> curMap;
+            // Opt-in cache of the results of the searches returning a vector,
+            // keyed by the keyword token, the add count and the covering list
+            // (pruned by search_with_deletions). capacity is a number of
+            // results, 0 (the default) disables it. The deleting searches are
+            // never served from it.
+            void set_result_cache_capacity(const size_t capacity);
+            typename sophos::ResultCache<index_type>::Stats result_cache_stats() const;
+
+            sophos::FlatTokenMap<kUpdateTokenSize, T> curMap;
+
+            // The delCntMap maps the delete keys to masked counters (see
+            // CounterCodec). Like the index, it lives in memory or, with
+            // usehdd, in its own RocksDB base next to edb_.
+            void put_del_counter(const update_token_type& key, const update_token_type& value);
+            void put_del_counters(const std::vector<std::pair<update_token_type, update_token_type>>& entries);
 
-            map<update_token_type, update_token_type> delCntMap;
+            // Maps results of a deletion tree to the counters they were
+            // stored with in the delCntMap. Unknown keys and values encoded
+            // under another keyword token are skipped.
+            std::vector<uint32_t> deleted_counters(const std::vector<update_token_type>& del_keys, const keyword_token_type& kw_token) const;
 
             void update(const UpdateRequest<index_type>& req);
+            // inserts all the entries with a single write batch
+            void bulk_update(const std::vector<UpdateRequest<index_type>>& reqs);
 
             std::ostream& print_stats(std::ostream& out) const;
 
@@ -72,21 +106,50 @@ namespace sse {
         private:
             bool get_unmask(const uint8_t *key, index_type &index, bool delete_key);
 
+            // per worker scratch space of a parallel search, reused by the next ones
+            struct SearchBuffers {
+                std::vector<uint8_t> leaves;
+                std::vector<update_token_type> tokens;
+                std::vector<index_type> masks;
+                std::vector<index_type> values;
+                std::vector<uint8_t> found;
+                std::vector<update_token_type> removed;
+            };
+
+            typedef std::vector<SearchBuffers> SearchBufferSet;
+
+            // The searches share the pool, but each one gets a set of buffers
+            // of its own (one per worker), taken from the idle sets. Changing
+            // the thread count replaces the pool: the running searches keep
+            // the former one alive.
+            std::shared_ptr<WorkStealingPool> acquire_search_pool(uint8_t threads_count, std::unique_ptr<SearchBufferSet> &buffers);
+            void release_search_buffers(std::unique_ptr<SearchBufferSet> buffers);
+
+            static std::string result_cache_key(const SearchRequest& req);
+            // appends the cached results of req to results; a deleting search
+            // drops the entry of req instead
+            bool cached_search(const SearchRequest& req, bool delete_results, std::vector<index_type> &results);
+            void cache_results(const SearchRequest& req, bool delete_results, typename std::vector<index_type>::const_iterator first, typename std::vector<index_type>::const_iterator last);
+
+            // number of leaves scanned by a search, cut in tasks of kLeafBatchSize leaves
+            static uint64_t search_leaf_count(const SearchRequest& req);
+
+            // emit(index, worker_id, task_index) is called for every match
+            void parallel_search(const SearchRequest& req, uint8_t threads_count, const std::function<void(index_type, uint32_t, size_t) > &emit, bool delete_results);
+            void search_leaves(SearchBuffers& buffers, const TokenTree::token_type& K, const uint8_t depth, const uint64_t start_index, const uint64_t end_index, const std::function<void(index_type) > &emit, bool delete_results);
+
             inline bool retrieve_entry(const update_token_type key, index_type &index, bool delete_key) {
                 bool found = false;
                 if (usehdd) {
                     found = edb_.get(key, index);
                 } else {
-                    if (curMap.count(key) > 0) {
-                        found = true;
-                        index = curMap[key];
-                    }
+                    found = curMap.get(key, index);
                 }
                 if (delete_key && found) {
                     if (usehdd) {
                         edb_.remove(key);
                     } else {
-                        curMap.erase(key);
+                        curMap.remove(key);
                     }
                 }
                 return found;
@@ -95,6 +158,18 @@ namespace sse {
 
             sophos::RockDBWrapper edb_;
 
+            sophos::FlatTokenMap<kUpdateTokenSize, update_token_type> delCntMap;
+            std::unique_ptr<sophos::RockDBWrapper> del_cnt_db_;
+
+            // protects search_pool_ and idle_buffers_
+            std::mutex search_mutex_;
+            std::shared_ptr<WorkStealingPool> search_pool_;
+            std::vector<std::unique_ptr<SearchBufferSet> > idle_buffers_;
+            // the parallel searches read the index together, their deferred
+            // removals are applied alone
+            std::shared_timed_mutex index_mutex_;
+
+            sophos::ResultCache<index_type> result_cache_;
         };
 
     }
@@ -103,16 +178,33 @@ namespace sse {
 namespace sse {
     namespace diana {
 
+        template <typename T>
+        constexpr uint64_t DianaServer<T>::kLeafBatchSize;
+
+        template <typename T>
+        uint8_t DianaServer<T>::default_threads_count() {
+            unsigned int cores = std::thread::hardware_concurrency();
+            return (uint8_t) DIANA_MIN(DIANA_MAX(cores, 1U), 255U);
+        }
+
         template <typename T>
         DianaServer<T>::DianaServer(const std::string& db_path, bool usehdd) :
         edb_(db_path) {
             this->usehdd = usehdd;
+            if (usehdd) {
+                del_cnt_db_.reset(new sophos::RockDBWrapper(db_path + ".delcnt"));
+            }
         }
 
         template <typename T>
         DianaServer<T>::DianaServer(const std::string& db_path, const size_t tm_setup_size, bool usehdd) :
         edb_(db_path) {
             this->usehdd = usehdd;
+            if (usehdd) {
+                del_cnt_db_.reset(new sophos::RockDBWrapper(db_path + ".delcnt"));
+            } else {
+                curMap.reserve(tm_setup_size);
+            }
         }
 
         template <typename T>
@@ -148,8 +240,11 @@ namespace sse {
         }
 
         template <typename T>
-        std::list<typename DianaServer<T>::index_type> DianaServer<T>::search(const SearchRequest& req, bool delete_results) {
-            std::list<index_type> results;
+        std::vector<typename DianaServer<T>::index_type> DianaServer<T>::search(const SearchRequest& req, bool delete_results) {
+            std::vector<index_type> results;
+            if (cached_search(req, delete_results, results)) {
+                return results;
+            }
 
             auto callback = [&results](index_type i) {
                 results.push_back(i);
@@ -157,6 +252,7 @@ namespace sse {
 
             search(req, callback, delete_results);
 
+            cache_results(req, delete_results, results.begin(), results.end());
             return results;
         }
 
@@ -255,163 +351,245 @@ namespace sse {
         }
 
         template <typename T>
-        std::list<typename DianaServer<T>::index_type> DianaServer<T>::search_simple_parallel(const SearchRequest& req, uint8_t threads_count, bool delete_results) {
-            assert(threads_count > 0);
-
-
-            // use one result list per thread so to avoid using locks
-            std::list<index_type> *result_lists = new std::list<index_type>[threads_count];
-
-            auto callback = [&result_lists](index_type i, uint8_t thread_id) {
-                result_lists[thread_id].push_back(i);
-            };
-
-            search_simple_parallel(req, callback, threads_count, delete_results);
-
-            // merge the result lists
-            std::list<index_type> results(std::move(result_lists[0]));
-            for (uint8_t i = 1; i < threads_count; i++) {
-                results.splice(results.end(), result_lists[i]);
-            }
-
-            delete [] result_lists;
-            //
-            //            index_type *result_array = new index_type[req.add_count];
-            //            std::atomic<uint64_t> r_index(0);
-            //
-            //            auto callback = [&result_array, &r_index](index_type i, uint8_t thread_id)
-            //            {
-            //                result_array[r_index++] = i;
-            //            };
-            //
-            //            search_simple_parallel(req, callback, threads_count);
-            //
-            //            std::list<index_type> results;
-            //
-            //            for (uint64_t i = 0; i < req.add_count; i++) {
-            //                results.push_back(result_array[i]);
-            //            }
-            //
-            //            delete [] result_array;
-
+        std::vector<typename DianaServer<T>::index_type> DianaServer<T>::search_simple_parallel(const SearchRequest& req, uint8_t threads_count, bool delete_results) {
+            std::vector<index_type> results;
+            search_simple_parallel(req, threads_count, results, delete_results);
             return results;
         }
 
         template <typename T>
         void DianaServer<T>::search_simple_parallel(const SearchRequest& req, uint8_t threads_count, std::vector<index_type> &results, bool delete_results) {
-            if (results.size() < req.add_count) {
-                // resize the vector if needed
-                results.reserve(req.add_count);
+            assert(threads_count > 0);
+            if (cached_search(req, delete_results, results)) {
+                return;
             }
 
-            std::atomic<uint64_t> r_index(0);
+            // every task owns the slice of the output matching its leaves, so
+            // the workers fill it without synchronization
+            const uint64_t leaf_count = search_leaf_count(req);
+            const size_t base = results.size();
+            std::vector<uint32_t> task_hits((leaf_count + kLeafBatchSize - 1) / kLeafBatchSize, 0);
+
+            results.resize(base + leaf_count);
+            index_type* out = results.data() + base;
 
-            auto callback = [&results, &r_index](index_type i, uint8_t thread_id) {
-                results[r_index++] = i;
+            auto emit = [out, &task_hits](index_type index, uint32_t worker_id, size_t task_index) {
+                out[task_index * kLeafBatchSize + task_hits[task_index]++] = index;
             };
 
-            search_simple_parallel(req, callback, threads_count, delete_results);
+            parallel_search(req, threads_count, emit, delete_results);
+
+            // close the gaps between the slices
+            size_t size = 0;
+            for (size_t t = 0; t < task_hits.size(); t++) {
+                if (size != t * kLeafBatchSize) {
+                    std::move(out + t * kLeafBatchSize, out + t * kLeafBatchSize + task_hits[t], out + size);
+                }
+                size += task_hits[t];
+            }
+            results.resize(base + size);
+
+            cache_results(req, delete_results, results.begin() + base, results.end());
         }
 
         template <typename T>
         void DianaServer<T>::search_simple_parallel(const SearchRequest& req, const std::function<void(index_type)> &post_callback, uint8_t threads_count, bool delete_results) {
-            auto aux = [&post_callback](index_type ind, uint8_t i) {
+            auto aux = [&post_callback](index_type ind, uint32_t worker_id, size_t task_index) {
                 post_callback(ind);
             };
-            search_simple_parallel(req, aux, threads_count, delete_results);
+            parallel_search(req, threads_count, aux, delete_results);
         }
 
         template <typename T>
         void DianaServer<T>::search_simple_parallel(const SearchRequest& req, const std::function<void(index_type, uint8_t)> &post_callback, uint8_t threads_count, bool delete_results) {
-            assert(threads_count > 0);
-            if (req.add_count == 0) {
-                return;
-            }
+            auto aux = [&post_callback](index_type ind, uint32_t worker_id, size_t task_index) {
+                post_callback(ind, (uint8_t) worker_id);
+            };
+            parallel_search(req, threads_count, aux, delete_results);
+        }
 
-            auto job = [this, &post_callback, delete_results](const uint8_t t_id, const SearchRequest& req, const uint64_t min_index, const uint64_t max_index) {
+        template <typename T>
+        std::shared_ptr<WorkStealingPool> DianaServer<T>::acquire_search_pool(uint8_t threads_count, std::unique_ptr<SearchBufferSet> &buffers) {
+            std::lock_guard<std::mutex> lock(search_mutex_);
 
+            if (!search_pool_ || search_pool_->size() != threads_count) {
+                search_pool_ = std::make_shared<WorkStealingPool>(threads_count);
+                idle_buffers_.clear();
+            }
+            if (idle_buffers_.empty()) {
+                buffers.reset(new SearchBufferSet(search_pool_->size()));
+            } else {
+                buffers = std::move(idle_buffers_.back());
+                idle_buffers_.pop_back();
+            }
+            return search_pool_;
+        }
 
-                auto get_callback = [this, t_id, &post_callback, delete_results](const uint8_t * key) {
-                    index_type index;
-                    if (get_unmask(key, index, delete_results)) {
-                        post_callback(index, t_id);
-                    }
-                };
+        template <typename T>
+        void DianaServer<T>::release_search_buffers(std::unique_ptr<SearchBufferSet> buffers) {
+            std::lock_guard<std::mutex> lock(search_mutex_);
 
-                uint64_t loc_min_index = min_index;
-                uint64_t loc_max_index = max_index;
+            // drop the sets of a replaced pool
+            if (search_pool_ && buffers->size() == search_pool_->size()) {
+                idle_buffers_.push_back(std::move(buffers));
+            }
+        }
 
-                // find the starting token
-                uint64_t leaf_count = 0;
+        template <typename T>
+        void DianaServer<T>::set_result_cache_capacity(const size_t capacity) {
+            result_cache_.set_capacity(capacity);
+        }
 
-                auto key_it = req.token_list.begin();
+        template <typename T>
+        typename sophos::ResultCache<T>::Stats DianaServer<T>::result_cache_stats() const {
+            return result_cache_.stats();
+        }
 
-                do {
-                    // this is the number of leafs for the current node
-                    leaf_count = (1UL << key_it->second);
+        template <typename T>
+        std::string DianaServer<T>::result_cache_key(const SearchRequest& req) {
+            std::string key(reinterpret_cast<const char*> (req.kw_token.data()), req.kw_token.size());
+            for (size_t i = 0; i < sizeof (req.add_count); i++) {
+                key.push_back((char) (req.add_count >> (8 * i)));
+            }
+            for (auto& node : req.token_list) {
+                key.append(reinterpret_cast<const char*> (node.first.data()), node.first.size());
+                key.push_back((char) node.second);
+            }
+            return key;
+        }
 
-                    if ((leaf_count <= loc_min_index)) {
-                        // the selected leaf does not cover the minimum index
-                        // get the next node
+        template <typename T>
+        bool DianaServer<T>::cached_search(const SearchRequest& req, bool delete_results, std::vector<index_type> &results) {
+            if (!result_cache_.enabled()) {
+                return false;
+            }
+            if (delete_results) {
+                // the entries are about to leave the EDB
+                result_cache_.erase(result_cache_key(req));
+                return false;
+            }
+            return result_cache_.get(result_cache_key(req), results);
+        }
 
-                        // update the local index counters
-                        loc_min_index -= leaf_count; // no underflow:
-                        loc_max_index -= leaf_count; // leaf_count <= loc_min_index <= loc_max_index
+        template <typename T>
+        void DianaServer<T>::cache_results(const SearchRequest& req, bool delete_results, typename std::vector<index_type>::const_iterator first, typename std::vector<index_type>::const_iterator last) {
+            if (!delete_results && result_cache_.enabled()) {
+                result_cache_.put(result_cache_key(req), first, last);
+            }
+        }
 
-                    } else if ((leaf_count > loc_max_index)) {
-                        // this is the last node for us
+        template <typename T>
+        void DianaServer<T>::search_leaves(SearchBuffers& buffers, const TokenTree::token_type& K, const uint8_t depth, const uint64_t start_index, const uint64_t end_index, const std::function<void(index_type) > &emit, bool delete_results) {
+            const uint64_t count = end_index - start_index + 1;
 
-                        TokenTree::derive_leaves(key_it->first, key_it->second, loc_min_index, loc_max_index, get_callback);
+            // room for the in place expansion of the leaves
+            buffers.leaves.resize(kLeafBatchSize * crypto::Prg::kBatchOutputSize);
+            TokenTree::derive_leaves(K, depth, start_index, end_index, buffers.leaves.data());
 
+            buffers.tokens.resize(kLeafBatchSize);
+            buffers.masks.resize(kLeafBatchSize);
+            buffers.values.resize(kLeafBatchSize);
+            buffers.found.resize(kLeafBatchSize);
 
+            gen_update_tokens_masks(buffers.leaves.data(), count, buffers.tokens.data(), buffers.masks.data());
 
-                        break;
-                    } else {
-                        // leaf_count > loc_min_index and leaf_count <= loc_max_index
+            if (usehdd) {
+                edb_.get_many(buffers.tokens[0].data(), kUpdateTokenSize, count, buffers.values.data(), buffers.found.data());
+            } else {
+                curMap.lookup_many(buffers.tokens[0].data(), count, buffers.values.data(), buffers.found.data());
+            }
 
+            for (uint64_t i = 0; i < count; i++) {
+                if (buffers.found[i]) {
+                    if (delete_results) {
+                        // the index is not modified while the other workers read it
+                        buffers.removed.push_back(buffers.tokens[i]);
+                    }
+                    emit(xor_mask(buffers.values[i], buffers.masks[i]));
+                }
+            }
+        }
 
-                        TokenTree::derive_leaves(key_it->first, key_it->second, loc_min_index, leaf_count - 1, get_callback);
+        template <typename T>
+        uint64_t DianaServer<T>::search_leaf_count(const SearchRequest& req) {
+            uint64_t leaf_count = 0;
 
-                        // update the local index counters
-                        loc_min_index = 0; // the first leaves have been generated now
-                        loc_max_index -= leaf_count; // leaf_count <= loc_min_index <= loc_max_index
+            for (auto& node : req.token_list) {
+                leaf_count += (1UL << node.second);
+            }
+            // do not go past the number of matches announced by the client
+            return DIANA_MIN(leaf_count, (uint64_t) req.add_count);
+        }
 
-                    }
+        template <typename T>
+        void DianaServer<T>::parallel_search(const SearchRequest& req, uint8_t threads_count, const std::function<void(index_type, uint32_t, size_t) > &emit_match, bool delete_results) {
+            assert(threads_count > 0);
+            if (req.add_count == 0) {
+                return;
+            }
 
+            // flatten the covering list: the leaves of all the nodes form a
+            // single index space, cut in tasks of kLeafBatchSize leaves
+            std::vector<const std::pair<search_token_key_type, uint8_t>*> nodes;
+            std::vector<uint64_t> node_offsets;
+            uint64_t offset = 0;
 
+            for (auto& node : req.token_list) {
+                nodes.push_back(&node);
+                node_offsets.push_back(offset);
+                offset += (1UL << node.second);
+            }
+            const uint64_t leaf_count = search_leaf_count(req);
 
-                    // get the next tree node
-                    ++key_it;
-                } while ((key_it != req.token_list.end()));
-            };
+            const uint64_t task_count = (leaf_count + kLeafBatchSize - 1) / kLeafBatchSize;
 
-            std::vector<std::thread> threads;
+            std::unique_ptr<SearchBufferSet> buffer_set;
+            std::shared_ptr<WorkStealingPool> pool = acquire_search_pool(threads_count, buffer_set);
 
-            threads_count = DIANA_MIN(threads_count, req.add_count);
+            auto task = [&](uint32_t worker_id, size_t task_index) {
+                SearchBuffers& buffers = (*buffer_set)[worker_id];
+                auto emit = [&emit_match, worker_id, task_index](index_type index) {
+                    emit_match(index, worker_id, task_index);
+                };
 
+                uint64_t first = task_index * kLeafBatchSize;
+                uint64_t last = DIANA_MIN(leaf_count, first + kLeafBatchSize) - 1;
 
-            size_t step = req.add_count / threads_count;
-            size_t remaining = req.add_count % threads_count;
+                size_t k = std::upper_bound(node_offsets.begin(), node_offsets.end(), first) - node_offsets.begin() - 1;
 
-            size_t min = 0;
-            size_t max = step;
+                // a task can span several small nodes
+                while (first <= last) {
+                    uint64_t node_last = node_offsets[k] + (1UL << nodes[k]->second) - 1;
+                    uint64_t end = DIANA_MIN(last, node_last);
 
-            for (uint8_t t = 0; t < threads_count; t++) {
+                    search_leaves(buffers, nodes[k]->first, nodes[k]->second, first - node_offsets[k], end - node_offsets[k], emit, delete_results);
 
-                if (t < remaining) {
-                    max++;
+                    first = end + 1;
+                    k++;
                 }
+            };
 
-                threads.push_back(std::thread(job, t, req, min, DIANA_MIN(max, req.add_count) - 1));
-
-                min = max;
-                max += step;
+            {
+                std::shared_lock<std::shared_timed_mutex> lock(index_mutex_);
+                pool->parallel_for(task_count, task);
             }
 
-            for (uint8_t t = 0; t < threads_count; t++) {
-                threads[t].join();
+            if (delete_results) {
+                std::lock_guard<std::shared_timed_mutex> lock(index_mutex_);
+                for (auto& buffers : *buffer_set) {
+                    if (usehdd) {
+                        if (buffers.removed.size() > 0) {
+                            edb_.remove_many(buffers.removed[0].data(), kUpdateTokenSize, buffers.removed.size());
+                        }
+                    } else {
+                        for (auto& token : buffers.removed) {
+                            curMap.remove(token);
+                        }
+                    }
+                    buffers.removed.clear();
+                }
             }
-
+            release_search_buffers(std::move(buffer_set));
         }
 
         template <typename T>
@@ -422,19 +600,125 @@ namespace sse {
             if (usehdd) {
                 edb_.put(req.token, req.index);
             } else {
-                curMap.insert(pair<update_token_type, T>(req.token, req.index));
+                curMap.insert(req.token, req.index);
+            }
+
+        }
+
+        template <typename T>
+        void DianaServer<T>::bulk_update(const std::vector<UpdateRequest<T>>& reqs) {
+            if (!usehdd) {
+                curMap.reserve(curMap.size() + reqs.size());
+                for (const auto& req : reqs) {
+                    curMap.insert(req.token, req.index);
+                }
+                return;
+            }
+
+            rocksdb::WriteBatch batch;
+            for (const auto& req : reqs) {
+                batch.Put(rocksdb::Slice(reinterpret_cast<const char*> (req.token.data()), kUpdateTokenSize),
+                        rocksdb::Slice(reinterpret_cast<const char*> (&req.index), sizeof (T)));
+            }
+            edb_.write(batch);
+        }
+
+        template <typename T>
+        void DianaServer<T>::put_del_counter(const update_token_type& key, const update_token_type& value) {
+            if (usehdd) {
+                del_cnt_db_->put(key, value);
+            } else {
+                delCntMap.put(key, value);
+            }
+        }
+
+        template <typename T>
+        void DianaServer<T>::put_del_counters(const std::vector<std::pair<update_token_type, update_token_type>>& entries) {
+            if (!usehdd) {
+                delCntMap.reserve(delCntMap.size() + entries.size());
+                for (const auto& e : entries) {
+                    delCntMap.put(e.first, e.second);
+                }
+                return;
             }
 
+            rocksdb::WriteBatch batch;
+            for (const auto& e : entries) {
+                batch.Put(rocksdb::Slice(reinterpret_cast<const char*> (e.first.data()), kUpdateTokenSize),
+                        rocksdb::Slice(reinterpret_cast<const char*> (e.second.data()), kUpdateTokenSize));
+            }
+            del_cnt_db_->write(batch);
         }
 
         template <typename T>
         std::ostream& DianaServer<T>::print_stats(std::ostream& out) const {
+            if (result_cache_.enabled()) {
+                auto stats = result_cache_.stats();
+                out << "Result cache: " << stats.hits << " hits, " << stats.misses << " misses, " << stats.evictions << " evictions; ";
+                out << stats.entries << " entries, " << stats.results << " results" << std::endl;
+            }
             return out;
         }
 
         template <typename T>
         void DianaServer<T>::flush_edb() {
             edb_.flush();
+            if (del_cnt_db_) {
+                del_cnt_db_->flush();
+            }
+        }
+
+        template <typename T>
+        std::vector<uint32_t> DianaServer<T>::deleted_counters(const std::vector<update_token_type>& del_keys, const keyword_token_type& kw_token) const {
+            CounterCodec codec(kw_token);
+            std::vector<update_token_type> values(del_keys.size());
+            std::vector<uint8_t> found(del_keys.size());
+            std::vector<uint32_t> counters;
+
+            if (del_keys.size() == 0) {
+                return counters;
+            }
+            if (usehdd) {
+                del_cnt_db_->get_many(del_keys[0].data(), kUpdateTokenSize, del_keys.size(), values.data(), found.data());
+            } else {
+                delCntMap.lookup_many(del_keys[0].data(), del_keys.size(), values.data(), found.data());
+            }
+
+            counters.reserve(del_keys.size());
+            for (size_t i = 0; i < del_keys.size(); i++) {
+                uint32_t counter;
+
+                if (!found[i]) {
+                    continue;
+                }
+                if (codec.decode(del_keys[i], values[i], counter)) {
+                    counters.push_back(counter);
+                }
+            }
+            return counters;
+        }
+
+        /*
+         * Search in a single round trip: the deletion tree is searched first,
+         * its results are mapped to counters through the delCntMap of
+         * server_del (using the kw_token of ins_req), and the deleted leaves
+         * are pruned from the covering list of ins_req before the insertion
+         * tree is searched.
+         */
+        template <typename I>
+        std::vector<I> search_with_deletions(DianaServer<update_token_type>& server_del, DianaServer<I>& server_ins, const SearchRequest& del_req, SearchRequest ins_req, uint8_t threads_count) {
+            if (ins_req.add_count == 0) {
+                return std::vector<I>();
+            }
+            if (del_req.add_count > 0) {
+                std::vector<update_token_type> res_del = server_del.search_simple_parallel(del_req, threads_count, false);
+                std::vector<uint32_t> del_cnts = server_del.deleted_counters(res_del, ins_req.kw_token);
+
+                if (del_cnts.size() > 0) {
+                    ins_req.token_list = TokenTree::prune_covering_list(ins_req.token_list, ins_req.add_count, del_cnts);
+                }
+            }
+            return server_ins.search_simple_parallel(ins_req, threads_count, false);
         }
     }
 }
@@ -21,10 +21,10 @@
 
 #include "token_tree.hpp"
 
+#include <algorithm>
 #include <cassert>
 #include <stack>
 #include <iostream>
-#include <math.h>
 #include <stdlib.h>
 #include "../utils/Utilities.h"
 
@@ -99,64 +99,88 @@ namespace sse {
             }
         }
 
+        // Covers the leaves of the subtree rooted at K (at height depth, whose
+        // leftmost leaf is first_leaf) that are below node_count and not in the
+        // sorted deleted list [del_begin, del_end).
+        // Only the nodes on the paths to the deleted leaves and to the last
+        // leaf are expanded, and each of them is derived once.
+        static void covering_list_gaps(const TokenTree::token_type& K, const uint8_t depth, const uint64_t first_leaf, const uint64_t node_count, const uint32_t* del_begin, const uint32_t* del_end, std::list<std::pair<TokenTree::token_type, uint8_t>> &list) {
+            const uint64_t end_leaf = first_leaf + (1UL << depth);
+            const uint64_t live_count = MIN(end_leaf, node_count) - first_leaf;
+            const uint64_t del_count = del_end - del_begin;
+
+            if (del_count == live_count) {
+                // nothing left in this subtree
+                return;
+            }
+            if (del_count == 0 && end_leaf <= node_count) {
+                list.push_back(std::make_pair(K, depth));
+                return;
+            }
+
+            const uint64_t mid_leaf = first_leaf + (1UL << (depth - 1));
+            const uint32_t* del_mid = std::lower_bound(del_begin, del_end, mid_leaf);
+
+            const bool need_left = ((uint64_t) (del_mid - del_begin) < MIN(mid_leaf, node_count) - first_leaf);
+            const bool need_right = (node_count > mid_leaf) && ((uint64_t) (del_end - del_mid) < MIN(end_leaf, node_count) - mid_leaf);
+
+            TokenTree::token_type K_left, K_right;
+
+            if (need_left && need_right) {
+                uint8_t derived_tokens[2 * TokenTree::kTokenSize];
+
+                crypto::Prg::derive(K.data(), 0, 2 * TokenTree::kTokenSize, derived_tokens);
+
+                std::copy(derived_tokens, derived_tokens + TokenTree::kTokenSize, K_left.begin());
+                std::copy(derived_tokens + TokenTree::kTokenSize, derived_tokens + 2 * TokenTree::kTokenSize, K_right.begin());
+            } else if (need_left) {
+                crypto::Prg::derive(K, 0, K_left);
+            } else if (need_right) {
+                crypto::Prg::derive(K, TokenTree::kTokenSize, K_right);
+            }
+
+            if (need_left) {
+                covering_list_gaps(K_left, depth - 1, first_leaf, node_count, del_begin, del_mid, list);
+            }
+            if (need_right) {
+                covering_list_gaps(K_right, depth - 1, mid_leaf, node_count, del_mid, del_end, list);
+            }
+        }
+
         void TokenTree::covering_list_aux(const token_type& K, uint64_t node_count, uint8_t depth, std::list<std::pair<token_type, uint8_t>> &list, std::vector<uint32_t> delCnts) {
             assert(node_count > 0);
 
-            uint64_t siblings_count = 1UL << depth;
+            // only the deleted leaves that are actually covered matter
+            std::sort(delCnts.begin(), delCnts.end());
+            delCnts.erase(std::unique(delCnts.begin(), delCnts.end()), delCnts.end());
+            delCnts.erase(std::lower_bound(delCnts.begin(), delCnts.end(), node_count), delCnts.end());
 
-            token_type K_left;
-            crypto::Prg::derive(K, 0, K_left);
+            covering_list_gaps(K, depth, 0, node_count, delCnts.data(), delCnts.data() + delCnts.size(), list);
+        }
 
-            if (node_count > (siblings_count >> 1)) {
+        std::list<std::pair<TokenTree::token_type, uint8_t>> TokenTree::prune_covering_list(const std::list<std::pair<token_type, uint8_t>>& cover, uint64_t node_count, std::vector<uint32_t> delCnts) {
+            std::sort(delCnts.begin(), delCnts.end());
+            delCnts.erase(std::unique(delCnts.begin(), delCnts.end()), delCnts.end());
+            delCnts.erase(std::lower_bound(delCnts.begin(), delCnts.end(), node_count), delCnts.end());
 
-                std::list<std::pair<int, int> > targetNodes;
-                int** tree = new int*[depth + 1];
-                for (int i = 0; i <= depth; i++) {
-                    tree[i] = new int[(int) pow(2, i)];
-                    for (int j = 0; j < (int) pow(2, i); j++) {
-                        tree[i][j] = 0;
-                    }
-                }
-                for (uint i = 0; i < node_count; i++) {
-                    tree[depth][i] = 2;
-                }
-                for (uint i = 0; i < delCnts.size(); i++) {
-                    tree[depth][delCnts[i]] = 0;
-                }
-                for (int i = depth - 1; i >= 0; i--) {
-                    for (int j = 0; j < (int) pow(2, i); j++) {
-                        if (tree[i + 1][2 * j] + tree[i + 1][2 * j + 1] == 4) {
-                            tree[i][j] = 2;
-                            tree[i + 1][2 * j + 1] = 0;
-                            tree[i + 1][2 * j] = 0;
-                        } else if (tree[i + 1][2 * j] + tree[i + 1][2 * j + 1] < 4 && tree[i + 1][2 * j] + tree[i + 1][2 * j + 1] > 0) {
-                            tree[i][j] = 1;
-                        } else {
-                            tree[i][j] = 0;
-                        }
-                        if (i == 0 && tree[i][j] == 2) {
-                            targetNodes.push_back(std::make_pair(i, j));
-                        }
-                        if (tree[i][j] != 4 && tree[i + 1][2 * j] == 2) {
-                            targetNodes.push_back(std::make_pair(i + 1, 2 * j));
-                        }
-                        if (tree[i][j] != 4 && tree[i + 1][2 * j + 1] == 2) {
-                            targetNodes.push_back(std::make_pair(i + 1, 2 * j + 1));
-                        }
+            std::list<std::pair<token_type, uint8_t>> list;
+            const uint32_t* del_it = delCnts.data();
+            const uint32_t* del_end = delCnts.data() + delCnts.size();
+            uint64_t first_leaf = 0;
 
-                    }
-                }
-                for (auto item : targetNodes) {
-                    token_type token = derive_node(K, item.second, item.first);
-                    list.push_back(std::make_pair(token, depth - item.first));
-                }
-                for (int i = 0; i <= depth; i++) {
-                    delete[] tree[i];
+            for (const auto& node : cover) {
+                if (first_leaf >= node_count) {
+                    break;
                 }
-            } else {
-                // node_count <= siblings_count/2
-                covering_list_aux(K_left, node_count, depth - 1, list, delCnts);
+                const uint64_t end_leaf = first_leaf + (1UL << node.second);
+                const uint32_t* node_del_end = std::lower_bound(del_it, del_end, end_leaf);
+
+                covering_list_gaps(node.first, node.second, first_leaf, node_count, del_it, node_del_end, list);
+
+                del_it = node_del_end;
+                first_leaf = end_leaf;
             }
+            return list;
         }
 
         /*
@@ -324,5 +348,52 @@ namespace sse {
         void TokenTree::derive_leaves(const token_type& K, const uint8_t depth, const uint64_t start_index, const uint64_t end_index, const std::function<void(const uint8_t *) > &callback) {
             derive_leaves_aux(K.data(), depth, start_index, end_index, callback);
         }
+    
+
+        void TokenTree::derive_all_leaves(const token_type& K, const uint8_t depth, uint8_t *out) {
+            derive_leaves(K, depth, 0, (1UL << depth) - 1, out);
+        }
+
+        void TokenTree::derive_leaves(const token_type& K, const uint8_t depth, const uint64_t start_index, const uint64_t end_index, uint8_t *out) {
+            if (start_index > end_index || end_index > ((1UL << depth) - 1)) {
+                throw std::out_of_range("Invalid start index (" + std::to_string(start_index) + ") or end index (" + std::to_string(end_index) + ")for depth " + std::to_string(depth));
+            }
+
+            std::copy(K.begin(), K.end(), out);
+
+            // out holds the nodes first..last of the current level
+            uint64_t first = 0;
+            uint64_t last = 0;
+
+            for (uint8_t level = 1; level <= depth; level++) {
+                const uint64_t count = last - first + 1;
+                const uint64_t next_first = start_index >> (depth - level);
+                const uint64_t next_last = end_index >> (depth - level);
+
+                // only the two border nodes can have a single child in range
+                const uint64_t skip_left = next_first - 2 * first;
+                const uint64_t skip_right = 2 * last + 1 - next_last;
+
+                // the node at index i of the level is expanded at 2*i-skip_left:
+                // as this is never below i, go from right to left
+                if (skip_right) {
+                    uint8_t *node = out + (count - 1) * kTokenSize;
+                    crypto::Prg::derive(node, 0, kTokenSize, out + (2 * (count - 1) - skip_left) * kTokenSize);
+                }
+
+                const uint64_t inner_count = count - skip_left - skip_right;
+                if (inner_count > 0) {
+                    uint8_t *inner = out + skip_left * kTokenSize;
+                    crypto::Prg::derive_batch(inner, inner_count, inner);
+                }
+
+                if (skip_left) {
+                    crypto::Prg::derive(out, kTokenSize, kTokenSize, out);
+                }
+
+                first = next_first;
+                last = next_last;
+            }
+        }
     }
-}
\ No newline at end of file
+}
@@ -44,10 +44,22 @@ namespace sse {
             static inline std::list<std::pair<token_type, uint8_t>> covering_list(const token_type& root, uint64_t node_count, uint8_t depth);
             static inline std::list<std::pair<token_type, uint8_t>> covering_list(const token_type& root, uint64_t node_count, uint8_t depth, std::vector<uint32_t> delCnts);
 
+            // Removes the deleted leaves from a covering list of the first
+            // node_count leaves (in left to right order, as returned by
+            // covering_list). Only the nodes containing deleted leaves are split.
+            static std::list<std::pair<token_type, uint8_t>> prune_covering_list(const std::list<std::pair<token_type, uint8_t>>& cover, uint64_t node_count, std::vector<uint32_t> delCnts);
+
             static void derive_all_leaves(const token_type& K, const uint8_t depth, const std::function<void(const uint8_t *) > &callback);
 
             static void derive_leaves(const token_type& K, const uint8_t depth, const uint64_t start_index, const uint64_t end_index, const std::function<void(const uint8_t *) > &callback);
 
+            // Breadth-first variants: the leaves are written contiguously in out,
+            // which must hold (end_index-start_index+1)*kTokenSize bytes.
+            // The subtree is expanded in place, one level at a time, so that the
+            // PRG calls of a level are batched.
+            static void derive_all_leaves(const token_type& K, const uint8_t depth, uint8_t *out);
+            static void derive_leaves(const token_type& K, const uint8_t depth, const uint64_t start_index, const uint64_t end_index, uint8_t *out);
+
         private:
             static void covering_list_aux(const token_type& root, uint64_t node_count, uint8_t depth, std::list<std::pair<token_type, uint8_t>> &list);
             static void covering_list_aux(const token_type& root, uint64_t node_count, uint8_t depth, std::list<std::pair<token_type, uint8_t>> &list, std::vector<uint32_t> delCnts);
@@ -1,15 +1,11 @@
 #include "FidesClient.h"
+#include "utils/flat_token_map.hpp"
 #include <sstream>
-#include <boost/algorithm/string/split.hpp>
-#include <boost/algorithm/string/classification.hpp>
+#include <algorithm>
 #include <sse/dbparser/DBParserJSON.h>
-#include <openssl/conf.h>
-#include <openssl/evp.h>
-#include <openssl/err.h>
 #include <string.h>
-using namespace boost::algorithm;
 
-FidesClient::FidesClient(bool usehdd, bool deleteItems) {
+FidesClient::FidesClient(bool usehdd, bool deleteItems, CounterStore::Backend counterBackend) {
     this->deleteItems = deleteItems;
     string client_sk_path = "tdp_sk.key";
     string client_master_key_path = "derivation_master.key";
@@ -42,11 +38,11 @@ FidesClient::FidesClient(bool usehdd, bool deleteItems) {
         server_pk_buf << server_pk_in.rdbuf();
         client_tdp_prg_key_buf << client_tdp_prg_key_in_ins.rdbuf();
 
-        insertClient.reset(new SophosClient("client.sav", client_sk_buf.str(), client_master_key_buf.str(), client_tdp_prg_key_buf.str()));
+        insertClient.reset(new SophosClient("client.sav", client_sk_buf.str(), client_master_key_buf.str(), client_tdp_prg_key_buf.str(), counterBackend));
         insertServer.reset(new SophosServer("server.dat", server_pk_buf.str(), usehdd));
 
     } else {
-        insertClient.reset(new SophosClient("client.sav", 1000));
+        insertClient.reset(new SophosClient("client.sav", 1000, counterBackend));
         insertServer.reset(new SophosServer("server.dat", 1000, insertClient->public_key(), usehdd));
 
         // write keys to files
@@ -61,26 +57,49 @@ FidesClient::FidesClient(bool usehdd, bool deleteItems) {
         ofstream server_pk_out(server_pk_path.c_str());
         server_pk_out << insertServer->public_key();
         server_pk_out.close();
+
+        ofstream client_tdp_prg_key_out(client_tdp_prg_key_path.c_str());
+        client_tdp_prg_key_out << insertClient->rsa_prg_key();
+        client_tdp_prg_key_out.close();
     }
+
+    // the keyword seeds are 16 bytes long, so this input never collides with
+    // a derivation key revealed by a search
+    auto record_key = insertClient->derivation_prf().prf(string("fides/record"));
+    recordPrf.reset(new sse::crypto::Prf<kUpdateTokenSize>(record_key.data(), record_key.size()));
 }
 
 FidesClient::~FidesClient() {
-    insertClient.release();
+    // destroyed, so that a persistent counter store writes back its table
+    insertClient.reset();
     insertServer.release();
 }
 
 //This function is used for the client and server mode
 void FidesClient::deleteKeyword(string key, index_type ind, UpdateRequest& u_req) {
-    u_req = insertClient->update_request(key, Utilities::encode(to_string(ind) + "|0"));
+    u_req = insertClient->update_request(key, encodeRecord(recordKey(key), ind, false, insertClient->update_count(key)));
     totalUpdateCommSize = (sizeof (u_req.index) + sizeof (u_req.token));
 }
 
 //This function is used for the client and server mode
 void FidesClient::insertKeyword(string key, index_type ind, UpdateRequest& u_req) {
-    u_req = insertClient->update_request(key, Utilities::encode(to_string(ind) + "|1"));
+    u_req = insertClient->update_request(key, encodeRecord(recordKey(key), ind, true, insertClient->update_count(key)));
     totalUpdateCommSize = (sizeof (u_req.index) + sizeof (u_req.token));
 }
 
+//This function is used for the client and server mode
+void FidesClient::bulkInsertKeyword(string key, const vector<index_type>& inds, vector<UpdateRequest>& u_reqs) {
+    keyword_key_type kw_key = recordKey(key);
+    uint32_t counter = insertClient->update_count(key);
+    vector<record_type> records;
+    records.reserve(inds.size());
+    for (index_type ind : inds) {
+        records.push_back(encodeRecord(kw_key, ind, true, counter++));
+    }
+    u_reqs = insertClient->bulk_update_request(key, records);
+    totalUpdateCommSize = u_reqs.size() * (sizeof (UpdateRequest::index) + sizeof (UpdateRequest::token));
+}
+
 //This function is used for the client and server mode
 void FidesClient::searchRequest(string key, SearchRequest& s_req_ins) {
     totalSearchCommSize = 0;
@@ -89,21 +108,8 @@ void FidesClient::searchRequest(string key, SearchRequest& s_req_ins) {
 }
 
 //This function is used for the client and server mode
-list<index_type> FidesClient::searchProcess(list<std::array<uint8_t, kUpdateTokenSize> > res_ins) {
-    list<index_type> final_res;
-    map<index_type, int> remove;
-    for (array<uint8_t, kUpdateTokenSize> i : res_ins) {
-        string plainValue = Utilities::decode(i);
-        std::vector<std::string> tokens;
-        split(tokens, plainValue, is_any_of("|"));
-        index_type finalPlainValue = stoi(tokens[0]);
-        remove[finalPlainValue] += (2 * stoi(tokens[1]) - 1);
-    }
-    for (auto const& cur : remove) {
-        if (cur.second > 0) {
-            final_res.push_back(cur.first);
-        }
-    }
+vector<index_type> FidesClient::searchProcess(string key, const list<record_type>& res_ins) {
+    vector<index_type> final_res = tallyRecords(key, res_ins);
     totalSearchCommSize += (kUpdateTokenSize * res_ins.size());
     return final_res;
 }
@@ -111,7 +117,7 @@ list<index_type> FidesClient::searchProcess(list<std::array<uint8_t, kUpdateToke
 //This function is used for the single machine mode
 void FidesClient::deleteKeyword(string key, index_type ind) {
     UpdateRequest u_req;
-    u_req = insertClient->update_request(key, Utilities::encode(to_string(ind) + "|0"));
+    u_req = insertClient->update_request(key, encodeRecord(recordKey(key), ind, false, insertClient->update_count(key)));
     totalUpdateCommSize = (sizeof (u_req.index) + sizeof (u_req.token));
     insertServer->update(u_req);
 }
@@ -119,45 +125,124 @@ void FidesClient::deleteKeyword(string key, index_type ind) {
 //This function is used for the single machine mode
 void FidesClient::insertKeyword(string key, index_type ind) {
     UpdateRequest u_req;
-    u_req = insertClient->update_request(key, Utilities::encode(to_string(ind) + "|1"));
+    u_req = insertClient->update_request(key, encodeRecord(recordKey(key), ind, true, insertClient->update_count(key)));
     totalUpdateCommSize = (sizeof (u_req.index) + sizeof (u_req.token));
     insertServer->update(u_req);
 }
 
 //This function is used for the single machine mode
-list<index_type> FidesClient::searchKeyword(string key) {
-    list<index_type> final_res;
+void FidesClient::bulkInsertKeyword(string key, const vector<index_type>& inds) {
+    vector<UpdateRequest> u_reqs;
+    bulkInsertKeyword(key, inds, u_reqs);
+    insertServer->bulk_update(u_reqs);
+}
+
+//This function is used for the single machine mode
+vector<index_type> FidesClient::searchKeyword(string key) {
     SearchRequest s_req_ins;
-    list<std::array<uint8_t, kUpdateTokenSize> > res_ins;
+    list<record_type> res_ins;
     s_req_ins = insertClient->search_request(key);
     res_ins = insertServer->search(s_req_ins, deleteItems);
-    search_token_type st = s_req_ins.token;
 
-    map<index_type, int> remove;
+    vector<index_type> final_res = tallyRecords(key, res_ins);
     int finalsize = 0;
-    for (array<uint8_t, kUpdateTokenSize> i : res_ins) {
-        string plainValue = Utilities::decode(i);
-        std::vector<std::string> tokens;
-        split(tokens, plainValue, is_any_of("|"));
-        index_type finalPlainValue = stoi(tokens[0]);
-        remove[finalPlainValue] += (2 * stoi(tokens[1]) - 1);
-        st = insertServer->public_tdp_.eval(st);
+    if (deleteItems && !final_res.empty()) {
+        totalUpdateCommSize = 0;
+        bulkInsertKeyword(key, final_res);
+        finalsize += totalUpdateCommSize;
     }
+    totalSearchCommSize = finalsize + (sizeof (s_req_ins.add_count))+(sizeof (s_req_ins.token))+(kUpdateTokenSize * res_ins.size());
+    return final_res;
+}
+
+FidesClient::keyword_key_type FidesClient::recordKey(const string& key) const {
+    // the leading zero separates these inputs from the mask ones
+    return recordPrf->prf(string(1, '\0') + key);
+}
 
-    for (auto const& cur : remove) {
+// zero over the counter, which is read before unmasking
+static void recordMask(const sse::crypto::Prf<kUpdateTokenSize>& prf, const FidesClient::keyword_key_type& kw_key, uint32_t counter, uint8_t* mask) {
+    uint8_t input[1 + kUpdateTokenSize + sizeof (counter)];
+    input[0] = 1;
+    memcpy(input + 1, kw_key.data(), kw_key.size());
+    for (size_t i = 0; i < sizeof (counter); i++) {
+        input[1 + kUpdateTokenSize + i] = (uint8_t) (counter >> (8 * i));
+    }
+    auto out = prf.prf(input, sizeof (input));
+    memcpy(mask, out.data(), Payload::kSize);
+    memset(mask + Payload::kCounterOffset, 0, sizeof (counter));
+}
+
+FidesClient::record_type FidesClient::encodeRecord(const keyword_key_type& kw_key, index_type ind, bool insertion, uint32_t counter) const {
+    uint8_t mask[Payload::kSize];
+    Payload payload;
+    payload.id = ind;
+    payload.counter = counter;
+    payload.insertion = insertion;
+
+    recordMask(*recordPrf, kw_key, counter, mask);
+    return PayloadCodec::encode(payload, mask);
+}
+
+bool FidesClient::decodeRecord(const keyword_key_type& kw_key, const record_type& record, Payload& payload) const {
+    uint8_t mask[Payload::kSize];
+
+    recordMask(*recordPrf, kw_key, PayloadCodec::clear_counter(record), mask);
+    if (PayloadCodec::decode(record, mask, payload)) {
+        return true;
+    }
+    return PayloadCodec::decode_legacy_record(record, payload);
+}
+
+// The FlatTokenMap hashes the first key bytes as they are, which suits PRF
+// outputs but clusters sequential ids: they go through the splitmix64
+// finalizer first. It is a bijection, so distinct ids keep distinct keys.
+static uint64_t mixId(uint64_t id) {
+    id = (id ^ (id >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    id = (id ^ (id >> 27)) * 0x94d049bb133111ebULL;
+    return id ^ (id >> 31);
+}
+
+vector<index_type> FidesClient::tallyRecords(const string& key, const list<record_type>& records) const {
+    // one counter per distinct id, found through its position in the map
+    keyword_key_type kw_key = recordKey(key);
+    vector<pair<index_type, int32_t> > tallies;
+    FlatTokenMap<sizeof (index_type), size_t> positions(2 * records.size());
+    std::array<uint8_t, sizeof (index_type)> id_key;
+
+    for (const record_type& record : records) {
+        Payload payload;
+        if (!decodeRecord(kw_key, record, payload)) {
+            continue;
+        }
+
+        uint64_t mixed = mixId(payload.id);
+        for (size_t i = 0; i < id_key.size(); i++) {
+            id_key[i] = (uint8_t) (mixed >> (8 * i));
+        }
+        size_t* pos = positions.find(id_key);
+        if (pos == nullptr) {
+            positions.insert(id_key, tallies.size());
+            tallies.push_back(make_pair(payload.id, payload.insertion ? 1 : -1));
+        } else {
+            tallies[*pos].second += payload.insertion ? 1 : -1;
+        }
+    }
+
+    vector<index_type> final_res;
+    for (auto const& cur : tallies) {
         if (cur.second > 0) {
             final_res.push_back(cur.first);
-            if (deleteItems) {
-                totalUpdateCommSize = 0;
-                insertKeyword(key, cur.first);
-                finalsize += totalUpdateCommSize;
-            }
         }
     }
-    totalSearchCommSize = finalsize + (sizeof (s_req_ins.add_count))+(sizeof (s_req_ins.token))+(kUpdateTokenSize * res_ins.size());
+    std::sort(final_res.begin(), final_res.end());
     return final_res;
 }
 
+void FidesClient::writeCounterSnapshot(const string& path) const {
+    insertClient->write_counter_snapshot(path);
+}
+
 double FidesClient::getTotalSearchCommSize() const {
     return totalSearchCommSize;
 }
@@ -167,7 +252,7 @@ double FidesClient::getTotalUpdateCommSize() const {
 }
 
 double FidesClient::getServerStorageSize() {
-    return (sizeof (insertServer->curArray.begin()->first) + sizeof (insertServer->curArray.begin()->second)) * insertServer->curArray.size();
+    return (sizeof (update_token_type) + sizeof (SophosServer::value_type)) * insertServer->size();
 }
 
 void FidesClient::setTotalSearchCommSize(double totalSearchCommSize) {
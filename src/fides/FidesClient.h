@@ -5,38 +5,62 @@
 #include <fstream>
 #include <memory>
 #include <map>
+#include <vector>
 #include "../utils/Utilities.h"
 
 #include "fides/sophos_client.hpp"
 #include "fides/sophos_server.hpp"
 #include "../utils/utils.hpp"
+#include "../utils/payload_codec.hpp"
 
 using namespace std;
 using namespace sse::sophos;
 
 class FidesClient {
+public:
+    // A record is a Payload of the id, the op and the Sophos counter of the
+    // update. The counter stays in clear, and the rest is masked with the
+    // record PRF of the keyword key and of that counter, which never repeats.
+    typedef Payload::value_type record_type;
+    typedef std::array<uint8_t, kUpdateTokenSize> keyword_key_type;
+
+    static_assert(sizeof (record_type) == kUpdateTokenSize, "A record must fit a Sophos index");
+
 private:
     bool deleteItems;
     unique_ptr<SophosClient> insertClient;
     unique_ptr<SophosServer> insertServer;
+    unique_ptr<sse::crypto::Prf<kUpdateTokenSize> > recordPrf;
     double totalUpdateCommSize = 0;
     double totalSearchCommSize = 0;
 
 public:
-    FidesClient(bool usehdd, bool deleteItems);
+    // the keyword counters are kept in counterBackend at client.sav (kSnapshot
+    // opens a writeCounterSnapshot file for searches only)
+    FidesClient(bool usehdd, bool deleteItems, CounterStore::Backend counterBackend = CounterStore::Backend::kMemory);
     virtual ~FidesClient();
     void insertKeyword(string key, index_type ind, UpdateRequest& u_req);
     void deleteKeyword(string key, index_type ind, UpdateRequest& u_req);
+    void bulkInsertKeyword(string key, const vector<index_type>& inds, vector<UpdateRequest>& u_reqs);
     void searchRequest(string key, SearchRequest& s_req_ins);
-    list<index_type> searchProcess(list<std::array<uint8_t, kUpdateTokenSize> > res_ins);
+    vector<index_type> searchProcess(string key, const list<record_type>& res_ins);
     void insertKeyword(string key, index_type ind);
     void deleteKeyword(string key, index_type ind);
-    list<index_type> searchKeyword(string key);
+    void bulkInsertKeyword(string key, const vector<index_type>& inds);
+    vector<index_type> searchKeyword(string key);
+    void writeCounterSnapshot(const string& path) const;
     double getTotalSearchCommSize() const;
     double getTotalUpdateCommSize() const;
     double getServerStorageSize();
     void setTotalSearchCommSize(double totalSearchCommSize);
     void setTotalUpdateCommSize(double totalUpdateCommSize);
+
+private:
+    keyword_key_type recordKey(const string& key) const;
+    record_type encodeRecord(const keyword_key_type& kw_key, index_type ind, bool insertion, uint32_t counter) const;
+    // also reads the records of the former format, returns false if invalid
+    bool decodeRecord(const keyword_key_type& kw_key, const record_type& record, Payload& payload) const;
+    vector<index_type> tallyRecords(const string& key, const list<record_type>& records) const;
 };
 
 #endif /* FIDES_H */
@@ -11,17 +11,19 @@
 #include <string>
 #include <thread>
 #include <fstream>
+#include <unordered_map>
 
 #include <grpc/grpc.h>
 #include <grpc++/client_context.h>
+#include <grpc++/completion_queue.h>
 #include <grpc++/create_channel.h>
 #include <grpc++/security/credentials.h>
 
-FidesClientRunner::FidesClientRunner(string address, bool usehdd, bool deleteItem) {
+FidesClientRunner::FidesClientRunner(string address, bool usehdd, bool deleteItem, CounterStore::Backend counterBackend) {
     this->deleteItem = deleteItem;
     std::shared_ptr<grpc::Channel> channel(grpc::CreateChannel(address, grpc::InsecureChannelCredentials()));
     stub_ = Fides::NewStub(channel);
-    client_ = make_unique<FidesClient>(usehdd, deleteItem);
+    client_ = make_unique<FidesClient>(usehdd, deleteItem, counterBackend);
     setupMode = false;
     this->usehdd = usehdd;
 }
@@ -89,7 +91,89 @@ void FidesClientRunner::deleteKeyword(string keyword, index_type index) {
     totalUpdateTime = Utilities::stopTimer(2);
 }
 
-list<index_type> FidesClientRunner::searchKeyword(string keyword) {
+void FidesClientRunner::bulkInsertKeywords(const vector<pair<string, index_type> >& updates) {
+    clientUpdateComputationTime = 0;
+    serverUpdateComputationTime = 0;
+    Utilities::startTimer(2);
+
+    // one asynchronous call per batch, completed through the queue
+    struct PendingBatch {
+        grpc::ClientContext context;
+        UpdateResponse response;
+        grpc::Status status;
+        std::unique_ptr<grpc::ClientAsyncResponseReader<UpdateResponse> > rpc;
+    };
+    grpc::CompletionQueue cq;
+    size_t pending = 0;
+
+    auto completeOne = [&]() {
+        void* tag;
+        bool ok;
+        if (!cq.Next(&tag, &ok)) {
+            return;
+        }
+        std::unique_ptr<PendingBatch> batch(static_cast<PendingBatch*> (tag));
+        pending--;
+        if (!ok || !batch->status.ok()) {
+            cout << "Batch update failed:" << std::endl;
+            return;
+        }
+        serverUpdateComputationTime += batch->response.comptime();
+    };
+
+    BatchUpdateRequestMessage message;
+    auto sendBatch = [&]() {
+        if (pending == kMaxPendingBatches) {
+            completeOne();
+        }
+        PendingBatch* batch = new PendingBatch;
+        batch->rpc = stub_->AsyncbatchUpdate(&batch->context, message, &cq);
+        batch->rpc->Finish(&batch->response, &batch->status, batch);
+        pending++;
+        message.Clear();
+    };
+
+    Utilities::startTimer(1);
+    unordered_map<string, vector<index_type> > groups;
+    for (const auto& update : updates) {
+        groups[update.first].push_back(update.second);
+    }
+    clientUpdateComputationTime += Utilities::stopTimer(1);
+
+    vector<UpdateRequest> reqs;
+    for (const auto& group : groups) {
+        // large groups are split over several batches
+        for (size_t done = 0; done < group.second.size();) {
+            size_t count = std::min(group.second.size() - done, kBulkBatchSize - message.index_size());
+            Utilities::startTimer(1);
+            vector<index_type> inds(group.second.begin() + done, group.second.begin() + done + count);
+            client_->bulkInsertKeyword(group.first, inds, reqs);
+            for (const UpdateRequest& req : reqs) {
+                message.add_update_token(req.token.data(), req.token.size());
+                message.add_index(req.index.data(), req.index.size());
+            }
+            clientUpdateComputationTime += Utilities::stopTimer(1);
+            done += count;
+            if ((size_t) message.index_size() == kBulkBatchSize) {
+                sendBatch();
+            }
+        }
+    }
+    if (message.index_size() > 0) {
+        sendBatch();
+    }
+    while (pending > 0) {
+        completeOne();
+    }
+    cq.Shutdown();
+    void* tag;
+    bool ok;
+    while (cq.Next(&tag, &ok)) {
+    }
+    totalUpdateTime = Utilities::stopTimer(2);
+}
+
+vector<index_type> FidesClientRunner::searchKeyword(string keyword) {
     clientSearchComputationTime = 0;
     Utilities::startTimer(2);
     Utilities::startTimer(1);
@@ -98,38 +182,46 @@ list<index_type> FidesClientRunner::searchKeyword(string keyword) {
     clientSearchComputationTime += Utilities::stopTimer(1);
     grpc::ClientContext context;
     SearchRequestMessage message;
-    SearchReply reply;
+    SearchStreamReply reply;
 
 
     message.set_add_count(req.add_count);
     message.set_derivation_key(req.derivation_key);
     message.set_search_token(req.token.data(), req.token.size());
 
-    list<std::array<uint8_t, kUpdateTokenSize> > ciphers;
+    list<FidesClient::record_type> ciphers;
 
-    stub_->search(&context, message, &reply);
-    serverSearchComputationTime = reply.comptime();
-    for (int i = 0; i < reply.index_size(); i++) {
-        std::array<uint8_t, kUpdateTokenSize> cipher;
-        std::copy(reply.index(i).begin(), reply.index(i).end(), cipher.begin());
-        ciphers.push_back(cipher);
+    std::unique_ptr<grpc::ClientReader<SearchStreamReply> > stream(stub_->searchStream(&context, message));
+    while (stream->Read(&reply)) {
+        for (int i = 0; i < reply.index_size(); i++) {
+            std::array<uint8_t, kUpdateTokenSize> cipher;
+            std::copy(reply.index(i).begin(), reply.index(i).end(), cipher.begin());
+            ciphers.push_back(cipher);
+        }
+        if (reply.last()) {
+            serverSearchComputationTime = reply.comptime();
+        }
+    }
+    grpc::Status status = stream->Finish();
+    if (!status.ok()) {
+        cout << "search failed:" << std::endl;
     }
     Utilities::startTimer(1);
-    list<index_type> res = client_->searchProcess(ciphers);
+    vector<index_type> res = client_->searchProcess(keyword, ciphers);
     clientSearchComputationTime += Utilities::stopTimer(1);
-    if (deleteItem) {
+    if (deleteItem && !res.empty()) {
         BatchUpdateRequestMessage batchMessage;
         UpdateResponse batchResponse;
         grpc::ClientContext batchContext;
-        for (auto item : res) {
-            Utilities::startTimer(1);
-            UpdateRequest breq;
-            client_->insertKeyword(keyword, item, breq);
-            clientSearchComputationTime += Utilities::stopTimer(1);
+        Utilities::startTimer(1);
+        vector<UpdateRequest> breqs;
+        client_->bulkInsertKeyword(keyword, res, breqs);
+        clientSearchComputationTime += Utilities::stopTimer(1);
+        for (const UpdateRequest& breq : breqs) {
             batchMessage.add_update_token(breq.token.data(), breq.token.size());
             batchMessage.add_index(breq.index.data(), breq.index.size());
-            client_->setTotalSearchCommSize(client_->getTotalSearchCommSize() + client_->getTotalUpdateCommSize());
         }
+        client_->setTotalSearchCommSize(client_->getTotalSearchCommSize() + client_->getTotalUpdateCommSize());
         grpc::Status status = stub_->batchUpdate(&batchContext, batchMessage, &batchResponse);
         serverSearchComputationTime = batchResponse.comptime();
 
@@ -12,11 +12,15 @@
 
 class FidesClientRunner : public Fides::Service {
 public:
-    FidesClientRunner(string address, bool usehdd,bool deleteItem);
+    FidesClientRunner(string address, bool usehdd,bool deleteItem, CounterStore::Backend counterBackend = CounterStore::Backend::kMemory);
     virtual ~FidesClientRunner();
     void insertKeyword(string key, index_type ind);    
     void deleteKeyword(string key, index_type ind);
-    list<index_type> searchKeyword(string key);
+    // Initial load: the updates are grouped by keyword and sent in batches,
+    // with up to kMaxPendingBatches requests in flight while the next batch
+    // is computed.
+    void bulkInsertKeywords(const vector<pair<string, index_type> >& updates);
+    vector<index_type> searchKeyword(string key);
     double getTotalSearchCommSize();
     double getTotalUpdateCommSize();
     std::unique_ptr<FidesClient> client_;
@@ -29,6 +33,10 @@ public:
     void setup();
     bool setupMode;
 private:
+    // entries per BatchUpdateRequestMessage (about 1MB)
+    static const size_t kBulkBatchSize = 16384;
+    static const size_t kMaxPendingBatches = 8;
+
     bool deleteItem,usehdd;    
     std::unique_ptr<Fides::Stub> stub_;
 };
@@ -1,6 +1,10 @@
 #include "FidesServerRunner.h"
 
-FidesServerRunner::FidesServerRunner() {
+#include <algorithm>
+#include <thread>
+
+FidesServerRunner::FidesServerRunner(size_t resultCacheSize) : resultCacheSize(resultCacheSize) {
+    searchThreads = std::max(1u, std::min(255u, std::thread::hardware_concurrency()));
 }
 
 grpc::Status FidesServerRunner::setup(grpc::ServerContext* context, const SetupMessage* message, google::protobuf::Empty* e) {
@@ -42,6 +46,7 @@ grpc::Status FidesServerRunner::setup(grpc::ServerContext* context, const SetupM
         server_pk_out << insertServer->public_key();
         server_pk_out.close();
     }
+    insertServer->set_result_cache_capacity(resultCacheSize);
     return grpc::Status::OK;
 }
 
@@ -49,6 +54,7 @@ grpc::Status FidesServerRunner::update(grpc::ServerContext* context, const Updat
     UpdateRequest req;
     std::copy(message->index().begin(), message->index().end(), req.index.begin());
     std::copy(message->update_token().begin(), message->update_token().end(), req.token.begin());
+    std::lock_guard<std::mutex> lock(indexMutex);
     Utilities::startTimer(10);
     insertServer->update(req);
     auto t = Utilities::stopTimer(10);
@@ -57,17 +63,16 @@ grpc::Status FidesServerRunner::update(grpc::ServerContext* context, const Updat
 }
 
 grpc::Status FidesServerRunner::batchUpdate(grpc::ServerContext* context, const BatchUpdateRequestMessage* message, UpdateResponse* response) {
-    double totalTime=0;
+    vector<UpdateRequest> reqs(message->index_size());
     for (int i = 0; i < message->index_size(); i++) {
-        UpdateRequest req;
-        std::copy(message->index(i).begin(), message->index(i).end(), req.index.begin());
-        std::copy(message->update_token(i).begin(), message->update_token(i).end(), req.token.begin());
-        Utilities::startTimer(10);
-        insertServer->update(req);
-        auto t = Utilities::stopTimer(10);
-        totalTime+=t;        
+        std::copy(message->index(i).begin(), message->index(i).end(), reqs[i].index.begin());
+        std::copy(message->update_token(i).begin(), message->update_token(i).end(), reqs[i].token.begin());
     }
-    response->set_comptime(totalTime);
+    std::lock_guard<std::mutex> lock(indexMutex);
+    Utilities::startTimer(10);
+    insertServer->bulk_update(reqs);
+    auto t = Utilities::stopTimer(10);
+    response->set_comptime(t);
     return grpc::Status::OK;
 }
 
@@ -77,8 +82,14 @@ grpc::Status FidesServerRunner::search(grpc::ServerContext* context, const Searc
     req.add_count = message->add_count();
     req.derivation_key = message->derivation_key();
     std::copy(message->search_token().begin(), message->search_token().end(), req.token.begin());
+    std::lock_guard<std::mutex> lock(indexMutex);
     Utilities::startTimer(10);
-    list<std::array<uint8_t, kUpdateTokenSize> > res_ins = insertServer->search(req, deleteItem);
+    list<SophosServer::value_type> res_ins;
+    if (req.add_count >= kParallelSearchThreshold && searchThreads > 1) {
+        res_ins = insertServer->search_pipelined(req, searchThreads, deleteItem);
+    } else {
+        res_ins = insertServer->search(req, deleteItem);
+    }
     auto t = Utilities::stopTimer(10);
     reply->set_comptime(t);
 
@@ -88,6 +99,44 @@ grpc::Status FidesServerRunner::search(grpc::ServerContext* context, const Searc
     return grpc::Status::OK;
 }
 
+grpc::Status FidesServerRunner::searchStream(grpc::ServerContext* context, const SearchRequestMessage* message, grpc::ServerWriter<SearchStreamReply>* writer) {
+    SearchRequest req;
+
+    req.add_count = message->add_count();
+    req.derivation_key = message->derivation_key();
+    std::copy(message->search_token().begin(), message->search_token().end(), req.token.begin());
+    std::lock_guard<std::mutex> lock(indexMutex);
+    Utilities::startTimer(10);
+
+    // the lanes fill the current chunk, which is sent as soon as it is full
+    SearchStreamReply reply;
+    std::mutex replyMutex;
+    auto post_callback = [&reply, &replyMutex, writer](const SophosServer::value_type* hits, size_t n) {
+        std::lock_guard<std::mutex> replyLock(replyMutex);
+        for (size_t i = 0; i < n; i++) {
+            reply.add_index(hits[i].data(), hits[i].size());
+        }
+        if (reply.index_size() >= kResultChunkSize) {
+            writer->Write(reply);
+            reply.Clear();
+        }
+    };
+    if (req.add_count >= kParallelSearchThreshold) {
+        insertServer->search_pipelined_callback(req, post_callback, searchThreads, deleteItem);
+    } else {
+        list<SophosServer::value_type> res_ins = insertServer->search(req, deleteItem);
+        for (auto it : res_ins) {
+            reply.add_index(it.data(), it.size());
+        }
+    }
+    auto t = Utilities::stopTimer(10);
+
+    reply.set_last(true);
+    reply.set_comptime(t);
+    writer->Write(reply);
+    return grpc::Status::OK;
+}
+
 FidesServerRunner::~FidesServerRunner() {
 }
 
@@ -16,15 +16,27 @@ using namespace std;
 
 class FidesServerRunner : public Fides::Service {
 public:
-    FidesServerRunner();
+    // resultCacheSize: capacity (in results) of the search result cache of
+    // the server, 0 disables it
+    FidesServerRunner(size_t resultCacheSize = 0);
     virtual ~FidesServerRunner();
     grpc::Status setup(grpc::ServerContext* context, const SetupMessage* request, google::protobuf::Empty* e) ;
     grpc::Status update(grpc::ServerContext* context, const UpdateRequestMessage* request, UpdateResponse* response) ;
     grpc::Status batchUpdate(grpc::ServerContext* context, const BatchUpdateRequestMessage* request, UpdateResponse* response) ;
     grpc::Status search(grpc::ServerContext* context, const SearchRequestMessage* mes, SearchReply* res) ;
+    grpc::Status searchStream(grpc::ServerContext* context, const SearchRequestMessage* mes, grpc::ServerWriter<SearchStreamReply>* writer) ;
+
+    // searches with at least this many updates run on all the cores
+    static const uint32_t kParallelSearchThreshold = 64;
+    // number of results per streamed reply
+    static const int kResultChunkSize = 16384;
 private:
     unique_ptr<SophosServer> insertServer;
     bool deleteItem;
+    uint8_t searchThreads;
+    size_t resultCacheSize;
+    // the calls run on several gRPC threads, while the EDB is not synchronized
+    std::mutex indexMutex;
 };
 
 #endif /* FIDESSERVERRUNNER_H */
\ No newline at end of file
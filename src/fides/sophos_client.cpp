@@ -28,6 +28,7 @@
 
 #include <iostream>
 #include <algorithm>
+#include <limits>
 
 namespace sse {
     namespace sophos {
@@ -77,7 +78,7 @@ namespace sse {
             master_key_buf << master_key_in.rdbuf();
             rsa_prg_key_buf << rsa_prg_key_in.rdbuf();
             
-            return std::unique_ptr<SophosClient>(new  SophosClient(counter_map_path, sk_buf.str(), master_key_buf.str(), rsa_prg_key_buf.str()));
+            return std::unique_ptr<SophosClient>(new  SophosClient(counter_map_path, sk_buf.str(), master_key_buf.str(), rsa_prg_key_buf.str(), CounterStore::Backend::kRocksDB));
         }
         
         std::unique_ptr<SophosClient> SophosClient::init_in_directory(const std::string& dir_path, uint32_t n_keywords)
@@ -89,25 +90,25 @@ namespace sse {
             
             std::string counter_map_path = dir_path + "/" + counter_map_file__;
             
-            auto c_ptr =  std::unique_ptr<SophosClient>(new SophosClient(counter_map_path, n_keywords));
+            auto c_ptr =  std::unique_ptr<SophosClient>(new SophosClient(counter_map_path, n_keywords, CounterStore::Backend::kRocksDB));
             
             c_ptr->write_keys(dir_path);
             
             return c_ptr;
         }
         
-        SophosClient::SophosClient(const std::string& token_map_path, const size_t tm_setup_size) :
-        k_prf_(), inverse_tdp_(), rsa_prg_()
+        SophosClient::SophosClient(const std::string& token_map_path, const size_t tm_setup_size, const CounterStore::Backend counter_backend) :
+        k_prf_(), inverse_tdp_(), rsa_prg_(), counters_(CounterStore::open(counter_backend, token_map_path)), token_cache_capacity_(kDefaultTokenCacheCapacity)
         {
         }
         
-        SophosClient::SophosClient(const std::string& token_map_path, const std::string& tdp_private_key, const std::string& derivation_master_key, const std::string& rsa_prg_key) :
-        k_prf_(derivation_master_key), inverse_tdp_(tdp_private_key), rsa_prg_(rsa_prg_key)
+        SophosClient::SophosClient(const std::string& token_map_path, const std::string& tdp_private_key, const std::string& derivation_master_key, const std::string& rsa_prg_key, const CounterStore::Backend counter_backend) :
+        k_prf_(derivation_master_key), inverse_tdp_(tdp_private_key), rsa_prg_(rsa_prg_key), counters_(CounterStore::open(counter_backend, token_map_path)), token_cache_capacity_(kDefaultTokenCacheCapacity)
         {
         }
         
-        SophosClient::SophosClient(const std::string& token_map_path, const std::string& tdp_private_key, const std::string& derivation_master_key, const std::string& rsa_prg_key, const size_t tm_setup_size) :
-        k_prf_(derivation_master_key), inverse_tdp_(tdp_private_key), rsa_prg_(rsa_prg_key)
+        SophosClient::SophosClient(const std::string& token_map_path, const std::string& tdp_private_key, const std::string& derivation_master_key, const std::string& rsa_prg_key, const size_t tm_setup_size, const CounterStore::Backend counter_backend) :
+        k_prf_(derivation_master_key), inverse_tdp_(tdp_private_key), rsa_prg_(rsa_prg_key), counters_(CounterStore::open(counter_backend, token_map_path)), token_cache_capacity_(kDefaultTokenCacheCapacity)
         {
         }
         
@@ -119,7 +120,12 @@ namespace sse {
         
         size_t SophosClient::keyword_count() const
         {
-            return ramCounter.size();
+            return counters_->size();
+        }
+        
+        void SophosClient::write_counter_snapshot(const std::string& path) const
+        {
+            counters_->write_snapshot(path);
         }
         
         const std::string SophosClient::public_key() const
@@ -152,6 +158,13 @@ namespace sse {
             return hash_string.erase(kKeywordIndexSize);
         }
         
+        CounterStore::key_type SophosClient::counter_key(const std::string &seed)
+        {
+            CounterStore::key_type key;
+            std::copy_n(seed.begin(), key.size(), key.begin());
+            return key;
+        }
+        
         SearchRequest   SophosClient::search_request(const std::string &keyword) const
         {
             uint32_t kw_counter;
@@ -161,18 +174,19 @@ namespace sse {
             
             std::string seed = get_keyword_index(keyword);
             
-            if (ramCounter.count(keyword) != 0) {
+            if (counters_->get(counter_key(seed), kw_counter)) {
                 found = true;
-                kw_counter = ramCounter.at(keyword);
-            }            
+            }
             
             if(!found)
             {
                 //logger::log(logger::INFO) << "No matching counter found for keyword " << keyword << " (index " << hex_string(seed) << ")" << std::endl;
             }else{
                 // Now derive the original search token from the kw_index (as seed)
-                req.token = inverse_tdp().generate_array(rsa_prg_, seed);
-                req.token = inverse_tdp().invert_mult(req.token, kw_counter);
+                if (!cached_token(keyword, kw_counter, req.token)) {
+                    req.token = inverse_tdp().generate_array(rsa_prg_, seed);
+                    req.token = inverse_tdp().invert_mult(req.token, kw_counter);
+                }
                 
                 
                 req.derivation_key = derivation_prf().prf_string(seed);
@@ -183,6 +197,16 @@ namespace sse {
         }
         
         
+        uint32_t        SophosClient::update_count(const std::string &keyword) const
+        {
+            uint32_t kw_counter;
+            
+            if (counters_->get(counter_key(get_keyword_index(keyword)), kw_counter)) {
+                return kw_counter+1;
+            }
+            return 0;
+        }
+        
         UpdateRequest   SophosClient::update_request(const std::string &keyword, const std::array<uint8_t, kUpdateTokenSize> index)
         {
             UpdateRequest req;
@@ -196,26 +220,32 @@ namespace sse {
             // retrieve the counter
             uint32_t kw_counter;
             
-            if (ramCounter.count(keyword) != 0) {
-                kw_counter = ramCounter.at(keyword);
+            CounterStore::key_type kw_key = counter_key(seed);
+            
+            if (counters_->get(kw_key, kw_counter)) {
                 kw_counter++;
-                ramCounter.at(keyword) = kw_counter;
             } else {
-                ramCounter.insert(std::make_pair(keyword, 0));
                 kw_counter=0;
             }
-            
-            st = inverse_tdp().generate_array(rsa_prg_, seed);
+            counters_->set(kw_key, kw_counter);
             
             if (kw_counter==0) {
+                st = inverse_tdp().generate_array(rsa_prg_, seed);
                 logger::log(logger::DBG) << "ST0 " << hex_string(st) << std::endl;
             }else{
-                st = inverse_tdp().invert_mult(st, kw_counter);
+                if (cached_token(keyword, kw_counter-1, st)) {
+                    // one inversion from the previous token
+                    st = inverse_tdp().invert(st);
+                }else{
+                    st = inverse_tdp().generate_array(rsa_prg_, seed);
+                    st = inverse_tdp().invert_mult(st, kw_counter);
+                }
                 
                 if (logger::severity() <= logger::DBG) {
                     logger::log(logger::DBG) << "New ST " << hex_string(st) << std::endl;
                 }
             }
+            cache_token(keyword, kw_counter, st);
             
             
             std::string deriv_key = derivation_prf().prf_string(seed);
@@ -236,6 +266,107 @@ namespace sse {
             return req;
         }
         
+        std::vector<UpdateRequest> SophosClient::bulk_update_request(const std::string &keyword, const std::vector<std::array<uint8_t, kUpdateTokenSize> > &indexes)
+        {
+            std::vector<UpdateRequest> reqs(indexes.size());
+            
+            if (indexes.empty()) {
+                return reqs;
+            }
+            
+            std::string seed = get_keyword_index(keyword);
+            
+            // counter of the first update, the others follow
+            uint32_t first_counter = 0;
+            CounterStore::key_type kw_key = counter_key(seed);
+            
+            if (counters_->get(kw_key, first_counter)) {
+                first_counter++;
+            }
+            if (indexes.size() - 1 > std::numeric_limits<uint32_t>::max() - first_counter) {
+                throw std::out_of_range("Keyword counter overflow");
+            }
+            uint32_t last_counter = first_counter + (uint32_t) (indexes.size() - 1);
+            counters_->set(kw_key, last_counter);
+            
+            search_token_type st;
+            
+            if (first_counter == 0) {
+                st = inverse_tdp().generate_array(rsa_prg_, seed);
+            }else if (cached_token(keyword, first_counter-1, st)) {
+                st = inverse_tdp().invert(st);
+            }else{
+                st = inverse_tdp().generate_array(rsa_prg_, seed);
+                st = inverse_tdp().invert_mult(st, first_counter);
+            }
+            
+            auto derivation = crypto::Prf<kUpdateTokenSize>(derivation_prf().prf_string(seed));
+            
+            for (size_t i = 0; i < indexes.size(); i++) {
+                if (i > 0) {
+                    st = inverse_tdp().invert(st);
+                }
+                std::string st_string(reinterpret_cast<char*> (st.data()), st.size());
+                reqs[i].token = derivation.prf(st_string + '0');
+                reqs[i].index = xor_mask(indexes[i], derivation.prf(st_string + '1'));
+            }
+            cache_token(keyword, last_counter, st);
+            
+            return reqs;
+        }
+        
+        void SophosClient::set_token_cache_capacity(const size_t capacity)
+        {
+            token_cache_capacity_ = capacity;
+            while (token_cache_.size() > token_cache_capacity_) {
+                token_cache_index_.erase(token_cache_.back().keyword);
+                token_cache_.pop_back();
+            }
+        }
+        
+        size_t SophosClient::token_cache_capacity() const
+        {
+            return token_cache_capacity_;
+        }
+        
+        void SophosClient::set_tdp_backend(const sse::crypto::TdpBackend backend)
+        {
+            inverse_tdp_.set_backend(backend);
+        }
+        
+        bool SophosClient::cached_token(const std::string &keyword, const uint32_t counter, search_token_type &st) const
+        {
+            auto it = token_cache_index_.find(keyword);
+            if (it == token_cache_index_.end() || it->second->counter != counter) {
+                return false;
+            }
+            st = it->second->token;
+            return true;
+        }
+        
+        void SophosClient::cache_token(const std::string &keyword, const uint32_t counter, const search_token_type &st)
+        {
+            if (token_cache_capacity_ == 0) {
+                return;
+            }
+            
+            auto it = token_cache_index_.find(keyword);
+            if (it != token_cache_index_.end()) {
+                // most recently used first
+                token_cache_.splice(token_cache_.begin(), token_cache_, it->second);
+            }else{
+                if (token_cache_.size() >= token_cache_capacity_) {
+                    token_cache_index_.erase(token_cache_.back().keyword);
+                    token_cache_.pop_back();
+                }
+                token_cache_.push_front(CachedToken());
+                token_cache_.front().keyword = keyword;
+                token_cache_index_[keyword] = token_cache_.begin();
+            }
+            token_cache_.front().counter = counter;
+            token_cache_.front().token = st;
+        }
+        
         std::string SophosClient::rsa_prg_key() const
         {
             return std::string(rsa_prg_.key().begin(), rsa_prg_.key().end());
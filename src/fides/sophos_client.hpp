@@ -23,12 +23,16 @@
 
 #include "sophos_common.hpp"
 #include "utils/rocksdb_wrapper.hpp"
+#include "utils/counter_store.hpp"
 
 #include <string>
 #include <array>
 #include <fstream>
 #include <functional>
+#include <list>
 #include <mutex>
+#include <unordered_map>
+#include <vector>
 
 #include <sse/crypto/tdp.hpp>
 #include <sse/crypto/prf.hpp>
@@ -41,14 +45,18 @@ namespace sse {
         class SophosClient {
         public:
             static constexpr size_t kKeywordIndexSize = 16;
+            // number of keywords whose latest search token is kept (kSearchTokenSize bytes each)
+            static constexpr size_t kDefaultTokenCacheCapacity = 1 << 16;
             //    typedef std::array<uint8_t, kKeywordIndexSize> keyword_index_type;
             
             static std::unique_ptr<SophosClient> construct_from_directory(const std::string& dir_path);
             static std::unique_ptr<SophosClient> init_in_directory(const std::string& dir_path, uint32_t n_keywords);
             
-            SophosClient(const std::string& token_map_path, const size_t tm_setup_size);
-            SophosClient(const std::string& token_map_path, const std::string& tdp_private_key, const std::string& derivation_master_key, const std::string& rsa_prg_key);
-            SophosClient(const std::string& token_map_path, const std::string& tdp_private_key, const std::string& derivation_master_key, const std::string& rsa_prg_key, const size_t tm_setup_size);
+            // the keyword counters are kept in a counter_backend store at token_map_path;
+            // a kSnapshot client can only search
+            SophosClient(const std::string& token_map_path, const size_t tm_setup_size, const CounterStore::Backend counter_backend = CounterStore::Backend::kMemory);
+            SophosClient(const std::string& token_map_path, const std::string& tdp_private_key, const std::string& derivation_master_key, const std::string& rsa_prg_key, const CounterStore::Backend counter_backend = CounterStore::Backend::kMemory);
+            SophosClient(const std::string& token_map_path, const std::string& tdp_private_key, const std::string& derivation_master_key, const std::string& rsa_prg_key, const size_t tm_setup_size, const CounterStore::Backend counter_backend = CounterStore::Backend::kMemory);
             
             ~SophosClient();
             
@@ -60,18 +68,31 @@ namespace sse {
             std::string rsa_prg_key() const;
             
             void write_keys(const std::string& dir_path) const;
+            // the counters, for a search-only client opened with kSnapshot
+            void write_counter_snapshot(const std::string& path) const;
             
             SearchRequest   search_request(const std::string &keyword) const;
+            // number of updates of keyword so far, i.e. the counter of its next update
+            uint32_t        update_count(const std::string &keyword) const;
             UpdateRequest   update_request(const std::string &keyword, const std::array<uint8_t, kUpdateTokenSize> index);
+            // Same requests as successive update_request calls: the search
+            // tokens are one chain of inversions from the first one, and the
+            // update tokens and masks all come from a single PRF instance.
+            std::vector<UpdateRequest> bulk_update_request(const std::string &keyword, const std::vector<std::array<uint8_t, kUpdateTokenSize> > &indexes);
             
             std::ostream& print_stats(std::ostream& out) const;
             
+            // 0 disables the search token cache
+            void set_token_cache_capacity(const size_t capacity);
+            size_t token_cache_capacity() const;
+            
             const crypto::Prf<kDerivationKeySize>& derivation_prf() const;
             const sse::crypto::TdpInverse& inverse_tdp() const;
+            // implementation of the inversions (CRT with precomputed dP/dQ powers by default)
+            void set_tdp_backend(const sse::crypto::TdpBackend backend);
             
             static const std::string tdp_sk_file__;
             static const std::string derivation_key_file__;
-            std::map<const std::string , uint32_t> ramCounter;
             
         private:
             static const std::string rsa_prg_key_file__;
@@ -83,8 +104,28 @@ namespace sse {
             
             std::string get_keyword_index(const std::string &kw) const;
             
+            static CounterStore::key_type counter_key(const std::string &seed);
+            
             crypto::Prf<crypto::Tdp::kRSAPrgSize> rsa_prg_;
             
+            std::unique_ptr<CounterStore> counters_;
+            
+            // Latest search token of the recently updated keywords: the next
+            // update of a cached keyword only inverts that token once, instead
+            // of running invert_mult from ST0. Entries are evicted in LRU order.
+            struct CachedToken {
+                std::string keyword;
+                uint32_t counter;
+                search_token_type token;
+            };
+            
+            bool cached_token(const std::string &keyword, const uint32_t counter, search_token_type &st) const;
+            void cache_token(const std::string &keyword, const uint32_t counter, const search_token_type &st);
+            
+            std::list<CachedToken> token_cache_;
+            std::unordered_map<std::string, std::list<CachedToken>::iterator> token_cache_index_;
+            size_t token_cache_capacity_;
+            
             
             std::mutex token_map_mtx_;
             
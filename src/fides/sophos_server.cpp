@@ -33,14 +33,21 @@ namespace sse {
     namespace sophos {
         using namespace std;
 
+        // The searches use the e^k keys of the pool for k up to their number of
+        // lanes, and never run more lanes than there are cores: the former
+        // 2 * cores keys (each with its own window tables) were never used.
+        static uint8_t tdp_pool_size() {
+            return (uint8_t) std::max(1u, std::min(255u, std::thread::hardware_concurrency()));
+        }
+
         SophosServer::SophosServer(const std::string& db_path, const std::string& tdp_pk, bool usehdd) :
-        edb_(db_path), public_tdp_(tdp_pk, 2 * std::thread::hardware_concurrency()) {
+        edb_(db_path), public_tdp_(tdp_pk, tdp_pool_size()) {
             this->usehdd = usehdd;
         }
 
         SophosServer::SophosServer(const std::string& db_path, const size_t tm_setup_size, const std::string& tdp_pk, bool usehdd) :
         edb_(db_path), /*edb_(db_path, tm_setup_size),*/
-        public_tdp_(tdp_pk, 2 * std::thread::hardware_concurrency()) {
+        public_tdp_(tdp_pk, tdp_pool_size()) {
             this->usehdd = usehdd;
         }
 
@@ -48,8 +55,91 @@ namespace sse {
             return public_tdp_.public_key();
         }
 
-        std::list<array<uint8_t, kUpdateTokenSize> > SophosServer::search(const SearchRequest& req, bool deleteItems) {
-            std::list<array<uint8_t, kUpdateTokenSize> > results;
+        void SophosServer::set_tdp_backend(const sse::crypto::TdpBackend backend) {
+            public_tdp_.set_backend(backend);
+        }
+
+        void SophosServer::set_result_cache_capacity(const size_t capacity) {
+            result_cache_.set_capacity(capacity);
+        }
+
+        ResultCache<SophosServer::value_type>::Stats SophosServer::result_cache_stats() const {
+            return result_cache_.stats();
+        }
+
+        std::string SophosServer::result_cache_key(const SearchRequest& req) {
+            std::string key(reinterpret_cast<const char*> (req.token.data()), req.token.size());
+            for (size_t i = 0; i < sizeof (req.add_count); i++) {
+                key.push_back((char) (req.add_count >> (8 * i)));
+            }
+            return key;
+        }
+
+        template <typename C>
+        bool SophosServer::cached_search(const SearchRequest& req, bool deleteItems, C& results) {
+            if (!result_cache_.enabled()) {
+                return false;
+            }
+            if (deleteItems) {
+                // the entries are about to leave the EDB
+                result_cache_.erase(result_cache_key(req));
+                return false;
+            }
+            return result_cache_.get(result_cache_key(req), results);
+        }
+
+        template <typename C>
+        void SophosServer::cache_results(const SearchRequest& req, bool deleteItems, const C& results) {
+            if (!deleteItems && result_cache_.enabled()) {
+                result_cache_.put(result_cache_key(req), results.begin(), results.end());
+            }
+        }
+
+        bool SophosServer::get(const update_token_type& token, value_type& r) const {
+            if (usehdd) {
+                return edb_.get(token, r);
+            }
+            return curArray.get(token, r);
+        }
+
+        bool SophosServer::parallel_get(const update_token_type& token, value_type& r, DeferredRemovals* removals) const {
+            if (logger::severity() <= logger::DBG) {
+                logger::log(logger::DBG) << "Derived token: " << hex_string(token) << std::endl;
+            }
+
+            if (!get(token, r)) {
+                //logger::log(logger::ERROR) << "We were supposed to find a value mapped to key " << hex_string(token) << std::endl;
+                return false;
+            }
+            if (removals != nullptr) {
+                std::lock_guard<std::mutex> lock(removals->mutex);
+                removals->tokens.push_back(token);
+            }
+            return true;
+        }
+
+        void SophosServer::remove_all(const std::vector<update_token_type>& tokens) {
+            if (tokens.empty()) {
+                return;
+            }
+            if (usehdd) {
+                edb_.remove_many(tokens[0].data(), kUpdateTokenSize, tokens.size());
+            } else {
+                for (const auto& token : tokens) {
+                    curArray.remove(token);
+                }
+            }
+        }
+
+        size_t SophosServer::size() const {
+            return curArray.size();
+        }
+
+        std::list<SophosServer::value_type> SophosServer::search(const SearchRequest& req, bool deleteItems) {
+            std::list<value_type> results;
+            if (cached_search(req, deleteItems, results)) {
+                return results;
+            }
 
             search_token_type st = req.token;
 
@@ -61,8 +151,7 @@ namespace sse {
             }
 
             for (size_t i = 0; i < req.add_count; i++) {
-                std::string st_string(reinterpret_cast<char*> (st.data()), st.size());
-                array<uint8_t, kUpdateTokenSize> r;
+                value_type r;
                 update_token_type ut;
                 std::array<uint8_t, kUpdateTokenSize> mask;
                 gen_update_token_masks(req.derivation_key, st.data(), ut, mask);
@@ -71,22 +160,12 @@ namespace sse {
                     logger::log(logger::DBG) << "Derived token: " << hex_string(ut) << std::endl;
                 }
 
-                bool found = false;
-                if (usehdd) {
-                    found = edb_.get(ut, r);
-                } else {
-                    if (curArray.count(ut) > 0) {
-                        found = true;
-                        r = curArray[ut];
-                    }
-
-                }
-                if (found) {
+                if (get(ut, r)) {
                     if (deleteItems) {
                         if (usehdd) {
                             edb_.remove(ut);
                         } else {
-                            curArray.erase(ut);
+                            curArray.remove(ut);
                         }
                     }
                     r = xor_mask(r, mask);
@@ -98,10 +177,11 @@ namespace sse {
                 st = public_tdp_.eval(st);
             }
 
+            cache_results(req, deleteItems, results);
             return results;
         }
 
-        void SophosServer::search_callback(const SearchRequest& req, std::function<void(index_type) > post_callback) {
+        void SophosServer::search_callback(const SearchRequest& req, std::function<void(const value_type&) > post_callback) {
             search_token_type st = req.token;
 
 
@@ -112,8 +192,7 @@ namespace sse {
             }
 
             for (size_t i = 0; i < req.add_count; i++) {
-                std::string st_string(reinterpret_cast<char*> (st.data()), st.size());
-                index_type r;
+                value_type r;
                 update_token_type ut;
                 std::array<uint8_t, kUpdateTokenSize> mask;
                 gen_update_token_masks(req.derivation_key, st.data(), ut, mask);
@@ -122,22 +201,7 @@ namespace sse {
                     logger::log(logger::DBG) << "Derived token: " << hex_string(ut) << std::endl;
                 }
 
-                bool found = false;
-                if (usehdd) {
-                    found = edb_.get(ut, r);
-                } else {
-                    if (curArray.count(ut) > 0) {
-                        found = true;
-                        //r = curArray[ut];
-                    }
-
-                }
-
-                if (found) {
-                    if (logger::severity() <= logger::DBG) {
-                        logger::log(logger::DBG) << "Found: " << std::hex << r << std::endl;
-                    }
-
+                if (get(ut, r)) {
                     r = xor_mask(r, mask);
                     post_callback(r);
                 } else {
@@ -148,8 +212,12 @@ namespace sse {
             }
         }
 
-        std::list<index_type> SophosServer::search_parallel_full(const SearchRequest& req) {
-            std::list<index_type> results;
+        std::list<SophosServer::value_type> SophosServer::search_parallel_full(const SearchRequest& req, bool deleteItems) {
+            std::list<value_type> results;
+            DeferredRemovals removals;
+            if (cached_search(req, deleteItems, results)) {
+                return results;
+            }
 
             search_token_type st = req.token;
 
@@ -165,39 +233,17 @@ namespace sse {
             ThreadPool token_map_pool(1);
             ThreadPool decrypt_pool(1);
 
-            auto decrypt_job = [&derivation_prf, &results](const index_type r, const std::string & st_string) {
-                index_type v = xor_mask(r, derivation_prf.prf(st_string + '1'));
+            auto decrypt_job = [&derivation_prf, &results](const value_type r, const std::string & st_string) {
+                value_type v = xor_mask(r, derivation_prf.prf(st_string + '1'));
                 results.push_back(v);
             };
 
-            auto lookup_job = [&derivation_prf, &decrypt_pool, &decrypt_job, this](const std::string& st_string, const update_token_type & token) {
-                index_type r;
-
-                if (logger::severity() <= logger::DBG) {
-                    logger::log(logger::DBG) << "Derived token: " << hex_string(token) << std::endl;
-                }
-
-                bool found = false;
-                if (usehdd) {
-                    found = edb_.get(token, r);
-                } else {
-                    if (curArray.count(token) > 0) {
-                        found = true;
-//                        r = curArray[token];
-                    }
-                }
-
-                if (found) {
-                    if (logger::severity() <= logger::DBG) {
-                        logger::log(logger::DBG) << "Found: " << std::hex << r << std::endl;
-                    }
+            auto lookup_job = [&decrypt_pool, &decrypt_job, &removals, deleteItems, this](const std::string& st_string, const update_token_type & token) {
+                value_type r;
 
+                if (parallel_get(token, r, deleteItems ? &removals : nullptr)) {
                     decrypt_pool.enqueue(decrypt_job, r, st_string);
-
-                } else {
-                    //logger::log(logger::ERROR) << "We were supposed to find something!" << std::endl;
                 }
-
             };
 
 
@@ -231,7 +277,10 @@ namespace sse {
 
             std::vector<std::thread> rsa_threads;
 
-            unsigned n_threads = std::thread::hardware_concurrency() - 3;
+            // the three pipeline stages have a thread each
+            unsigned n_threads = std::max(4u, std::thread::hardware_concurrency()) - 3;
+            // the lanes are strided by the public key pool
+            n_threads = std::min(n_threads, (unsigned) public_tdp_.maximum_order());
 
             for (uint8_t t = 0; t < n_threads; t++) {
                 rsa_threads.push_back(std::thread(rsa_job, t, req.add_count, n_threads));
@@ -243,19 +292,24 @@ namespace sse {
 
             prf_pool.join();
             token_map_pool.join();
+            decrypt_pool.join();
 
+            remove_all(removals.tokens);
 
+            cache_results(req, deleteItems, results);
             return results;
         }
 
-        std::list<index_type> SophosServer::search_parallel(const SearchRequest& req, uint8_t access_threads) {
-            std::list<index_type> results;
+        std::list<SophosServer::value_type> SophosServer::search_parallel(const SearchRequest& req, uint8_t access_threads, bool deleteItems) {
+            std::list<value_type> results;
             std::mutex res_mutex;
+            DeferredRemovals removals;
+            if (cached_search(req, deleteItems, results)) {
+                return results;
+            }
 
             search_token_type st = req.token;
 
-            //    auto derivation_prf = crypto::Prf<kUpdateTokenSize>(req.derivation_key);
-
             if (logger::severity() <= logger::DBG) {
                 logger::log(logger::DBG) << "Search token: " << hex_string(req.token) << std::endl;
 
@@ -264,41 +318,20 @@ namespace sse {
 
             ThreadPool access_pool(access_threads);
 
-            auto access_job = [&req, this, &results, &res_mutex](const std::string & st_string) {
+            auto access_job = [&req, this, &results, &res_mutex, &removals, deleteItems](const std::string & st_string) {
                 update_token_type token;
                 std::array<uint8_t, kUpdateTokenSize> mask;
                 gen_update_token_masks(req.derivation_key, (uint8_t *) st_string.data(), token, mask);
 
-                index_type r;
-
-                if (logger::severity() <= logger::DBG) {
-                    logger::log(logger::DBG) << "Derived token: " << hex_string(token) << std::endl;
-                }
+                value_type r;
 
-                bool found = false;
-                if (usehdd) {
-                    found = edb_.get(token, r);
-                } else {
-                    if (curArray.count(token) > 0) {
-                        found = true;
-                        //r = curArray[token];
-                    }
-                }
+                if (parallel_get(token, r, deleteItems ? &removals : nullptr)) {
+                    value_type v = xor_mask(r, mask);
 
-                if (found) {
-                    if (logger::severity() <= logger::DBG) {
-                        logger::log(logger::DBG) << "Found: " << std::hex << r << std::endl;
-                    }
-                } else {
-                    //logger::log(logger::ERROR) << "We were supposed to find something!" << std::endl;
+                    res_mutex.lock();
+                    results.push_back(v);
+                    res_mutex.unlock();
                 }
-
-                index_type v = xor_mask(r, mask);
-
-                res_mutex.lock();
-                results.push_back(v);
-                res_mutex.unlock();
-
             };
 
 
@@ -327,7 +360,9 @@ namespace sse {
 
             std::vector<std::thread> rsa_threads;
 
-            unsigned n_threads = std::thread::hardware_concurrency() - access_threads;
+            unsigned n_threads = std::max(access_threads + 1u, std::thread::hardware_concurrency()) - access_threads;
+            // the lanes are strided by the public key pool
+            n_threads = std::min(n_threads, (unsigned) public_tdp_.maximum_order());
 
             for (uint8_t t = 0; t < n_threads; t++) {
                 rsa_threads.push_back(std::thread(rsa_job, t, req.add_count, n_threads));
@@ -339,15 +374,33 @@ namespace sse {
 
             access_pool.join();
 
+            remove_all(removals.tokens);
+
+            cache_results(req, deleteItems, results);
             return results;
         }
 
-        std::list<index_type> SophosServer::search_parallel_light(const SearchRequest& req, uint8_t thread_count) {
-            search_token_type st = req.token;
-            std::list<index_type> results;
+        std::list<SophosServer::value_type> SophosServer::search_parallel_light(const SearchRequest& req, uint8_t thread_count, bool deleteItems) {
+            std::list<value_type> results;
             std::mutex res_mutex;
+            if (cached_search(req, deleteItems, results)) {
+                return results;
+            }
+
+            auto callback = [&results, &res_mutex](const value_type & v) {
+                std::lock_guard<std::mutex> lock(res_mutex);
+                results.push_back(v);
+            };
+
+            search_parallel_light_callback(req, callback, thread_count, deleteItems);
+
+            cache_results(req, deleteItems, results);
+            return results;
+        }
 
-            //    auto derivation_prf = crypto::Prf<kUpdateTokenSize>(req.derivation_key);
+        void SophosServer::search_parallel_callback(const SearchRequest& req, std::function<void(const value_type&) > post_callback, uint8_t rsa_thread_count, uint8_t access_thread_count, uint8_t post_thread_count, bool deleteItems) {
+            search_token_type st = req.token;
+            DeferredRemovals removals;
 
             if (logger::severity() <= logger::DBG) {
                 logger::log(logger::DBG) << "Search token: " << hex_string(req.token) << std::endl;
@@ -355,51 +408,27 @@ namespace sse {
                 logger::log(logger::DBG) << "Derivation key: " << hex_string(req.derivation_key) << std::endl;
             }
 
-            auto derive_access = [&req, this, &results, &res_mutex](const search_token_type st, size_t i) {
+            ThreadPool access_pool(access_thread_count);
+            ThreadPool post_pool(post_thread_count);
 
+            auto access_job = [&req, this, &post_pool, &post_callback, &removals, deleteItems](const search_token_type st, size_t i) {
                 update_token_type token;
                 std::array<uint8_t, kUpdateTokenSize> mask;
                 gen_update_token_masks(req.derivation_key, st.data(), token, mask);
 
+                value_type r;
 
-                index_type r;
+                if (parallel_get(token, r, deleteItems ? &removals : nullptr)) {
+                    value_type v = xor_mask(r, mask);
 
-                if (logger::severity() <= logger::DBG) {
-                    logger::log(logger::DBG) << "Derived token: " << hex_string(token) << std::endl;
-                }
-
-                bool found = false;
-                if (usehdd) {
-                    found = edb_.get(token, r);
-                } else {
-                    if (curArray.count(token) > 0) {
-                        found = true;
-                        //r = curArray[token];
-                    }
-                }
-
-                if (found) {
-                    if (logger::severity() <= logger::DBG) {
-                        logger::log(logger::DBG) << "Found: " << std::hex << r << std::endl;
-                    }
-
-                    index_type v = xor_mask(r, mask);
-
-                    res_mutex.lock();
-                    results.push_back(v);
-                    res_mutex.unlock();
-
-                } else {
-                    //logger::log(logger::ERROR) << "We were supposed to find a value mapped to key " << hex_string(token);
-                    //logger::log(logger::ERROR) << " (" << i << "-th derived key from search token " << hex_string(st) << ")" << std::endl;
+                    post_pool.enqueue(post_callback, v);
                 }
-
             };
 
 
 
             // the rsa job launched with input index,max computes all the RSA tokens of order i + kN up to max
-            auto job = [this, &st, &derive_access](const uint8_t index, const size_t max, const uint8_t N) {
+            auto rsa_job = [this, &st, &access_job, &access_pool](const uint8_t index, const size_t max, const uint8_t N) {
                 search_token_type local_st = st;
                 if (index != 0) {
                     local_st = public_tdp_.eval(local_st, index);
@@ -407,36 +436,38 @@ namespace sse {
 
                 if (index < max) {
                     // this is a valid search token, we have to derive it and do a lookup
-
-                    derive_access(local_st, index);
+                    access_pool.enqueue(access_job, local_st, index);
                 }
 
                 for (size_t i = index + N; i < max; i += N) {
                     local_st = public_tdp_.eval(local_st, N);
 
-                    derive_access(local_st, index);
+                    access_pool.enqueue(access_job, local_st, i);
                 }
             };
 
             std::vector<std::thread> rsa_threads;
 
-            //    unsigned n_threads = std::thread::hardware_concurrency()-access_threads;
+            // the lanes are strided by the public key pool
+            rsa_thread_count = std::min(rsa_thread_count, public_tdp_.maximum_order());
 
-            for (uint8_t t = 0; t < thread_count; t++) {
-                rsa_threads.push_back(std::thread(job, t, req.add_count, thread_count));
+            for (uint8_t t = 0; t < rsa_thread_count; t++) {
+                rsa_threads.push_back(std::thread(rsa_job, t, req.add_count, rsa_thread_count));
             }
 
-            for (uint8_t t = 0; t < thread_count; t++) {
+            for (uint8_t t = 0; t < rsa_thread_count; t++) {
                 rsa_threads[t].join();
             }
 
-            return results;
+            access_pool.join();
+            post_pool.join();
+
+            remove_all(removals.tokens);
         }
 
-        void SophosServer::search_parallel_callback(const SearchRequest& req, std::function<void(index_type) > post_callback, uint8_t rsa_thread_count, uint8_t access_thread_count, uint8_t post_thread_count) {
+        void SophosServer::search_parallel_light_callback(const SearchRequest& req, std::function<void(const value_type&) > post_callback, uint8_t thread_count, bool deleteItems) {
             search_token_type st = req.token;
-
-            //    auto derivation_prf = crypto::Prf<kUpdateTokenSize>(req.derivation_key);
+            DeferredRemovals removals;
 
             if (logger::severity() <= logger::DBG) {
                 logger::log(logger::DBG) << "Search token: " << hex_string(req.token) << std::endl;
@@ -444,50 +475,24 @@ namespace sse {
                 logger::log(logger::DBG) << "Derivation key: " << hex_string(req.derivation_key) << std::endl;
             }
 
-            ThreadPool access_pool(access_thread_count);
-            ThreadPool post_pool(post_thread_count);
-
-            auto access_job = [&req, this, &post_pool, &post_callback](const search_token_type st, size_t i) {
+            auto derive_access = [&req, this, &post_callback, &removals, deleteItems](const search_token_type st) {
                 update_token_type token;
                 std::array<uint8_t, kUpdateTokenSize> mask;
                 gen_update_token_masks(req.derivation_key, st.data(), token, mask);
 
-                index_type r;
+                value_type r;
 
-                if (logger::severity() <= logger::DBG) {
-                    logger::log(logger::DBG) << "Derived token: " << hex_string(token) << std::endl;
-                }
+                if (parallel_get(token, r, deleteItems ? &removals : nullptr)) {
+                    value_type v = xor_mask(r, mask);
 
-                bool found = false;
-                if (usehdd) {
-                    found = edb_.get(token, r);
-                } else {
-                    if (curArray.count(token) > 0) {
-                        found = true;
-                        //r = curArray[token];
-                    }
-                }
-
-                if (found) {
-                    if (logger::severity() <= logger::DBG) {
-                        logger::log(logger::DBG) << "Found: " << std::hex << r << std::endl;
-                    }
-
-                    index_type v = xor_mask(r, mask);
-
-                    post_pool.enqueue(post_callback, v);
-
-                } else {
-                    //logger::log(logger::ERROR) << "We were supposed to find a value mapped to key " << hex_string(token);
-                    //logger::log(logger::ERROR) << " (" << i << "-th derived key from search token " << hex_string(st) << ")" << std::endl;
+                    post_callback(v);
                 }
-
             };
 
 
 
             // the rsa job launched with input index,max computes all the RSA tokens of order i + kN up to max
-            auto rsa_job = [this, &st, &access_job, &access_pool](const uint8_t index, const size_t max, const uint8_t N) {
+            auto job = [this, &st, &derive_access](const uint8_t index, const size_t max, const uint8_t N) {
                 search_token_type local_st = st;
                 if (index != 0) {
                     local_st = public_tdp_.eval(local_st, index);
@@ -495,110 +500,153 @@ namespace sse {
 
                 if (index < max) {
                     // this is a valid search token, we have to derive it and do a lookup
-                    access_pool.enqueue(access_job, local_st, index);
+
+                    derive_access(local_st);
                 }
 
                 for (size_t i = index + N; i < max; i += N) {
                     local_st = public_tdp_.eval(local_st, N);
 
-                    access_pool.enqueue(access_job, local_st, i);
+                    derive_access(local_st);
                 }
             };
 
             std::vector<std::thread> rsa_threads;
 
-            //    unsigned n_threads = std::thread::hardware_concurrency()-access_threads;
+            // the lanes are strided by the public key pool
+            thread_count = std::min(thread_count, public_tdp_.maximum_order());
 
-            for (uint8_t t = 0; t < rsa_thread_count; t++) {
-                rsa_threads.push_back(std::thread(rsa_job, t, req.add_count, rsa_thread_count));
+            for (uint8_t t = 0; t < thread_count; t++) {
+                rsa_threads.push_back(std::thread(job, t, req.add_count, thread_count));
             }
 
-            for (uint8_t t = 0; t < rsa_thread_count; t++) {
+            for (uint8_t t = 0; t < thread_count; t++) {
                 rsa_threads[t].join();
             }
 
-            access_pool.join();
-            post_pool.join();
+            remove_all(removals.tokens);
         }
 
-        void SophosServer::search_parallel_light_callback(const SearchRequest& req, std::function<void(index_type) > post_callback, uint8_t thread_count) {
-            search_token_type st = req.token;
+        constexpr size_t SophosServer::kLaneBatchSize;
 
-            if (logger::severity() <= logger::DBG) {
-                logger::log(logger::DBG) << "Search token: " << hex_string(req.token) << std::endl;
-
-                logger::log(logger::DBG) << "Derivation key: " << hex_string(req.derivation_key) << std::endl;
-            }
+        std::list<SophosServer::value_type> SophosServer::search_pipelined(const SearchRequest& req, uint8_t lane_count, bool deleteItems) {
+            std::list<value_type> results;
+            std::mutex results_mtx;
 
-            auto derive_access = [&req, this, &post_callback](const search_token_type st, size_t i) {
-                update_token_type token;
-                std::array<uint8_t, kUpdateTokenSize> mask;
-                gen_update_token_masks(req.derivation_key, st.data(), token, mask);
+            auto post_callback = [&results, &results_mtx](const value_type* hits, size_t n) {
+                std::lock_guard<std::mutex> lock(results_mtx);
+                results.insert(results.end(), hits, hits + n);
+            };
+            search_pipelined_callback(req, post_callback, lane_count, deleteItems);
 
-                index_type r;
+            return results;
+        }
 
-                if (logger::severity() <= logger::DBG) {
-                    logger::log(logger::DBG) << "Derived token: " << hex_string(token) << std::endl;
-                }
+        void SophosServer::search_pipelined_callback(const SearchRequest& req, std::function<void(const value_type*, size_t)> post_callback, uint8_t lane_count, bool deleteItems) {
+            if (req.add_count == 0) {
+                return;
+            }
 
-                bool found = false;
-                if (usehdd) {
-                    found = edb_.get(token, r);
-                } else {
-                    if (curArray.count(token) > 0) {
-                        found = true;
-                        //r = curArray[token];
-                    }
+            std::vector<value_type> cached;
+            if (cached_search(req, deleteItems, cached)) {
+                // in batches, as the lanes would
+                for (size_t i = 0; i < cached.size(); i += kLaneBatchSize) {
+                    post_callback(cached.data() + i, std::min(kLaneBatchSize, cached.size() - i));
                 }
+                return;
+            }
 
-                if (found) {
-                    if (logger::severity() <= logger::DBG) {
-                        logger::log(logger::DBG) << "Found: " << std::hex << r << std::endl;
-                    }
-
-                    index_type v = xor_mask(r, mask);
-
-                    post_callback(v);
-
-                } else {
-                    //logger::log(logger::ERROR) << "We were supposed to find a value mapped to key " << hex_string(token);
-                    //logger::log(logger::ERROR) << " (" << i << "-th derived key from search token " << hex_string(st) << ")" << std::endl;
+            // on a cache miss, the hits are also collected for the cache
+            const bool collect = !deleteItems && result_cache_.enabled();
+            std::mutex cached_mtx;
+            auto emit = [&post_callback, collect, &cached, &cached_mtx](const value_type* hits, size_t n) {
+                if (collect) {
+                    std::lock_guard<std::mutex> lock(cached_mtx);
+                    cached.insert(cached.end(), hits, hits + n);
                 }
-
+                post_callback(hits, n);
             };
 
+            if (logger::severity() <= logger::DBG) {
+                logger::log(logger::DBG) << "Search token: " << hex_string(req.token) << std::endl;
 
+                logger::log(logger::DBG) << "Derivation key: " << hex_string(req.derivation_key) << std::endl;
+            }
 
-            // the rsa job launched with input index,max computes all the RSA tokens of order i + kN up to max
-            auto job = [this, &st, &derive_access](const uint8_t index, const size_t max, const uint8_t N) {
-                search_token_type local_st = st;
-                if (index != 0) {
-                    local_st = public_tdp_.eval(local_st, index);
-                }
-
-                if (index < max) {
-                    // this is a valid search token, we have to derive it and do a lookup
+            // the lanes are strided by the public key pool
+            lane_count = std::min(lane_count, public_tdp_.maximum_order());
+            lane_count = (uint8_t) std::min<uint32_t>(lane_count, req.add_count);
+            lane_count = std::max<uint8_t>(lane_count, 1);
+
+            std::vector<std::vector<update_token_type> > lane_removals(lane_count);
+
+            auto lane = [this, &req, &emit, lane_count, &lane_removals, deleteItems](const uint8_t index) {
+                const size_t count = (req.add_count - index + lane_count - 1) / lane_count;
+                const size_t batch_size = std::min(count, kLaneBatchSize);
+                auto derivation_prf = crypto::Prf<kUpdateTokenSize>(req.derivation_key);
+
+                // one more token, the start of the next batch
+                std::vector<search_token_type> tokens(batch_size + 1);
+                std::vector<update_token_type> uts(batch_size);
+                std::vector<value_type> masks(batch_size);
+                std::vector<value_type> values(batch_size);
+                std::vector<uint8_t> found(batch_size);
+                std::vector<value_type> hits(batch_size);
+
+                tokens[0] = (index == 0) ? req.token : public_tdp_.eval(req.token, index);
+
+                for (size_t done = 0; done < count;) {
+                    const size_t n = std::min(count - done, kLaneBatchSize);
+                    const size_t steps = (done + n < count) ? n : n - 1;
+                    public_tdp_.eval_chain(tokens[0], lane_count, steps, tokens.data() + 1);
+
+                    for (size_t i = 0; i < n; i++) {
+                        std::string st_string(reinterpret_cast<char*> (tokens[i].data()), tokens[i].size());
+                        uts[i] = derivation_prf.prf(st_string + '0');
+                        masks[i] = derivation_prf.prf(st_string + '1');
+                    }
 
-                    derive_access(local_st, index);
-                }
+                    if (usehdd) {
+                        edb_.get_many(uts[0].data(), kUpdateTokenSize, n, values.data(), found.data());
+                    } else {
+                        curArray.lookup_many(uts[0].data(), n, values.data(), found.data());
+                    }
 
-                for (size_t i = index + N; i < max; i += N) {
-                    local_st = public_tdp_.eval(local_st, N);
+                    size_t hit_count = 0;
+                    for (size_t i = 0; i < n; i++) {
+                        if (found[i]) {
+                            hits[hit_count++] = xor_mask(values[i], masks[i]);
+                            if (deleteItems) {
+                                lane_removals[index].push_back(uts[i]);
+                            }
+                        }
+                    }
+                    if (hit_count > 0) {
+                        emit(hits.data(), hit_count);
+                    }
 
-                    derive_access(local_st, index);
+                    done += n;
+                    tokens[0] = tokens[n];
                 }
             };
 
-            std::vector<std::thread> rsa_threads;
+            std::vector<std::thread> lane_threads;
 
-            //    unsigned n_threads = std::thread::hardware_concurrency()-access_threads;
+            for (uint8_t t = 1; t < lane_count; t++) {
+                lane_threads.push_back(std::thread(lane, t));
+            }
+            lane(0);
 
-            for (uint8_t t = 0; t < thread_count; t++) {
-                rsa_threads.push_back(std::thread(job, t, req.add_count, thread_count));
+            for (auto& thread : lane_threads) {
+                thread.join();
             }
 
-            for (uint8_t t = 0; t < thread_count; t++) {
-                rsa_threads[t].join();
+            for (uint8_t t = 0; t < lane_count; t++) {
+                remove_all(lane_removals[t]);
+            }
+
+            if (collect) {
+                cache_results(req, deleteItems, cached);
             }
         }
 
@@ -606,14 +654,36 @@ namespace sse {
             if (usehdd) {
                 edb_.put(req.token, req.index);
             } else {
-                curArray.insert(pair<const std::array<uint8_t, 16>, const std::array<uint8_t, 16> >(req.token, req.index));
+                curArray.insert(req.token, req.index);
             }
         }
 
+        void SophosServer::bulk_update(const std::vector<UpdateRequest>& reqs) {
+            if (!usehdd) {
+                curArray.reserve(curArray.size() + reqs.size());
+                for (const auto& req : reqs) {
+                    curArray.insert(req.token, req.index);
+                }
+                return;
+            }
+
+            rocksdb::WriteBatch batch;
+            for (const auto& req : reqs) {
+                batch.Put(rocksdb::Slice(reinterpret_cast<const char*> (req.token.data()), req.token.size()),
+                        rocksdb::Slice(reinterpret_cast<const char*> (req.index.data()), req.index.size()));
+            }
+            edb_.write(batch);
+        }
+
         std::ostream& SophosServer::print_stats(std::ostream& out) const {
 //            out << "Number of tokens: " << edb_.size();
 //            out << "; Load: " << edb_.load();
 //            out << "; Overflow bucket size: " << edb_.overflow_size() << std::endl;
+            if (result_cache_.enabled()) {
+                auto stats = result_cache_.stats();
+                out << "Result cache: " << stats.hits << " hits, " << stats.misses << " misses, " << stats.evictions << " evictions; ";
+                out << stats.entries << " entries, " << stats.results << " results" << std::endl;
+            }
 
             return out;
         }
@@ -27,7 +27,12 @@
 #include <array>
 #include <fstream>
 #include <functional>
-#include <map>
+#include <list>
+#include <mutex>
+#include <vector>
+
+#include "utils/flat_token_map.hpp"
+#include "utils/result_cache.hpp"
 
 #include <sse/crypto/tdp.hpp>
 #include <sse/crypto/prf.hpp>
@@ -39,31 +44,80 @@ namespace sophos {
     class SophosServer {
     public:
         
-        
+        typedef std::array<uint8_t, kUpdateTokenSize> value_type;
         
         SophosServer(const std::string& db_path, const std::string& tdp_pk,bool usehdd);
         SophosServer(const std::string& db_path, const size_t tm_setup_size, const std::string& tdp_pk,bool usehdd);
         
         const std::string public_key() const;
 
-        std::list< std::array<uint8_t,kUpdateTokenSize> > search(const SearchRequest& req, bool deleteItems);
-        void search_callback(const SearchRequest& req, std::function<void(index_type)> post_callback);
+        std::list<value_type> search(const SearchRequest& req, bool deleteItems);
+        void search_callback(const SearchRequest& req, std::function<void(const value_type&)> post_callback);
         
-        std::list<index_type> search_parallel_full(const SearchRequest& req);
-        std::list<index_type> search_parallel(const SearchRequest& req, uint8_t access_threads);
-        std::list<index_type> search_parallel_light(const SearchRequest& req, uint8_t thread_count);
+        // The parallel variants only read the EDB while their threads run:
+        // with deleteItems, the matching entries are removed in a single
+        // batch once the search is over. Results come in no particular order.
+        std::list<value_type> search_parallel_full(const SearchRequest& req, bool deleteItems = false);
+        std::list<value_type> search_parallel(const SearchRequest& req, uint8_t access_threads, bool deleteItems = false);
+        std::list<value_type> search_parallel_light(const SearchRequest& req, uint8_t thread_count, bool deleteItems = false);
+
+        void search_parallel_callback(const SearchRequest& req, std::function<void(const value_type&)> post_callback, uint8_t rsa_thread_count, uint8_t access_thread_count, uint8_t post_thread_count, bool deleteItems = false);
+        void search_parallel_light_callback(const SearchRequest& req, std::function<void(const value_type&)> post_callback, uint8_t thread_count, bool deleteItems = false);
 
-        void search_parallel_callback(const SearchRequest& req, std::function<void(index_type)> post_callback, uint8_t rsa_thread_count, uint8_t access_thread_count, uint8_t post_thread_count);
-        void search_parallel_light_callback(const SearchRequest& req, std::function<void(index_type)> post_callback, uint8_t thread_count);
+        // Splits the token chain in lane_count strided lanes (lane i walks the
+        // tokens i, i+K, i+2K... with the e^K key of the pool). Every lane
+        // evaluates kLaneBatchSize tokens at once with eval_chain, then derives
+        // and looks them up as a batch, so the lanes overlap the TDP, PRF and
+        // EDB work. Entries found with deleteItems are removed at the end.
+        std::list<value_type> search_pipelined(const SearchRequest& req, uint8_t lane_count, bool deleteItems = false);
+        // post_callback gets the hits of every lane batch, concurrently from the lanes
+        void search_pipelined_callback(const SearchRequest& req, std::function<void(const value_type*, size_t)> post_callback, uint8_t lane_count, bool deleteItems = false);
+        static constexpr size_t kLaneBatchSize = 64;
 
         void update(const UpdateRequest& req);
+        void bulk_update(const std::vector<UpdateRequest>& reqs);
+        
+        // number of entries of the in-memory EDB
+        size_t size() const;
+        
+        // implementation of the token evaluations (fixed-window Montgomery by default)
+        void set_tdp_backend(const sse::crypto::TdpBackend backend);
+        
+        // Opt-in cache of the results of the searches returning a list and
+        // of search_pipelined_callback, keyed by the search token and the add
+        // count. capacity is a number of results, 0 (the default) disables
+        // it. The deleting searches are never served from it.
+        void set_result_cache_capacity(const size_t capacity);
+        ResultCache<value_type>::Stats result_cache_stats() const;
         
         std::ostream& print_stats(std::ostream& out) const;
         sse::crypto::TdpMultPool public_tdp_;
+    private:
+        // tokens found by a parallel search, removed when it is over
+        struct DeferredRemovals {
+            std::mutex mutex;
+            std::vector<update_token_type> tokens;
+        };
+        
+        bool get(const update_token_type& token, value_type& r) const;
+        // lookup of the parallel searches: queues the token in removals (if any)
+        bool parallel_get(const update_token_type& token, value_type& r, DeferredRemovals* removals) const;
+        void remove_all(const std::vector<update_token_type>& tokens);
+        
+        static std::string result_cache_key(const SearchRequest& req);
+        // appends the cached results of req to results; a deleting search
+        // drops the entry of req instead
+        template <typename C>
+        bool cached_search(const SearchRequest& req, bool deleteItems, C& results);
+        template <typename C>
+        void cache_results(const SearchRequest& req, bool deleteItems, const C& results);
+        
+        ResultCache<value_type> result_cache_;
+        
     public:
         RockDBWrapper edb_;
         bool usehdd;
-        std::map<std::array<uint8_t, 16> , std::array<uint8_t, 16> > curArray;
+        FlatTokenMap<kUpdateTokenSize, value_type> curArray;
     };
 
 } // namespace sophos
@@ -24,16 +24,15 @@ private:
     std::mt19937 mt;
     std::uniform_int_distribution<int> dis;
 
-    int height(Bid N, int& leaf);
     int max(int a, int b);
     Node* newNode(Bid key, string value);
-    Node* rightRotate(Node* y);
-    Node* leftRotate(Node* x);
-    int getBalance(Node* N);
+    Node* rightRotate(Node* y, Node* x);
+    Node* leftRotate(Node* x, Node* y);
+    Node* insertNode(Bid rootKey, int& pos, Bid key, string value);
     int RandomPath();
 
 public:
-    AVLTree(int maxSize, bytes<Key> key);
+    AVLTree(int maxSize, bytes<Key> key, bool initialize = true, RAMStoreFactory storeFactory = nullptr);
     virtual ~AVLTree();
     Bid insert(Bid rootKey, int& pos, Bid key, string value);
     Node* search(Node* head, Bid key);
@@ -41,6 +40,11 @@ public:
     void printTree(Node* root, int indent);
     void startOperation(bool batchWrite = false);
     void finishOperation(bool find, Bid& rootKey, int& rootPos);
+    void finishOperation(int finds, int inserts, Bid& rootKey, int& rootPos);
+    const ORAMMetrics& getMetrics() const;
+    void resetMetrics();
+    void serialise(CheckpointWriter& out);
+    void deserialise(CheckpointReader& in);
 };
 
 #endif /* AVLTREE_H */
@@ -0,0 +1,31 @@
+#ifndef BUCKETSTORESERVERRUNNER_H
+#define BUCKETSTORESERVERRUNNER_H
+
+#include "RAMStore.hpp"
+#include "oram.grpc.pb.h"
+
+#include <map>
+#include <memory>
+#include <mutex>
+
+#include <grpc++/server.h>
+#include <grpc++/server_context.h>
+
+/*
+ * Server side of RemoteRAMStore: keeps one in-memory RAMStore per store id
+ * (Orion and Horus use two each) and serves batched bucket reads and writes.
+ */
+class BucketStoreServerRunner : public BucketStore::Service {
+public:
+    BucketStoreServerRunner();
+    virtual ~BucketStoreServerRunner();
+    grpc::Status setup(grpc::ServerContext* context, const BucketStoreSetupMessage* request, google::protobuf::Empty* e);
+    grpc::Status readBuckets(grpc::ServerContext* context, const ReadBucketsMessage* request, ReadBucketsReply* reply);
+    grpc::Status writeBuckets(grpc::ServerContext* context, const WriteBucketsMessage* request, google::protobuf::Empty* e);
+private:
+    RAMStore* getStore(uint32_t id);
+    std::map<uint32_t, std::unique_ptr<RAMStore> > stores_;
+    std::mutex stores_mtx_;
+};
+
+#endif /* BUCKETSTORESERVERRUNNER_H */
@@ -1,19 +1,37 @@
 #include "Horus.h"
 #include "utils/Utilities.h"
+#include "utils/Checkpoint.h"
+#include "RemoteRAMStore.hpp"
 #include <boost/algorithm/string/split.hpp>
 #include <boost/algorithm/string/classification.hpp>
 #include <sse/crypto/prg.hpp>
+#include <grpc++/create_channel.h>
 
 using namespace boost::algorithm;
 
 #define INC_FACTOR 4
 
-Horus::Horus(bool usehdd, int maxSize) {
+Horus::Horus(bool usehdd, int maxSize) : Horus(usehdd, maxSize, true, "") {
+}
+
+/**
+ * Keeps the buckets of both ORAMs on the BucketStore server at storeAddress instead of in local memory
+ */
+Horus::Horus(bool usehdd, int maxSize, string storeAddress) : Horus(usehdd, maxSize, true, storeAddress) {
+}
+
+Horus::Horus(bool usehdd, int maxSize, bool initialize, string storeAddress) {
     this->useHDD = usehdd;
     bytes<Key> key1{0};
     bytes<Key> key2{1};
-    OMAP_updt = new OMAP(maxSize * INC_FACTOR, key1);
-    ORAM_srch = new PRFORAM(maxSize * INC_FACTOR, key2);
+    RAMStoreFactory updtStore = nullptr, srchStore = nullptr;
+    if (storeAddress != "") {
+        std::shared_ptr<grpc::Channel> channel(grpc::CreateChannel(storeAddress, grpc::InsecureChannelCredentials()));
+        updtStore = RemoteRAMStore::factory(channel, 0);
+        srchStore = RemoteRAMStore::factory(channel, 1);
+    }
+    OMAP_updt = new OMAP(maxSize * INC_FACTOR, key1, initialize, updtStore);
+    ORAM_srch = new PRFORAM(maxSize * INC_FACTOR, key2, initialize, srchStore);
     this->maxSize = maxSize;
 }
 
@@ -319,3 +337,60 @@ int Horus::generatePosition(string keyword, int updt_cnt, int src_cnt, int acc_c
     int pos = (result) % (int) ((pow(2, floor(log2(maxSize * INC_FACTOR / Z)) + 1) - 1) / 2);
     return pos;
 }
+
+/**
+ * This function writes the client state, the update OMAP and the search PRFORAM into a single checkpoint
+ * file. It should not be called between beginSetup() and endSetup()
+ */
+void Horus::saveCheckpoint(string path) {
+    CheckpointWriter out(path, CHECKPOINT_HORUS);
+    out.writeValue<uint8_t>(useHDD);
+    out.writeValue<int32_t>(maxSize);
+    out.writeMap(UpdtCnt);
+    out.writeMap(SrchCnt);
+    out.writeMap(Access);
+    out.writeMap(LastIND);
+    out.writeMap(latestUpdatedCounter);
+    OMAP_updt->serialise(out);
+    ORAM_srch->Serialise(out);
+    out.close();
+}
+
+/**
+ * This function restores an instance saved by saveCheckpoint() without running the setup again. If
+ * storeAddress is given, the buckets are uploaded to that BucketStore server
+ */
+Horus* Horus::loadCheckpoint(string path, string storeAddress) {
+    CheckpointReader in(path, CHECKPOINT_HORUS);
+    bool usehdd = in.readValue<uint8_t>();
+    int maxSize = in.readValue<int32_t>();
+    Horus* horus = new Horus(usehdd, maxSize, false, storeAddress);
+    try {
+        horus->UpdtCnt = in.readMap();
+        horus->SrchCnt = in.readMap();
+        horus->Access = in.readMap();
+        horus->LastIND = in.readMap();
+        horus->latestUpdatedCounter = in.readMap();
+        horus->OMAP_updt->deserialise(in);
+        horus->ORAM_srch->Deserialise(in);
+        if (!in.finished()) {
+            throw runtime_error("Checkpoint has trailing data");
+        }
+    } catch (...) {
+        delete horus;
+        throw;
+    }
+    return horus;
+}
+
+/**
+ * Returns the metrics of the update OMAP and the search PRFORAM as a JSON object
+ */
+string Horus::dumpMetrics() const {
+    return "{\"updt\":" + OMAP_updt->dumpMetrics() + ",\"srch\":" + ORAM_srch->dumpMetrics() + "}";
+}
+
+void Horus::resetMetrics() {
+    OMAP_updt->resetMetrics();
+    ORAM_srch->resetMetrics();
+}
@@ -25,6 +25,7 @@ private:
     map<string, int> poses;
     int maxSize;
     PRFORAM* ORAM_srch;
+    Horus(bool useHDD, int maxSize, bool initialize, string storeAddress);
 
 public:
     void insert(string keyword, int ind);
@@ -33,9 +34,14 @@ public:
     void setupRemove(string keyword, int ind);
     vector<int> search(string keyword);
     Horus(bool useHDD, int maxSize);
+    Horus(bool useHDD, int maxSize, string storeAddress);
     virtual ~Horus();
     void beginSetup();
     void endSetup();
+    string dumpMetrics() const;
+    void saveCheckpoint(string path);
+    static Horus* loadCheckpoint(string path, string storeAddress = "");
+    void resetMetrics();
 
 };
 
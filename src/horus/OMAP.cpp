@@ -1,13 +1,17 @@
 #include "OMAP.h"
+#include "../utils/Checkpoint.h"
 using namespace std;
 
-OMAP::OMAP(int maxSize, bytes<Key> key) {
-    treeHandler = new AVLTree(maxSize, key);
+OMAP::OMAP(int maxSize, bytes<Key> key, bool initialize, RAMStoreFactory storeFactory) {
+    treeHandler = new AVLTree(maxSize, key, initialize, storeFactory);
     rootKey = 0;
+    rootPos = 0;
+    batchFinds = 0;
+    batchInserts = 0;
 }
 
 OMAP::~OMAP() {
-
+    delete treeHandler;
 }
 
 string OMAP::find(Bid key) {
@@ -92,3 +96,77 @@ vector<string> OMAP::batchSearch(vector<Bid> keys) {
     treeHandler->finishOperation(true, rootKey, rootPos);
     return result;
 }
+
+/**
+ * These functions run several finds and inserts as one oblivious operation.
+ * Paths shared between the accesses are fetched once and there is a single
+ * eviction in finishBatch(), which pads the operation to paddedFinds finds and
+ * paddedInserts inserts (or to the real counts if they are larger).
+ */
+void OMAP::startBatch() {
+    batchFinds = 0;
+    batchInserts = 0;
+    treeHandler->startOperation(false);
+}
+
+string OMAP::findInBatch(Bid key) {
+    batchFinds++;
+    if (rootKey == 0) {
+        return "";
+    }
+    Node* node = new Node();
+    node->key = rootKey;
+    node->pos = rootPos;
+    auto resNode = treeHandler->search(node, key);
+    delete node;
+    string res = "";
+    if (resNode != NULL) {
+        res.assign(resNode->value.begin(), resNode->value.end());
+        res = res.c_str();
+    }
+    return res;
+}
+
+void OMAP::insertInBatch(Bid key, string value) {
+    batchInserts++;
+    if (rootKey == 0) {
+        rootKey = treeHandler->insert(0, rootPos, key, value);
+    } else {
+        rootKey = treeHandler->insert(rootKey, rootPos, key, value);
+    }
+}
+
+void OMAP::finishBatch(int paddedFinds, int paddedInserts) {
+    treeHandler->finishOperation(std::max(batchFinds, paddedFinds), std::max(batchInserts, paddedInserts), rootKey, rootPos);
+}
+
+const ORAMMetrics& OMAP::getMetrics() const {
+    return treeHandler->getMetrics();
+}
+
+/**
+ * Returns the metrics of the underlying ORAM as a JSON object
+ */
+string OMAP::dumpMetrics() const {
+    return treeHandler->getMetrics().toJSON();
+}
+
+void OMAP::resetMetrics() {
+    treeHandler->resetMetrics();
+}
+
+/**
+ * Writes the root of the tree and the underlying ORAM to a checkpoint
+ */
+void OMAP::serialise(CheckpointWriter& out) {
+    out.write(rootKey.id.data(), rootKey.id.size());
+    out.writeValue<int32_t>(rootPos);
+    treeHandler->serialise(out);
+}
+
+void OMAP::deserialise(CheckpointReader& in) {
+    const byte_t* data = in.read(rootKey.id.size());
+    std::copy(data, data + rootKey.id.size(), rootKey.id.begin());
+    rootPos = in.readValue<int32_t>();
+    treeHandler->deserialise(in);
+}
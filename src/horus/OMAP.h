@@ -16,15 +16,26 @@ private:
     Bid rootKey;
     int rootPos;
     AVLTree* treeHandler;
+    int batchFinds;
+    int batchInserts;
 
 public:
-    OMAP(int maxSize, bytes<Key> key);
+    OMAP(int maxSize, bytes<Key> key, bool initialize = true, RAMStoreFactory storeFactory = nullptr);
     virtual ~OMAP();
     void insert(Bid key, string value);
     string find(Bid key);
     void printTree();
     void batchInsert(map<Bid, string> pairs);
     vector<string> batchSearch(vector<Bid> keys);
+    void startBatch();
+    string findInBatch(Bid key);
+    void insertInBatch(Bid key, string value);
+    void finishBatch(int paddedFinds, int paddedInserts);
+    const ORAMMetrics& getMetrics() const;
+    string dumpMetrics() const;
+    void resetMetrics();
+    void serialise(CheckpointWriter& out);
+    void deserialise(CheckpointReader& in);
 };
 
 #endif /* OMAP_H */
@@ -1,5 +1,6 @@
 #include "ORAM.hpp"
 #include "../utils/Utilities.h"
+#include "../utils/Checkpoint.h"
 #include <algorithm>
 #include <iomanip>
 #include <fstream>
@@ -10,7 +11,7 @@
 #include <map>
 #include <stdexcept>
 
-ORAM::ORAM(int maxSize, bytes<Key> key)
+ORAM::ORAM(int maxSize, bytes<Key> key, bool initialize, RAMStoreFactory storeFactory)
 : key(key), rd(), mt(rd()), dis(0, (pow(2, floor(log2(maxSize / Z))) - 1) / 2) {
     AES::Setup();
     depth = floor(log2(maxSize / Z));
@@ -21,8 +22,13 @@ ORAM::ORAM(int maxSize, bytes<Key> key)
     size_t storeBlockCount = blockCount;
     clen_size = AES::GetCiphertextLength((blockSize) * Z);
     plaintext_size = (blockSize) * Z;
-    store = new RAMStore(storeBlockCount, storeBlockSize);
-    for (size_t i = 0; i < bucketCount; i++) {
+    if (storeFactory) {
+        store = storeFactory(storeBlockCount, storeBlockSize);
+    } else {
+        store = new RAMStore(storeBlockCount, storeBlockSize);
+    }
+    // the buckets of a restored ORAM are loaded by Deserialise()
+    for (size_t i = 0; initialize && i < bucketCount; i++) {
         Bucket bucket;
         for (int z = 0; z < Z; z++) {
             bucket[z].id = 0;
@@ -30,9 +36,14 @@ ORAM::ORAM(int maxSize, bytes<Key> key)
         }
         WriteBucket(i, bucket);
     }
+    store->Flush();
+    // initialisation writes are not part of any operation
+    metrics.reset();
+    metrics.freeBlocks = store->GetEmptySize();
 }
 
 ORAM::~ORAM() {
+    delete store;
     AES::Cleanup();
 }
 
@@ -84,15 +95,28 @@ Bucket ORAM::DeserialiseBucket(block buffer) {
 }
 
 Bucket ORAM::ReadBucket(int index) {
-    block ciphertext = store->Read(index);
+    return DecryptBucket(store->Read(index));
+}
+
+Bucket ORAM::DecryptBucket(const block& ciphertext) {
+    uint64_t begin = ORAMMetrics::now();
     block buffer = AES::Decrypt(key, ciphertext, clen_size);
+    metrics.cryptoTime += ORAMMetrics::now() - begin;
+    metrics.decryptedBytes += ciphertext.size();
+    metrics.bucketsRead++;
+    opBucketsRead++;
     Bucket bucket = DeserialiseBucket(buffer);
     return bucket;
 }
 
 void ORAM::WriteBucket(int index, Bucket bucket) {
     block b = SerialiseBucket(bucket);
+    uint64_t begin = ORAMMetrics::now();
     block ciphertext = AES::Encrypt(key, b, clen_size, plaintext_size);
+    metrics.cryptoTime += ORAMMetrics::now() - begin;
+    metrics.encryptedBytes += ciphertext.size();
+    metrics.bucketsWritten++;
+    opBucketsWritten++;
     store->Write(index, ciphertext);
 }
 
@@ -100,6 +124,8 @@ void ORAM::WriteBucket(int index, Bucket bucket) {
 
 void ORAM::FetchPath(int leaf) {
     readCnt++;
+    metrics.pathsFetched++;
+    vector<int> nodes;
     for (size_t d = 0; d <= depth; d++) {
         int node = GetNodeOnPath(leaf, d);
 
@@ -107,9 +133,14 @@ void ORAM::FetchPath(int leaf) {
             continue;
         } else {
             readviewmap.push_back(node);
+            nodes.push_back(node);
         }
+    }
 
-        Bucket bucket = ReadBucket(node);
+    // all the buckets of the path are requested from the store at once
+    vector<block> ciphertexts = store->ReadBatch(nodes);
+    for (auto& ciphertext : ciphertexts) {
+        Bucket bucket = DecryptBucket(ciphertext);
 
         for (int z = 0; z < Z; z++) {
             Block &block = bucket[z];
@@ -126,6 +157,26 @@ void ORAM::FetchPath(int leaf) {
     }
 }
 
+// Asks the store to start loading the buckets of the given paths which have
+// not been read in this operation. It only starts reads FetchPath() is going
+// to do anyway, so the access pattern does not change.
+
+void ORAM::PrefetchPaths(const vector<int>& leaves) {
+    vector<int> nodes;
+    for (int leaf : leaves) {
+        for (size_t d = 0; d <= depth; d++) {
+            int node = GetNodeOnPath(leaf, d);
+            if (find(readviewmap.begin(), readviewmap.end(), node) == readviewmap.end() &&
+                    find(nodes.begin(), nodes.end(), node) == nodes.end()) {
+                nodes.push_back(node);
+            }
+        }
+    }
+    if (nodes.size() > 0) {
+        store->Prefetch(nodes);
+    }
+}
+
 // Gets a list of blocks on the cache which can be placed at a specific point
 
 std::vector<Bid> ORAM::GetIntersectingBlocks(int x, int curDepth) {
@@ -223,6 +274,7 @@ void ORAM::Access(Bid bid, Node*& node) {
 }
 
 Node* ORAM::ReadNode(Bid bid) {
+    metrics.cacheLookups++;
     if (bid == 0) {
         throw runtime_error("Node id is not set");
     }
@@ -234,7 +286,21 @@ Node* ORAM::ReadNode(Bid bid) {
     }
 }
 
+/**
+ * Starts loading the path of a node which is going to be read with ReadNode(bid, leaf, ...).
+ * Nothing is requested if that read would be served from the cache.
+ */
+void ORAM::Prefetch(Bid bid, int leaf) {
+    if (bid == 0) {
+        return;
+    }
+    if (cache.count(bid) == 0 || find(leafList.begin(), leafList.end(), leaf) == leafList.end()) {
+        PrefetchPaths(vector<int>{leaf});
+    }
+}
+
 Node* ORAM::ReadNode(Bid bid, int lastLeaf, int newLeaf) {
+    metrics.cacheLookups++;
     if (bid == 0) {
         return NULL;
     }
@@ -254,6 +320,7 @@ Node* ORAM::ReadNode(Bid bid, int lastLeaf, int newLeaf) {
 }
 
 int ORAM::WriteNode(Bid bid, Node* node) {
+    metrics.cacheLookups++;
     if (bid == 0) {
         throw runtime_error("Node id is not set");
     }
@@ -282,24 +349,34 @@ block ORAM::convertNodeToBlock(Node* node) {
 }
 
 void ORAM::finilize(bool find, Bid& rootKey, int& rootPos) {
+    if (find) {
+        finilize(1, 0, rootKey, rootPos);
+    } else {
+        finilize(0, 1, rootKey, rootPos);
+    }
+}
+
+/**
+ * Finishes an operation made of the given number of finds and inserts. The
+ * number of fetched paths is padded to the worst case of that many separate
+ * operations, so only the counts are leaked, while buckets shared between the
+ * paths are fetched and evicted once.
+ */
+void ORAM::finilize(int finds, int inserts, Bid& rootKey, int& rootPos) {
     //fake read for padding     
+    int realReads = readCnt;
     if (!batchWrite) {
-        if (find) {
-            for (unsigned int i = readCnt; i < depth * 1.45; i++) {
-                int rnd = RandomPath();
-                if (std::find(leafList.begin(), leafList.end(), rnd) == leafList.end()) {
-                    leafList.push_back(rnd);
-                }
-                FetchPath(rnd);
-            }
-        } else {
-            for (int i = readCnt; i < 4.35 * depth; i++) {
-                int rnd = RandomPath();
-                if (std::find(leafList.begin(), leafList.end(), rnd) == leafList.end()) {
-                    leafList.push_back(rnd);
-                }
-                FetchPath(rnd);
+        double paddedReads = finds * 1.45 * depth + inserts * 4.35 * depth;
+        vector<int> dummyLeaves;
+        for (int i = readCnt; i < paddedReads; i++) {
+            dummyLeaves.push_back(RandomPath());
+        }
+        PrefetchPaths(dummyLeaves);
+        for (int rnd : dummyLeaves) {
+            if (std::find(leafList.begin(), leafList.end(), rnd) == leafList.end()) {
+                leafList.push_back(rnd);
             }
+            FetchPath(rnd);
         }
     }
 
@@ -323,6 +400,13 @@ void ORAM::finilize(bool find, Bid& rootKey, int& rootPos) {
     if (cache[rootKey] != NULL)
         rootPos = cache[rootKey]->pos;
 
+    uint64_t dummyReads = readCnt - realReads;
+    metrics.dummyPaths += dummyReads;
+    metrics.dummyPathsPerOp.record(dummyReads);
+    metrics.stashPeakPerOp.record(cache.size());
+    metrics.updateStashHighWater(cache.size());
+
+    uint64_t evictionBegin = ORAMMetrics::now();
     int cnt = 0;
     for (int d = depth; d >= 0; d--) {
         for (unsigned int i = 0; i < leafList.size(); i++) {
@@ -334,8 +418,18 @@ void ORAM::finilize(bool find, Bid& rootKey, int& rootPos) {
         }
     }
 
+    store->Flush();
+    metrics.evictionTime += ORAMMetrics::now() - evictionBegin;
+
     leafList.clear();
     modified.clear();
+
+    metrics.operations++;
+    metrics.bucketsReadPerOp.record(opBucketsRead);
+    metrics.bucketsWrittenPerOp.record(opBucketsWritten);
+    metrics.stashAfterEviction.record(cache.size());
+    metrics.stashSize = cache.size();
+    metrics.freeBlocks = store->GetEmptySize();
 }
 
 void ORAM::start(bool batchWrite) {
@@ -343,6 +437,8 @@ void ORAM::start(bool batchWrite) {
     writeviewmap.clear();
     readviewmap.clear();
     readCnt = 0;
+    opBucketsRead = 0;
+    opBucketsWritten = 0;
 }
 
 void ORAM::Print() {
@@ -359,4 +455,49 @@ void ORAM::Print() {
 int ORAM::RandomPath() {
     int val = dis(mt);
     return val;
-}
\ No newline at end of file
+}
+
+const ORAMMetrics& ORAM::getMetrics() const {
+    return metrics;
+}
+
+void ORAM::resetMetrics() {
+    metrics.reset();
+    metrics.stashSize = cache.size();
+    metrics.freeBlocks = store->GetEmptySize();
+}
+
+/**
+ * Writes the stash and the encrypted buckets to a checkpoint. It must not be
+ * called in the middle of an operation.
+ */
+void ORAM::Serialise(CheckpointWriter& out) {
+    out.writeValue<uint64_t>(depth);
+    out.writeValue<uint64_t>(blockSize);
+    out.writeValue<uint64_t>(cache.size());
+    for (auto item : cache) {
+        block b = convertNodeToBlock(item.second);
+        out.write(b.data(), b.size());
+    }
+    store->Serialise(out);
+}
+
+void ORAM::Deserialise(CheckpointReader& in) {
+    uint64_t fileDepth = in.readValue<uint64_t>();
+    uint64_t fileBlockSize = in.readValue<uint64_t>();
+    if (fileDepth != depth || fileBlockSize != blockSize) {
+        throw runtime_error("Checkpoint does not match the ORAM geometry");
+    }
+    for (auto item : cache) {
+        delete item.second;
+    }
+    cache.clear();
+    uint64_t stashSize = in.readValue<uint64_t>();
+    for (uint64_t i = 0; i < stashSize; i++) {
+        const byte_t* data = in.read(blockSize);
+        Node* node = convertBlockToNode(block(data, data + blockSize));
+        cache[node->key] = node;
+    }
+    store->Deserialise(in);
+    resetMetrics();
+}
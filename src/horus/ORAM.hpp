@@ -12,6 +12,7 @@
 #include <set>
 #include <bits/stdc++.h>
 #include "Bid.h"
+#include "ORAMMetrics.hpp"
 
 using namespace std;
 
@@ -31,6 +32,9 @@ public:
     Bid rightID;
     int rightPos;
     unsigned int height;
+    // heights of the children, kept in the record so that an insert does not read the siblings
+    unsigned int leftHeight;
+    unsigned int rightHeight;
 };
 
 struct Block {
@@ -40,6 +44,9 @@ struct Block {
 
 using Bucket = std::array<Block, Z>;
 
+class CheckpointWriter;
+class CheckpointReader;
+
 class ORAM {
 private:
     RAMStore* store;
@@ -53,6 +60,9 @@ private:
     set<Bid> modified;
     int readCnt = 0;
     bytes<Key> key;
+    ORAMMetrics metrics;
+    size_t opBucketsRead = 0;
+    size_t opBucketsWritten = 0;
 
     // Randomness
     std::random_device rd;
@@ -64,6 +74,7 @@ private:
     std::vector<Bid> GetIntersectingBlocks(int x, int depth);
 
     void FetchPath(int leaf);
+    void PrefetchPaths(const vector<int>& leaves);
     void WritePath(int leaf, int level);
 
     Node* ReadData(Bid bid);
@@ -73,6 +84,7 @@ private:
     Bucket DeserialiseBucket(block buffer);
 
     Bucket ReadBucket(int pos);
+    Bucket DecryptBucket(const block& ciphertext);
     void WriteBucket(int pos, Bucket bucket);
     void Access(Bid bid, Node*& node, int lastLeaf, int newLeaf);
     void Access(Bid bid, Node*& node);
@@ -87,16 +99,22 @@ private:
     void Print();
 
 public:
-    ORAM(int maxSize, bytes<Key> key);
+    ORAM(int maxSize, bytes<Key> key, bool initialize = true, RAMStoreFactory storeFactory = nullptr);
     ~ORAM();
 
     Node* ReadNode(Bid bid, int lastLeaf, int newLeaf);
     Node* ReadNode(Bid bid);
+    void Prefetch(Bid bid, int leaf);
     int WriteNode(Bid bid, Node* n);
     void start(bool batchWrite);
     void finilize(bool find, Bid& rootKey, int& rootPos);
+    void finilize(int finds, int inserts, Bid& rootKey, int& rootPos);
     static Node* convertBlockToNode(block b);
     static block convertNodeToBlock(Node* node);
+    const ORAMMetrics& getMetrics() const;
+    void resetMetrics();
+    void Serialise(CheckpointWriter& out);
+    void Deserialise(CheckpointReader& in);
 };
 
 #endif
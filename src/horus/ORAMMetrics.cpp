@@ -0,0 +1,110 @@
+#include "ORAMMetrics.hpp"
+#include <sstream>
+
+Histogram::Histogram() {
+    reset();
+}
+
+void Histogram::record(uint64_t value) {
+    int idx = 0;
+    while (idx < kBuckets - 1 && (1ULL << idx) < value) {
+        idx++;
+    }
+    buckets[idx].fetch_add(1, std::memory_order_relaxed);
+    samples.fetch_add(1, std::memory_order_relaxed);
+    sum.fetch_add(value, std::memory_order_relaxed);
+    uint64_t curMax = max.load(std::memory_order_relaxed);
+    while (value > curMax && !max.compare_exchange_weak(curMax, value, std::memory_order_relaxed)) {
+    }
+}
+
+void Histogram::reset() {
+    for (int i = 0; i < kBuckets; i++) {
+        buckets[i].store(0, std::memory_order_relaxed);
+    }
+    samples.store(0, std::memory_order_relaxed);
+    sum.store(0, std::memory_order_relaxed);
+    max.store(0, std::memory_order_relaxed);
+}
+
+uint64_t Histogram::count() const {
+    return samples.load(std::memory_order_relaxed);
+}
+
+std::string Histogram::toJSON() const {
+    std::ostringstream out;
+    out << "{\"count\":" << samples.load() << ",\"sum\":" << sum.load() << ",\"max\":" << max.load() << ",\"buckets\":[";
+    bool first = true;
+    for (int i = 0; i < kBuckets; i++) {
+        uint64_t cnt = buckets[i].load();
+        if (cnt == 0) {
+            continue;
+        }
+        if (!first) {
+            out << ",";
+        }
+        first = false;
+        out << "[" << (1ULL << i) << "," << cnt << "]";
+    }
+    out << "]}";
+    return out.str();
+}
+
+ORAMMetrics::ORAMMetrics() {
+    reset();
+}
+
+void ORAMMetrics::updateStashHighWater(uint64_t size) {
+    uint64_t cur = stashHighWater.load(std::memory_order_relaxed);
+    while (size > cur && !stashHighWater.compare_exchange_weak(cur, size, std::memory_order_relaxed)) {
+    }
+}
+
+void ORAMMetrics::reset() {
+    operations = 0;
+    bucketsRead = 0;
+    bucketsWritten = 0;
+    pathsFetched = 0;
+    cacheLookups = 0;
+    dummyPaths = 0;
+    encryptedBytes = 0;
+    decryptedBytes = 0;
+    cryptoTime = 0;
+    evictionTime = 0;
+    stashHighWater = 0;
+    stashSize = 0;
+    freeBlocks = 0;
+    bucketsReadPerOp.reset();
+    bucketsWrittenPerOp.reset();
+    dummyPathsPerOp.reset();
+    stashPeakPerOp.reset();
+    stashAfterEviction.reset();
+}
+
+std::string ORAMMetrics::toJSON() const {
+    std::ostringstream out;
+    out << "{\"operations\":" << operations.load()
+            << ",\"bucketsRead\":" << bucketsRead.load()
+            << ",\"bucketsWritten\":" << bucketsWritten.load()
+            << ",\"pathsFetched\":" << pathsFetched.load()
+            << ",\"cacheLookups\":" << cacheLookups.load()
+            << ",\"dummyPaths\":" << dummyPaths.load()
+            << ",\"encryptedBytes\":" << encryptedBytes.load()
+            << ",\"decryptedBytes\":" << decryptedBytes.load()
+            << ",\"cryptoTimeNs\":" << cryptoTime.load()
+            << ",\"evictionTimeNs\":" << evictionTime.load()
+            << ",\"stashHighWater\":" << stashHighWater.load()
+            << ",\"stashSize\":" << stashSize.load()
+            << ",\"freeBlocks\":" << freeBlocks.load()
+            << ",\"bucketsReadPerOp\":" << bucketsReadPerOp.toJSON()
+            << ",\"bucketsWrittenPerOp\":" << bucketsWrittenPerOp.toJSON()
+            << ",\"dummyPathsPerOp\":" << dummyPathsPerOp.toJSON()
+            << ",\"stashPeakPerOp\":" << stashPeakPerOp.toJSON()
+            << ",\"stashAfterEviction\":" << stashAfterEviction.toJSON()
+            << "}";
+    return out.str();
+}
+
+uint64_t ORAMMetrics::now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
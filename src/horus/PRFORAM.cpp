@@ -1,5 +1,6 @@
 #include "PRFORAM.hpp"
 #include "utils/Utilities.h"
+#include "utils/Checkpoint.h"
 #include <algorithm>
 #include <iomanip>
 #include <fstream>
@@ -10,7 +11,7 @@
 #include <map>
 #include <stdexcept>
 
-PRFORAM::PRFORAM(int maxSize, bytes<Key> key)
+PRFORAM::PRFORAM(int maxSize, bytes<Key> key, bool initialize, RAMStoreFactory storeFactory)
 : key(key) {
     AES::Setup();
     depth = floor(log2(maxSize / Z));
@@ -21,9 +22,13 @@ PRFORAM::PRFORAM(int maxSize, bytes<Key> key)
     size_t storeBlockCount = blockCount;
     clen_size = AES::GetCiphertextLength((blockSize) * Z);
     plaintext_size = (blockSize) * Z;
-    store = new RAMStore(storeBlockCount, storeBlockSize);
-    // Intialise state of PRFORAM is new
-    for (size_t i = 0; i < bucketCount; i++) {
+    if (storeFactory) {
+        store = storeFactory(storeBlockCount, storeBlockSize);
+    } else {
+        store = new RAMStore(storeBlockCount, storeBlockSize);
+    }
+    // Intialise state of PRFORAM is new, a restored one is loaded by Deserialise()
+    for (size_t i = 0; initialize && i < bucketCount; i++) {
         Bucket bucket;
         for (int z = 0; z < Z; z++) {
             bucket[z].id = 0;
@@ -31,9 +36,14 @@ PRFORAM::PRFORAM(int maxSize, bytes<Key> key)
         }
         WriteBucket(i, bucket);
     }
+    store->Flush();
+    // initialisation writes are not part of any operation
+    metrics.reset();
+    metrics.freeBlocks = store->GetEmptySize();
 }
 
 PRFORAM::~PRFORAM() {
+    delete store;
     AES::Cleanup();
 }
 
@@ -84,21 +94,36 @@ Bucket PRFORAM::DeserialiseBucket(block buffer) {
 }
 
 Bucket PRFORAM::ReadBucket(int index) {
-    block ciphertext = store->Read(index);
+    return DecryptBucket(store->Read(index));
+}
+
+Bucket PRFORAM::DecryptBucket(const block& ciphertext) {
+    uint64_t begin = ORAMMetrics::now();
     block buffer = AES::Decrypt(key, ciphertext, clen_size);
+    metrics.cryptoTime += ORAMMetrics::now() - begin;
+    metrics.decryptedBytes += ciphertext.size();
+    metrics.bucketsRead++;
+    opBucketsRead++;
     Bucket bucket = DeserialiseBucket(buffer);
     return bucket;
 }
 
 void PRFORAM::WriteBucket(int index, Bucket bucket) {
     block b = SerialiseBucket(bucket);
+    uint64_t begin = ORAMMetrics::now();
     block ciphertext = AES::Encrypt(key, b, clen_size, plaintext_size);
+    metrics.cryptoTime += ORAMMetrics::now() - begin;
+    metrics.encryptedBytes += ciphertext.size();
+    metrics.bucketsWritten++;
+    opBucketsWritten++;
     store->Write(index, ciphertext);
 }
 
 // Fetches blocks along a path, adding them to the stash
 
 void PRFORAM::FetchPath(int leaf, bool batchRead) {
+    metrics.pathsFetched++;
+    vector<int> nodes;
     for (size_t d = 0; d <= depth; d++) {
         int node = GetBoxOnPath(leaf, d);
         if (batchRead) {
@@ -108,7 +133,13 @@ void PRFORAM::FetchPath(int leaf, bool batchRead) {
                 viewmap.push_back(node);
             }
         }
-        Bucket bucket = ReadBucket(node);
+        nodes.push_back(node);
+    }
+
+    // all the buckets of the path are requested from the store at once
+    vector<block> ciphertexts = store->ReadBatch(nodes);
+    for (auto& ciphertext : ciphertexts) {
+        Bucket bucket = DecryptBucket(ciphertext);
 
         for (int z = 0; z < Z; z++) {
             Block &block = bucket[z];
@@ -125,6 +156,25 @@ void PRFORAM::FetchPath(int leaf, bool batchRead) {
     }
 }
 
+// Asks the store to start loading the buckets of paths which are going to be
+// fetched in the current batch and have not been read yet
+
+void PRFORAM::PrefetchPaths(const vector<int>& leaves) {
+    vector<int> nodes;
+    for (int leaf : leaves) {
+        for (size_t d = 0; d <= depth; d++) {
+            int node = GetBoxOnPath(leaf, d);
+            if (find(viewmap.begin(), viewmap.end(), node) == viewmap.end() &&
+                    find(nodes.begin(), nodes.end(), node) == nodes.end()) {
+                nodes.push_back(node);
+            }
+        }
+    }
+    if (nodes.size() > 0) {
+        store->Prefetch(nodes);
+    }
+}
+
 // Gets a list of blocks on the stash which can be placed at a specific point
 
 std::vector<Bid> PRFORAM::GetIntersectingBlocks(int x, int curDepth) {
@@ -195,6 +245,7 @@ Box* PRFORAM::ReadData(Bid bid) {
 // Fetches a block, allowing you to read and write  in a block
 
 string PRFORAM::Access(Bid bid, Box*& box, int pos) {
+    StartOperation();
     FetchPath(pos);
     box = ReadData(bid);
     string res = "";
@@ -202,20 +253,33 @@ string PRFORAM::Access(Bid bid, Box*& box, int pos) {
         res.assign(box->value.begin(), box->value.end());
         res = res.c_str();
     }
+    metrics.stashPeakPerOp.record(stash.size());
+    metrics.updateStashHighWater(stash.size());
+    uint64_t evictionBegin = ORAMMetrics::now();
     viewmap.clear();
     for (int d = depth; d >= 0; d--) {
         WritePath(pos, d);
     }
+    store->Flush();
+    metrics.evictionTime += ORAMMetrics::now() - evictionBegin;
+    FinishOperation();
     return res;
 }
 
 void PRFORAM::Access(Bid bid, Box*& box) {
+    StartOperation();
     FetchPath(box->pos);
     WriteData(bid, box);
+    metrics.stashPeakPerOp.record(stash.size());
+    metrics.updateStashHighWater(stash.size());
+    uint64_t evictionBegin = ORAMMetrics::now();
     viewmap.clear();
     for (int d = depth; d >= 0; d--) {
         WritePath(box->pos, d);
     }
+    store->Flush();
+    metrics.evictionTime += ORAMMetrics::now() - evictionBegin;
+    FinishOperation();
 }
 
 string PRFORAM::ReadBox(Bid bid, int pos) {
@@ -276,7 +340,15 @@ void PRFORAM::Print() {
 vector<string> PRFORAM::batchRead(vector<pair<Bid, int> > batchQuery) {
     vector<string> result;
     set<int> leafs;
+    StartOperation();
     viewmap.clear();
+    vector<int> paths;
+    for (auto item : batchQuery) {
+        if (stash.count(item.second) == 0) {
+            paths.push_back(item.second);
+        }
+    }
+    PrefetchPaths(paths);
     for (auto item : batchQuery) {
         if (stash.count(item.second) == 0) {
             FetchPath(item.second, true);
@@ -297,12 +369,18 @@ vector<string> PRFORAM::batchRead(vector<pair<Bid, int> > batchQuery) {
             result.push_back(res);
         }
     }
+    metrics.stashPeakPerOp.record(stash.size());
+    metrics.updateStashHighWater(stash.size());
+    uint64_t evictionBegin = ORAMMetrics::now();
     viewmap.clear();
     for (int d = depth; d >= 0; d--) {
         for (auto item : leafs) {
             WritePath(item, d);
         }
     }
+    store->Flush();
+    metrics.evictionTime += ORAMMetrics::now() - evictionBegin;
+    FinishOperation();
     return result;
 }
 
@@ -310,6 +388,7 @@ void PRFORAM::batchWrite(map<Bid, string> values, map<Bid, int> poses) {
     set<int> leafs;
     auto valuesIterator = values.begin();
     auto posesIterator = poses.begin();
+    StartOperation();
     viewmap.clear();
     for (unsigned int i = 0; i < values.size(); i++) {
         Bid bid = valuesIterator->first;
@@ -328,10 +407,81 @@ void PRFORAM::batchWrite(map<Bid, string> values, map<Bid, int> poses) {
         valuesIterator++;
         posesIterator++;
     }
+    metrics.stashPeakPerOp.record(stash.size());
+    metrics.updateStashHighWater(stash.size());
+    uint64_t evictionBegin = ORAMMetrics::now();
     viewmap.clear();
     for (int d = depth; d >= 0; d--) {
         for (auto item : leafs) {
             WritePath(item, d);
         }
     }
+    store->Flush();
+    metrics.evictionTime += ORAMMetrics::now() - evictionBegin;
+    FinishOperation();
+}
+
+void PRFORAM::StartOperation() {
+    opBucketsRead = 0;
+    opBucketsWritten = 0;
+}
+
+// Records the per-operation counters. PRFORAM does not pad with dummy paths,
+// so dummyPaths stays zero here.
+
+void PRFORAM::FinishOperation() {
+    metrics.operations++;
+    metrics.bucketsReadPerOp.record(opBucketsRead);
+    metrics.bucketsWrittenPerOp.record(opBucketsWritten);
+    metrics.stashAfterEviction.record(stash.size());
+    metrics.stashSize = stash.size();
+    metrics.freeBlocks = store->GetEmptySize();
+}
+
+const ORAMMetrics& PRFORAM::getMetrics() const {
+    return metrics;
+}
+
+string PRFORAM::dumpMetrics() const {
+    return metrics.toJSON();
+}
+
+void PRFORAM::resetMetrics() {
+    metrics.reset();
+    metrics.stashSize = stash.size();
+    metrics.freeBlocks = store->GetEmptySize();
+}
+
+/**
+ * Writes the stash and the encrypted buckets to a checkpoint
+ */
+void PRFORAM::Serialise(CheckpointWriter& out) {
+    out.writeValue<uint64_t>(depth);
+    out.writeValue<uint64_t>(blockSize);
+    out.writeValue<uint64_t>(stash.size());
+    for (auto item : stash) {
+        block b = convertBoxToBlock(item.second);
+        out.write(b.data(), b.size());
+    }
+    store->Serialise(out);
+}
+
+void PRFORAM::Deserialise(CheckpointReader& in) {
+    uint64_t fileDepth = in.readValue<uint64_t>();
+    uint64_t fileBlockSize = in.readValue<uint64_t>();
+    if (fileDepth != depth || fileBlockSize != blockSize) {
+        throw runtime_error("Checkpoint does not match the PRFORAM geometry");
+    }
+    for (auto item : stash) {
+        delete item.second;
+    }
+    stash.clear();
+    uint64_t stashSize = in.readValue<uint64_t>();
+    for (uint64_t i = 0; i < stashSize; i++) {
+        const byte_t* data = in.read(blockSize);
+        Box* box = convertBlockToBox(block(data, data + blockSize));
+        stash[box->key] = box;
+    }
+    store->Deserialise(in);
+    resetMetrics();
 }
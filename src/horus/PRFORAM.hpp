@@ -13,6 +13,7 @@
 #include <bits/stdc++.h>
 #include "Bid.h"
 #include "ORAM.hpp"
+#include "ORAMMetrics.hpp"
 using namespace std;
 
 class Box {
@@ -42,6 +43,9 @@ private:
 
     set<int> emptyBoxs;
     bytes<Key> key;
+    ORAMMetrics metrics;
+    size_t opBucketsRead = 0;
+    size_t opBucketsWritten = 0;
 
     map<int, vector<Bid> > nodePoses;
     vector<Bid> deleted;
@@ -50,7 +54,10 @@ private:
     std::vector<Bid> GetIntersectingBlocks(int x, int depth);
 
     void FetchPath(int leaf, bool batchRead = false);
+    void PrefetchPaths(const vector<int>& leaves);
     void WritePath(int leaf, int d);
+    void StartOperation();
+    void FinishOperation();
 
     Box* ReadData(Bid bid);
     void WriteData(Bid bid, Box* b);
@@ -59,6 +66,7 @@ private:
     Bucket DeserialiseBucket(block buffer);
 
     Bucket ReadBucket(int pos);
+    Bucket DecryptBucket(const block& ciphertext);
     void WriteBucket(int pos, Bucket bucket);
     string Access(Bid bid, Box*& node, int pos);
     void Access(Bid bid, Box*& node);
@@ -72,13 +80,18 @@ private:
     static block convertBoxToBlock(Box* node);
 
 public:
-    PRFORAM(int maxSize, bytes<Key> key);
+    PRFORAM(int maxSize, bytes<Key> key, bool initialize = true, RAMStoreFactory storeFactory = nullptr);
     ~PRFORAM();
 
     string ReadBox(Bid bid, int pos);
     void WriteBox(Bid bid, string value, int pos);
     vector<string> batchRead(vector<pair<Bid, int> > batchQuery);
     void batchWrite(map<Bid, string> values, map<Bid, int> poses);
+    const ORAMMetrics& getMetrics() const;
+    string dumpMetrics() const;
+    void resetMetrics();
+    void Serialise(CheckpointWriter& out);
+    void Deserialise(CheckpointReader& in);
 };
 
 #endif
\ No newline at end of file
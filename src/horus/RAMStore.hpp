@@ -2,22 +2,40 @@
 #include "Types.hpp"
 #include <map>
 #include <array>
+#include <functional>
 
+class CheckpointWriter;
+class CheckpointReader;
+
+/*
+ * Keeps the encrypted buckets of an ORAM in memory. Subclasses can keep them
+ * elsewhere (see RemoteRAMStore); the batch, prefetch and flush calls let them
+ * amortise round trips.
+ */
 class RAMStore {
+protected:
 	std::vector<block> store;
 	size_t size;
         size_t emptyNodes;
 
 public:
 	RAMStore(size_t num, size_t size);
-	~RAMStore();
+	virtual ~RAMStore();
 
-	block Read(int pos);
-	void Write(int pos, block b);
+	virtual block Read(int pos);
+	virtual void Write(int pos, block b);
+        virtual std::vector<block> ReadBatch(const std::vector<int>& positions);
+        virtual void Prefetch(const std::vector<int>& positions);
+        virtual void Flush();
 
-	size_t GetBlockCount();
+	virtual size_t GetBlockCount();
 	size_t GetBlockSize();        
 	bool WasSerialised();
         void ReduceEmptyNumbers();
         size_t GetEmptySize();
+        void Serialise(CheckpointWriter& out);
+        void Deserialise(CheckpointReader& in);
 };
+
+// Creates the bucket store of an ORAM from the number of blocks and their size
+using RAMStoreFactory = std::function<RAMStore*(size_t num, size_t size)>;
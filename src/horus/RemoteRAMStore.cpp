@@ -0,0 +1,184 @@
+#include "RemoteRAMStore.hpp"
+#include <iostream>
+#include <stdexcept>
+
+#include <grpc++/client_context.h>
+
+using namespace std;
+
+RemoteRAMStore::RemoteRAMStore(shared_ptr<grpc::Channel> channel, uint32_t storeId, size_t num, size_t size)
+: RAMStore(0, size), channel(channel), storeId(storeId), count(num) {
+    stub_ = BucketStore::NewStub(channel);
+    emptyNodes = num;
+
+    grpc::ClientContext context;
+    BucketStoreSetupMessage message;
+    google::protobuf::Empty e;
+    message.set_store_id(storeId);
+    message.set_block_count(num);
+    message.set_block_size(size);
+    grpc::Status status = stub_->setup(&context, message, &e);
+    if (!status.ok()) {
+        throw runtime_error("Bucket store setup failed: " + status.error_message());
+    }
+}
+
+// An explicit Flush() reports a failed write, but a destructor must not throw
+// (the server may already be down at shutdown): the error is only logged.
+RemoteRAMStore::~RemoteRAMStore() {
+    for (auto& pending : inflight) {
+        pending.reply.wait();
+    }
+    try {
+        Flush();
+    } catch (const exception& e) {
+        cerr << "Dropping " << pendingWrites.size() << " bucket writes of store " << storeId << ": " << e.what() << endl;
+    }
+}
+
+vector<block> RemoteRAMStore::RemoteRead(const vector<int>& positions) {
+    grpc::ClientContext context;
+    ReadBucketsMessage message;
+    ReadBucketsReply reply;
+    message.set_store_id(storeId);
+    for (int pos : positions) {
+        message.add_index(pos);
+    }
+    grpc::Status status = stub_->readBuckets(&context, message, &reply);
+    if (!status.ok() || reply.bucket_size() != (int) positions.size()) {
+        throw runtime_error("Reading buckets failed: " + status.error_message());
+    }
+    vector<block> result;
+    for (int i = 0; i < reply.bucket_size(); i++) {
+        result.emplace_back(reply.bucket(i).begin(), reply.bucket(i).end());
+    }
+    return result;
+}
+
+// Waits for the background read containing pos, if any, and moves its
+// buckets to the prefetched map. Buckets written after the read was started
+// were removed from its positions and are dropped here.
+
+void RemoteRAMStore::CollectPrefetched(int pos) {
+    for (auto it = inflight.begin(); it != inflight.end(); it++) {
+        if (it->positions.count(pos) == 0) {
+            continue;
+        }
+        ReadBucketsReply reply = it->reply.get();
+        for (int i = 0; i < reply.bucket_size() && i < (int) it->order.size(); i++) {
+            int p = it->order[i];
+            if (it->positions.count(p) != 0) {
+                prefetched[p] = block(reply.bucket(i).begin(), reply.bucket(i).end());
+            }
+        }
+        inflight.erase(it);
+        return;
+    }
+}
+
+block RemoteRAMStore::Read(int pos) {
+    return ReadBatch(vector<int>{pos})[0];
+}
+
+vector<block> RemoteRAMStore::ReadBatch(const vector<int>& positions) {
+    vector<block> result(positions.size());
+    vector<int> missing;
+    vector<size_t> missingIndex;
+    for (size_t i = 0; i < positions.size(); i++) {
+        int pos = positions[i];
+        auto write = pendingWrites.find(pos);
+        if (write != pendingWrites.end()) {
+            result[i] = write->second;
+            continue;
+        }
+        CollectPrefetched(pos);
+        auto pre = prefetched.find(pos);
+        if (pre != prefetched.end()) {
+            result[i] = std::move(pre->second);
+            prefetched.erase(pre);
+            continue;
+        }
+        missing.push_back(pos);
+        missingIndex.push_back(i);
+    }
+    if (missing.size() > 0) {
+        vector<block> fetched = RemoteRead(missing);
+        for (size_t i = 0; i < missing.size(); i++) {
+            result[missingIndex[i]] = std::move(fetched[i]);
+        }
+    }
+    return result;
+}
+
+void RemoteRAMStore::Prefetch(const vector<int>& positions) {
+    vector<int> order;
+    for (int pos : positions) {
+        if (pendingWrites.count(pos) == 0 && prefetched.count(pos) == 0) {
+            order.push_back(pos);
+        }
+    }
+    if (order.size() == 0) {
+        return;
+    }
+    PendingRead pending;
+    pending.positions.insert(order.begin(), order.end());
+    pending.order = order;
+    BucketStore::Stub* stub = stub_.get();
+    uint32_t id = storeId;
+    pending.reply = std::async(std::launch::async, [stub, id, order]() {
+        grpc::ClientContext context;
+        ReadBucketsMessage message;
+        ReadBucketsReply reply;
+        message.set_store_id(id);
+        for (int pos : order) {
+            message.add_index(pos);
+        }
+        grpc::Status status = stub->readBuckets(&context, message, &reply);
+        if (!status.ok()) {
+            // the positions are read again synchronously
+            reply.clear_bucket();
+        }
+        return reply;
+    });
+    inflight.push_back(std::move(pending));
+}
+
+void RemoteRAMStore::Write(int pos, block b) {
+    prefetched.erase(pos);
+    for (auto& pending : inflight) {
+        pending.positions.erase(pos);
+    }
+    pendingWrites[pos] = b;
+    if (pendingWrites.size() >= kWriteBatchSize) {
+        Flush();
+    }
+}
+
+void RemoteRAMStore::Flush() {
+    if (pendingWrites.size() == 0) {
+        return;
+    }
+    grpc::ClientContext context;
+    WriteBucketsMessage message;
+    google::protobuf::Empty e;
+    message.set_store_id(storeId);
+    for (auto& item : pendingWrites) {
+        message.add_index(item.first);
+        message.add_bucket(item.second.data(), item.second.size());
+    }
+    grpc::Status status = stub_->writeBuckets(&context, message, &e);
+    if (!status.ok()) {
+        throw runtime_error("Writing buckets failed: " + status.error_message());
+    }
+    pendingWrites.clear();
+}
+
+size_t RemoteRAMStore::GetBlockCount() {
+    return count;
+}
+
+RAMStoreFactory RemoteRAMStore::factory(shared_ptr<grpc::Channel> channel, uint32_t storeId) {
+    return [channel, storeId](size_t num, size_t size) {
+        return new RemoteRAMStore(channel, storeId, num, size);
+    };
+}
@@ -1,22 +1,13 @@
 #include "AVLTree.h"
 
-AVLTree::AVLTree(int maxSize, bytes<Key> key) : rd(), mt(rd()), dis(0, (pow(2, floor(log2(maxSize / Z)) + 1) - 1) / 2) {
-    oram = new ORAM(maxSize, key);
+AVLTree::AVLTree(int maxSize, bytes<Key> key, bool initialize, RAMStoreFactory storeFactory) : rd(), mt(rd()), dis(0, (pow(2, floor(log2(maxSize / Z)) + 1) - 1) / 2) {
+    oram = new ORAM(maxSize, key, initialize, storeFactory);
 }
 
 AVLTree::~AVLTree() {
     delete oram;
 }
 
-// A utility function to get height of the tree
-
-int AVLTree::height(Bid key, int& leaf) {
-    if (key == 0)
-        return 0;
-    Node* node = oram->ReadNode(key, leaf, leaf);
-    return node->height;
-}
-
 // A utility function to get maximum of two integers
 
 int AVLTree::max(int a, int b) {
@@ -32,142 +23,137 @@ Node* AVLTree::newNode(Bid key, string value) {
     std::copy(value.begin(), value.end(), node->value.begin());
     node->leftID = 0;
     node->rightID = 0;
+    node->leftPos = 0;
+    node->rightPos = 0;
     node->pos = RandomPath();
     node->height = 1; // new node is initially added at leaf
+    node->leftHeight = 0;
+    node->rightHeight = 0;
     return node;
 }
 
-// A utility function to right rotate subtree rooted with y
-// See the diagram given above.
-
-Node* AVLTree::rightRotate(Node* y) {
-    Node* x = oram->ReadNode(y->leftID);
-    Node* T2;
-    if (x->rightID == 0) {
-        T2 = newNode(0, "");
-    } else {
-        T2 = oram->ReadNode(x->rightID);
-    }
+// A utility function to right rotate subtree rooted with y, where x is its left child.
+// The middle subtree T2 only changes its parent, so its key, position and height are
+// taken from x without reading it.
 
+Node* AVLTree::rightRotate(Node* y, Node* x) {
     // Perform rotation
+    y->leftID = x->rightID;
+    y->leftPos = x->rightPos;
+    y->leftHeight = x->rightHeight;
+    y->height = max(y->leftHeight, y->rightHeight) + 1;
+    oram->WriteNode(y->key, y);
+
     x->rightID = y->key;
     x->rightPos = y->pos;
-    y->leftID = T2->key;
-    y->leftPos = T2->pos;
-
-    // Update heights
-    y->height = max(height(y->leftID, y->leftPos), height(y->rightID, y->rightPos)) + 1;
-    oram->WriteNode(y->key, y);
-    x->height = max(height(x->leftID, x->leftPos), height(x->rightID, x->rightPos)) + 1;
+    x->rightHeight = y->height;
+    x->height = max(x->leftHeight, x->rightHeight) + 1;
     oram->WriteNode(x->key, x);
     // Return new root
-
     return x;
 }
 
-// A utility function to left rotate subtree rooted with x
-// See the diagram given above.
-
-Node* AVLTree::leftRotate(Node* x) {
-    Node* y = oram->ReadNode(x->rightID);
-    Node* T2;
-    if (y->leftID == 0) {
-        T2 = newNode(0, "");
-    } else {
-        T2 = oram->ReadNode(y->leftID);
-    }
-
+// A utility function to left rotate subtree rooted with x, where y is its right child.
 
+Node* AVLTree::leftRotate(Node* x, Node* y) {
     // Perform rotation
+    x->rightID = y->leftID;
+    x->rightPos = y->leftPos;
+    x->rightHeight = y->leftHeight;
+    x->height = max(x->leftHeight, x->rightHeight) + 1;
+    oram->WriteNode(x->key, x);
+
     y->leftID = x->key;
     y->leftPos = x->pos;
-    x->rightID = T2->key;
-    x->rightPos = T2->pos;
-
-    // Update heights
-    x->height = max(height(x->leftID, x->leftPos), height(x->rightID, x->rightPos)) + 1;
-    oram->WriteNode(x->key, x);
-    y->height = max(height(y->leftID, y->leftPos), height(y->rightID, y->rightPos)) + 1;
+    y->leftHeight = x->height;
+    y->height = max(y->leftHeight, y->rightHeight) + 1;
     oram->WriteNode(y->key, y);
     // Return new root
     return y;
 }
 
-// Get Balance factor of node N
-
-int AVLTree::getBalance(Node* N) {
-    if (N == NULL)
-        return 0;
-    return height(N->leftID, N->leftPos) - height(N->rightID, N->rightPos);
+Bid AVLTree::insert(Bid rootKey, int& pos, Bid key, string value) {
+    return insertNode(rootKey, pos, key, value)->key;
 }
 
-Bid AVLTree::insert(Bid rootKey, int& pos, Bid key, string value) {
+/**
+ * Inserts the key into the subtree and returns its (possibly new) root. Every node on the
+ * insertion path is resolved once, the heights of the siblings come from the cached child
+ * heights of their parents.
+ */
+Node* AVLTree::insertNode(Bid rootKey, int& pos, Bid key, string value) {
     /* 1. Perform the normal BST rotation */
     if (rootKey == 0) {
         Node* nnode = newNode(key, value);
         pos = oram->WriteNode(key, nnode);
-        return nnode->key;
+        return nnode;
     }
     Node* node = oram->ReadNode(rootKey, pos, pos);
+    Node* child;
     if (key < node->key) {
-        node->leftID = insert(node->leftID, node->leftPos, key, value);
+        child = insertNode(node->leftID, node->leftPos, key, value);
+        node->leftID = child->key;
+        node->leftHeight = child->height;
     } else if (key > node->key) {
-        node->rightID = insert(node->rightID, node->rightPos, key, value);
+        child = insertNode(node->rightID, node->rightPos, key, value);
+        node->rightID = child->key;
+        node->rightHeight = child->height;
     } else {
         std::fill(node->value.begin(), node->value.end(), 0);
         std::copy(value.begin(), value.end(), node->value.begin());
         oram->WriteNode(rootKey, node);
-        return node->key;
+        return node;
     }
 
     /* 2. Update height of this ancestor node */
-    node->height = max(height(node->leftID, node->leftPos), height(node->rightID, node->rightPos)) + 1;
+    node->height = max(node->leftHeight, node->rightHeight) + 1;
 
     /* 3. Get the balance factor of this ancestor node to check whether
-       this node became unbalanced */
-    int balance = getBalance(node);
+       this node became unbalanced. Only the side that received the key
+       can be too high, so child is the higher child. */
+    int balance = (int) node->leftHeight - (int) node->rightHeight;
 
     // If this node becomes unbalanced, then there are 4 cases
 
     // Left Left Case
-    if (balance > 1 && key < oram->ReadNode(node->leftID)->key) {
-        Node* res = rightRotate(node);
+    if (balance > 1 && key < child->key) {
+        Node* res = rightRotate(node, child);
         pos = res->pos;
-        return res->key;
+        return res;
     }
 
     // Right Right Case
-    if (balance < -1 && key > oram->ReadNode(node->rightID)->key) {
-        Node* res = leftRotate(node);
+    if (balance < -1 && key > child->key) {
+        Node* res = leftRotate(node, child);
         pos = res->pos;
-        return res->key;
+        return res;
     }
 
     // Left Right Case
-    if (balance > 1 && key > oram->ReadNode(node->leftID)->key) {
-        Node* res = leftRotate(oram->ReadNode(node->leftID));
+    if (balance > 1 && key > child->key) {
+        Node* res = leftRotate(child, oram->ReadNode(child->rightID));
         node->leftID = res->key;
         node->leftPos = res->pos;
-        oram->WriteNode(node->key, node);
-        Node* res2 = rightRotate(node);
+        node->leftHeight = res->height;
+        Node* res2 = rightRotate(node, res);
         pos = res2->pos;
-        return res2->key;
+        return res2;
     }
 
     // Right Left Case
-    if (balance < -1 && key < oram->ReadNode(node->rightID)->key) {
-        auto res = rightRotate(oram->ReadNode(node->rightID));
+    if (balance < -1 && key < child->key) {
+        Node* res = rightRotate(child, oram->ReadNode(child->leftID));
         node->rightID = res->key;
         node->rightPos = res->pos;
-        oram->WriteNode(node->key, node);
-        auto res2 = leftRotate(node);
+        node->rightHeight = res->height;
+        Node* res2 = leftRotate(node, res);
         pos = res2->pos;
-        return res2->key;
+        return res2;
     }
 
     /* return the (unchanged) node pointer */
     oram->WriteNode(node->key, node);
-    return node->key;
+    return node;
 }
 
 /**
@@ -208,6 +194,10 @@ void AVLTree::batchSearch(Node* head, vector<Bid> keys, vector<Node*>* results)
             results->push_back(head);
         }
     }
+    if (getLeft && getRight) {
+        // the right subtree is loaded while the left one is searched
+        oram->Prefetch(head->rightID, head->rightPos);
+    }
     if (getLeft) {
         batchSearch(oram->ReadNode(head->leftID, head->leftPos, head->leftPos), leftkeys, results);
     }
@@ -246,6 +236,29 @@ void AVLTree::finishOperation(bool find, Bid& rootKey, int& rootPos) {
     oram->finilize(find, rootKey, rootPos);
 }
 
+/*
+ * finishes an operation which contains several finds and inserts
+ */
+void AVLTree::finishOperation(int finds, int inserts, Bid& rootKey, int& rootPos) {
+    oram->finilize(finds, inserts, rootKey, rootPos);
+}
+
+const ORAMMetrics& AVLTree::getMetrics() const {
+    return oram->getMetrics();
+}
+
+void AVLTree::resetMetrics() {
+    oram->resetMetrics();
+}
+
+void AVLTree::serialise(CheckpointWriter& out) {
+    oram->Serialise(out);
+}
+
+void AVLTree::deserialise(CheckpointReader& in) {
+    oram->Deserialise(in);
+}
+
 int AVLTree::RandomPath() {
     int val = dis(mt);
     return val;
@@ -0,0 +1,58 @@
+#include "BucketStoreServerRunner.h"
+
+BucketStoreServerRunner::BucketStoreServerRunner() {
+}
+
+BucketStoreServerRunner::~BucketStoreServerRunner() {
+}
+
+// The caller must hold stores_mtx_
+
+RAMStore* BucketStoreServerRunner::getStore(uint32_t id) {
+    auto it = stores_.find(id);
+    if (it == stores_.end()) {
+        return NULL;
+    }
+    return it->second.get();
+}
+
+grpc::Status BucketStoreServerRunner::setup(grpc::ServerContext* context, const BucketStoreSetupMessage* request, google::protobuf::Empty* e) {
+    std::lock_guard<std::mutex> lock(stores_mtx_);
+    stores_[request->store_id()].reset(new RAMStore(request->block_count(), request->block_size()));
+    return grpc::Status::OK;
+}
+
+grpc::Status BucketStoreServerRunner::readBuckets(grpc::ServerContext* context, const ReadBucketsMessage* request, ReadBucketsReply* reply) {
+    std::lock_guard<std::mutex> lock(stores_mtx_);
+    RAMStore* store = getStore(request->store_id());
+    if (store == NULL) {
+        return grpc::Status(grpc::FAILED_PRECONDITION, "The store is not set up");
+    }
+    for (int i = 0; i < request->index_size(); i++) {
+        if (request->index(i) >= store->GetBlockCount()) {
+            return grpc::Status(grpc::OUT_OF_RANGE, "Bucket index out of range");
+        }
+        block b = store->Read(request->index(i));
+        reply->add_bucket(b.data(), b.size());
+    }
+    return grpc::Status::OK;
+}
+
+grpc::Status BucketStoreServerRunner::writeBuckets(grpc::ServerContext* context, const WriteBucketsMessage* request, google::protobuf::Empty* e) {
+    std::lock_guard<std::mutex> lock(stores_mtx_);
+    RAMStore* store = getStore(request->store_id());
+    if (store == NULL) {
+        return grpc::Status(grpc::FAILED_PRECONDITION, "The store is not set up");
+    }
+    if (request->index_size() != request->bucket_size()) {
+        return grpc::Status(grpc::INVALID_ARGUMENT, "Number of indices and buckets differ");
+    }
+    for (int i = 0; i < request->index_size(); i++) {
+        if (request->index(i) >= store->GetBlockCount()) {
+            return grpc::Status(grpc::OUT_OF_RANGE, "Bucket index out of range");
+        }
+        const std::string& bucket = request->bucket(i);
+        store->Write(request->index(i), block(bucket.begin(), bucket.end()));
+    }
+    return grpc::Status::OK;
+}
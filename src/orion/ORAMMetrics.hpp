@@ -0,0 +1,66 @@
+#ifndef ORAMMETRICS_H
+#define ORAMMETRICS_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+/*
+ * Power-of-two histogram: bucket i counts samples v with 2^(i-1) < v <= 2^i
+ * (bucket 0 holds zeros and ones). All updates are lock free.
+ */
+class Histogram {
+public:
+    static const int kBuckets = 32;
+
+    Histogram();
+    void record(uint64_t value);
+    void reset();
+    uint64_t count() const;
+    std::string toJSON() const;
+
+private:
+    std::atomic<uint64_t> buckets[kBuckets];
+    std::atomic<uint64_t> samples;
+    std::atomic<uint64_t> sum;
+    std::atomic<uint64_t> max;
+};
+
+/*
+ * Always-on counters describing how an ORAM instance behaves. "Stash" is the
+ * client side cache of blocks that are not (yet) written back to the tree.
+ * Times are in nanoseconds; eviction time includes the encryption done while
+ * writing buckets back.
+ */
+class ORAMMetrics {
+public:
+    std::atomic<uint64_t> operations;
+    std::atomic<uint64_t> bucketsRead;
+    std::atomic<uint64_t> bucketsWritten;
+    std::atomic<uint64_t> pathsFetched;
+    std::atomic<uint64_t> cacheLookups;
+    std::atomic<uint64_t> dummyPaths;
+    std::atomic<uint64_t> encryptedBytes;
+    std::atomic<uint64_t> decryptedBytes;
+    std::atomic<uint64_t> cryptoTime;
+    std::atomic<uint64_t> evictionTime;
+    std::atomic<uint64_t> stashHighWater;
+    std::atomic<uint64_t> stashSize;
+    std::atomic<uint64_t> freeBlocks;
+
+    Histogram bucketsReadPerOp;
+    Histogram bucketsWrittenPerOp;
+    Histogram dummyPathsPerOp;
+    Histogram stashPeakPerOp;
+    Histogram stashAfterEviction;
+
+    ORAMMetrics();
+    void updateStashHighWater(uint64_t size);
+    void reset();
+    std::string toJSON() const;
+
+    static uint64_t now();
+};
+
+#endif /* ORAMMETRICS_H */
@@ -1,11 +1,31 @@
 #include "Orion.h"
+#include "RemoteRAMStore.hpp"
+#include "../utils/Checkpoint.h"
 
-Orion::Orion(bool usehdd, int maxSize) {
+#include <grpc++/create_channel.h>
+
+Orion::Orion(bool usehdd, int maxSize) : Orion(usehdd, maxSize, true, "") {
+}
+
+/**
+ * Keeps the ORAM buckets on the BucketStore server at storeAddress instead of in local memory
+ */
+Orion::Orion(bool usehdd, int maxSize, string storeAddress) : Orion(usehdd, maxSize, true, storeAddress) {
+}
+
+Orion::Orion(bool usehdd, int maxSize, bool initialize, string storeAddress) {
     this->useHDD = usehdd;
+    this->maxSize = maxSize;
     bytes<Key> key1{0};
     bytes<Key> key2{1};
-    srch = new OMAP(maxSize*4, key1);
-    updt = new OMAP(maxSize*4, key2);
+    RAMStoreFactory srchStore = nullptr, updtStore = nullptr;
+    if (storeAddress != "") {
+        std::shared_ptr<grpc::Channel> channel(grpc::CreateChannel(storeAddress, grpc::InsecureChannelCredentials()));
+        srchStore = RemoteRAMStore::factory(channel, 0);
+        updtStore = RemoteRAMStore::factory(channel, 1);
+    }
+    srch = new OMAP(maxSize*4, key1, initialize, srchStore);
+    updt = new OMAP(maxSize*4, key2, initialize, updtStore);
 }
 
 Orion::~Orion() {
@@ -92,6 +112,59 @@ void Orion::setupRemove(string keyword, int ind) {
     }
 }
 
+/**
+ * This function applies a list of inserts and removes as one operation on each OMAP. The operations are
+ * padded to the worst case of the batch, so the server only learns the number of inserts and removes
+ */
+void Orion::batchUpdate(vector<tuple<string, int, OP> > updates) {
+    int inserts = 0, removes = 0;
+    updt->startBatch();
+    srch->startBatch();
+    for (auto update : updates) {
+        string keyword = get<0>(update);
+        int ind = get<1>(update);
+        Bid mapKey = createBid(keyword, ind);
+        string updt_cnt = updt->findInBatch(mapKey);
+        if (get<2>(update) == INS) {
+            inserts++;
+            if (updt_cnt == "" || stoi(updt_cnt) <= 0) {
+                if (UpdtCnt.count(keyword) == 0) {
+                    UpdtCnt[keyword] = 0;
+                }
+                UpdtCnt[keyword]++;
+                updt->insertInBatch(mapKey, to_string(UpdtCnt[keyword]));
+                Bid key = createBid(keyword, UpdtCnt[keyword]);
+                srch->insertInBatch(key, to_string(ind));
+                LastIND[keyword] = ind;
+            }
+        } else {
+            removes++;
+            if (updt_cnt != "" && stoi(updt_cnt) > 0) {
+                updt->insertInBatch(mapKey, to_string(-1));
+                UpdtCnt[keyword]--;
+                if (UpdtCnt[keyword] > 0) {
+                    if (UpdtCnt[keyword] + 1 != stoi(updt_cnt)) {
+                        Bid curKey = createBid(keyword, LastIND[keyword]);
+                        updt->insertInBatch(curKey, updt_cnt);
+                        Bid curKey2 = createBid(keyword, stoi(updt_cnt));
+                        srch->insertInBatch(curKey2, to_string(LastIND[keyword]));
+                    }
+                    Bid key = createBid(keyword, UpdtCnt[keyword]);
+                    string idstr = srch->findInBatch(key);
+                    int lastID = stoi(idstr);
+                    LastIND[keyword] = lastID;
+                } else {
+                    LastIND.erase(keyword);
+                }
+            }
+        }
+    }
+    // worst case: an insert is one find and one insert on updt and one insert on srch, a remove is one
+    // find and two inserts on updt and one find and one insert on srch
+    updt->finishBatch(inserts + removes, inserts + 2 * removes);
+    srch->finishBatch(removes, inserts + removes);
+}
+
 vector<int> Orion::search(string keyword) {
     vector<int> result;
     vector<Bid> bids;
@@ -130,3 +203,54 @@ Bid Orion::createBid(string keyword, int number) {
     std::copy(arr.begin(), arr.end(), bid.id.end() - 4);
     return bid;
 }
+
+/**
+ * This function writes the client state and both OMAPs into a single checkpoint file. It should not be
+ * called between beginSetup() and endSetup()
+ */
+void Orion::saveCheckpoint(string path) {
+    CheckpointWriter out(path, CHECKPOINT_ORION);
+    out.writeValue<uint8_t>(useHDD);
+    out.writeValue<int32_t>(maxSize);
+    out.writeMap(UpdtCnt);
+    out.writeMap(LastIND);
+    srch->serialise(out);
+    updt->serialise(out);
+    out.close();
+}
+
+/**
+ * This function restores an instance saved by saveCheckpoint() without running the setup again. If
+ * storeAddress is given, the buckets are uploaded to that BucketStore server
+ */
+Orion* Orion::loadCheckpoint(string path, string storeAddress) {
+    CheckpointReader in(path, CHECKPOINT_ORION);
+    bool usehdd = in.readValue<uint8_t>();
+    int maxSize = in.readValue<int32_t>();
+    Orion* orion = new Orion(usehdd, maxSize, false, storeAddress);
+    try {
+        orion->UpdtCnt = in.readMap();
+        orion->LastIND = in.readMap();
+        orion->srch->deserialise(in);
+        orion->updt->deserialise(in);
+        if (!in.finished()) {
+            throw runtime_error("Checkpoint has trailing data");
+        }
+    } catch (...) {
+        delete orion;
+        throw;
+    }
+    return orion;
+}
+
+/**
+ * Returns the metrics of both OMAPs as a JSON object, e.g. to size maxSize or watch stash pressure
+ */
+string Orion::dumpMetrics() const {
+    return "{\"srch\":" + srch->dumpMetrics() + ",\"updt\":" + updt->dumpMetrics() + "}";
+}
+
+void Orion::resetMetrics() {
+    srch->resetMetrics();
+    updt->resetMetrics();
+}
@@ -5,13 +5,21 @@
 using namespace std;
 
 class Orion {
+public:
+    // kept in the class: mitra/Client.h defines the same global names
+    enum OP {
+        INS, DEL
+    };
+
 private:
     bool useHDD;
+    int maxSize;
     map<Bid,string > setupPairs1;
     map<Bid,string > setupPairs2;
     OMAP* srch,*updt;
     map<string, int> UpdtCnt;
     map<string, int> LastIND;        
+    Orion(bool useHDD, int maxSize, bool initialize, string storeAddress);
     
 public:
     Bid createBid(string keyword,int number);
@@ -19,11 +27,17 @@ public:
     void setupInsert(string keyword, int ind);
     void remove(string keyword, int ind);
     void setupRemove(string keyword, int ind);
+    void batchUpdate(vector<tuple<string, int, OP> > updates);
     vector<int> search(string keyword);
     Orion(bool useHDD,int maxSize);    
+    Orion(bool useHDD, int maxSize, string storeAddress);
     virtual ~Orion();
     void beginSetup();
     void endSetup();
+    string dumpMetrics() const;
+    void saveCheckpoint(string path);
+    static Orion* loadCheckpoint(string path, string storeAddress = "");
+    void resetMetrics();
 
 };
 
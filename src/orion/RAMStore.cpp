@@ -1,6 +1,7 @@
 #include "RAMStore.hpp"
 #include <iostream>
 #include "ORAM.hpp"
+#include "../utils/Checkpoint.h"
 using namespace std;
 
 RAMStore::RAMStore(size_t count, size_t size)
@@ -20,6 +21,25 @@ void RAMStore::Write(int pos, block b)
 	store[pos] = b;
 }
 
+std::vector<block> RAMStore::ReadBatch(const std::vector<int>& positions)
+{
+	std::vector<block> result;
+	for (int pos : positions) {
+		result.push_back(Read(pos));
+	}
+	return result;
+}
+
+// Hints that the given positions are going to be read, an in-memory store ignores it
+void RAMStore::Prefetch(const std::vector<int>& positions)
+{
+}
+
+// Makes buffered writes visible to the storage, an in-memory store has none
+void RAMStore::Flush()
+{
+}
+
 size_t RAMStore::GetBlockCount()
 {
 	return store.size();
@@ -42,3 +62,36 @@ void RAMStore::ReduceEmptyNumbers() {
 size_t RAMStore::GetEmptySize() {
     return emptyNodes;
 }
+
+void RAMStore::Serialise(CheckpointWriter& out) {
+    size_t count = GetBlockCount();
+    out.writeValue<uint64_t>(count);
+    out.writeValue<uint64_t>(size);
+    out.writeValue<uint64_t>(emptyNodes);
+    const size_t chunk = 1024;
+    for (size_t begin = 0; begin < count; begin += chunk) {
+        std::vector<int> positions;
+        for (size_t i = begin; i < count && i < begin + chunk; i++) {
+            positions.push_back(i);
+        }
+        for (auto& b : ReadBatch(positions)) {
+            out.writeValue<uint64_t>(b.size());
+            out.write(b.data(), b.size());
+        }
+    }
+}
+
+void RAMStore::Deserialise(CheckpointReader& in) {
+    uint64_t count = in.readValue<uint64_t>();
+    uint64_t blockSize = in.readValue<uint64_t>();
+    if (count != GetBlockCount() || blockSize != size) {
+        throw runtime_error("Checkpoint does not match the store geometry");
+    }
+    emptyNodes = in.readValue<uint64_t>();
+    for (uint64_t i = 0; i < count; i++) {
+        uint64_t len = in.readValue<uint64_t>();
+        const byte_t* data = in.read(len);
+        Write(i, block(data, data + len));
+    }
+    Flush();
+}
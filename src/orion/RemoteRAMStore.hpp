@@ -0,0 +1,52 @@
+#pragma once
+#include "RAMStore.hpp"
+#include "oram.grpc.pb.h"
+
+#include <future>
+#include <list>
+#include <memory>
+#include <set>
+#include <string>
+
+#include <grpc++/channel.h>
+
+/*
+ * A RAMStore whose buckets live on a BucketStore server. Writes are buffered
+ * and sent in batches, reads of a path are sent as one request, and
+ * Prefetch() starts a read in the background whose result is used by the next
+ * Read/ReadBatch of those positions.
+ */
+class RemoteRAMStore : public RAMStore {
+private:
+    struct PendingRead {
+        std::set<int> positions;
+        std::future<ReadBucketsReply> reply;
+        std::vector<int> order;
+    };
+
+    std::shared_ptr<grpc::Channel> channel;
+    std::unique_ptr<BucketStore::Stub> stub_;
+    uint32_t storeId;
+    size_t count;
+    std::map<int, block> pendingWrites;
+    std::map<int, block> prefetched;
+    std::list<PendingRead> inflight;
+
+    static const size_t kWriteBatchSize = 1024;
+
+    void CollectPrefetched(int pos);
+    std::vector<block> RemoteRead(const std::vector<int>& positions);
+
+public:
+    RemoteRAMStore(std::shared_ptr<grpc::Channel> channel, uint32_t storeId, size_t num, size_t size);
+    ~RemoteRAMStore();
+
+    block Read(int pos);
+    void Write(int pos, block b);
+    std::vector<block> ReadBatch(const std::vector<int>& positions);
+    void Prefetch(const std::vector<int>& positions);
+    void Flush();
+    size_t GetBlockCount();
+
+    static RAMStoreFactory factory(std::shared_ptr<grpc::Channel> channel, uint32_t storeId);
+};
@@ -0,0 +1,189 @@
+#include "Checkpoint.h"
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+static const char CHECKPOINT_MAGIC[8] = {'S', 'S', 'E', 'C', 'K', 'P', 'T', '\0'};
+static const size_t CHECKPOINT_HEADER_SIZE = 8 + 4 + 4 + 8 + 8;
+
+CheckpointChecksum::CheckpointChecksum()
+: state(0xcbf29ce484222325ULL), length(0), pendingSize(0) {
+}
+
+void CheckpointChecksum::mix(uint64_t word) {
+    state ^= word;
+    state *= 0x9e3779b97f4a7c15ULL;
+    state ^= state >> 29;
+}
+
+// Consumes the input eight bytes at a time, so the result does not depend on
+// how the payload is split into update() calls
+
+void CheckpointChecksum::update(const uint8_t* data, size_t len) {
+    length += len;
+    while (pendingSize > 0 && pendingSize < 8 && len > 0) {
+        pending[pendingSize++] = *data++;
+        len--;
+    }
+    if (pendingSize == 8) {
+        uint64_t word;
+        memcpy(&word, pending, 8);
+        mix(word);
+        pendingSize = 0;
+    }
+    for (; len >= 8; data += 8, len -= 8) {
+        uint64_t word;
+        memcpy(&word, data, 8);
+        mix(word);
+    }
+    memcpy(pending + pendingSize, data, len);
+    pendingSize += len;
+}
+
+uint64_t CheckpointChecksum::digest() const {
+    CheckpointChecksum tmp = *this;
+    uint64_t word = 0;
+    memcpy(&word, tmp.pending, tmp.pendingSize);
+    tmp.mix(word);
+    tmp.mix(length);
+    return tmp.state;
+}
+
+CheckpointWriter::CheckpointWriter(string path, uint32_t kind)
+: out(path, ios::binary | ios::trunc), payloadSize(0), kind(kind), closed(false) {
+    if (!out) {
+        throw runtime_error("Cannot open checkpoint file " + path);
+    }
+    // placeholder header, completed in close()
+    char header[CHECKPOINT_HEADER_SIZE] = {0};
+    out.write(header, CHECKPOINT_HEADER_SIZE);
+}
+
+CheckpointWriter::~CheckpointWriter() {
+    if (!closed) {
+        out.close();
+    }
+}
+
+void CheckpointWriter::write(const void* data, size_t len) {
+    out.write((const char*) data, len);
+    checksum.update((const uint8_t*) data, len);
+    payloadSize += len;
+}
+
+void CheckpointWriter::writeString(const string& value) {
+    writeValue<uint64_t>(value.size());
+    write(value.data(), value.size());
+}
+
+void CheckpointWriter::writeMap(const map<string, int>& values) {
+    writeValue<uint64_t>(values.size());
+    for (auto item : values) {
+        writeString(item.first);
+        writeValue<int32_t>(item.second);
+    }
+}
+
+void CheckpointWriter::close() {
+    uint64_t digest = checksum.digest();
+    out.seekp(0);
+    out.write(CHECKPOINT_MAGIC, 8);
+    out.write((const char*) &CHECKPOINT_VERSION, 4);
+    out.write((const char*) &kind, 4);
+    out.write((const char*) &payloadSize, 8);
+    out.write((const char*) &digest, 8);
+    out.close();
+    closed = true;
+    if (out.fail()) {
+        throw runtime_error("Writing checkpoint failed");
+    }
+}
+
+CheckpointReader::CheckpointReader(string path, uint32_t kind)
+: fd(-1), mapping(NULL), mappingSize(0), cursor(NULL), end(NULL) {
+    fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw runtime_error("Cannot open checkpoint file " + path);
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t) st.st_size < CHECKPOINT_HEADER_SIZE) {
+        ::close(fd);
+        throw runtime_error("Checkpoint file is truncated");
+    }
+    mappingSize = st.st_size;
+    void* addr = mmap(NULL, mappingSize, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (addr == MAP_FAILED) {
+        ::close(fd);
+        throw runtime_error("Cannot map checkpoint file " + path);
+    }
+    mapping = (uint8_t*) addr;
+    madvise(mapping, mappingSize, MADV_SEQUENTIAL);
+
+    uint32_t version, fileKind;
+    uint64_t payloadSize, digest;
+    memcpy(&version, mapping + 8, 4);
+    memcpy(&fileKind, mapping + 12, 4);
+    memcpy(&payloadSize, mapping + 16, 8);
+    memcpy(&digest, mapping + 24, 8);
+    string error;
+    if (memcmp(mapping, CHECKPOINT_MAGIC, 8) != 0) {
+        error = "Not a checkpoint file";
+    } else if (version != CHECKPOINT_VERSION) {
+        error = "Unsupported checkpoint version " + to_string(version);
+    } else if (fileKind != kind) {
+        error = "Checkpoint was written by another scheme";
+    } else if (payloadSize != mappingSize - CHECKPOINT_HEADER_SIZE) {
+        error = "Checkpoint file is truncated";
+    } else {
+        CheckpointChecksum checksum;
+        checksum.update(mapping + CHECKPOINT_HEADER_SIZE, payloadSize);
+        if (checksum.digest() != digest) {
+            error = "Checkpoint checksum mismatch";
+        }
+    }
+    if (error != "") {
+        munmap(mapping, mappingSize);
+        ::close(fd);
+        throw runtime_error(error);
+    }
+    cursor = mapping + CHECKPOINT_HEADER_SIZE;
+    end = mapping + mappingSize;
+}
+
+CheckpointReader::~CheckpointReader() {
+    munmap(mapping, mappingSize);
+    ::close(fd);
+}
+
+const uint8_t* CheckpointReader::read(size_t len) {
+    if ((size_t) (end - cursor) < len) {
+        throw runtime_error("Checkpoint payload is shorter than expected");
+    }
+    const uint8_t* data = cursor;
+    cursor += len;
+    return data;
+}
+
+string CheckpointReader::readString() {
+    uint64_t len = readValue<uint64_t>();
+    const uint8_t* data = read(len);
+    return string((const char*) data, len);
+}
+
+map<string, int> CheckpointReader::readMap() {
+    map<string, int> values;
+    uint64_t count = readValue<uint64_t>();
+    for (uint64_t i = 0; i < count; i++) {
+        string key = readString();
+        values[key] = readValue<int32_t>();
+    }
+    return values;
+}
+
+bool CheckpointReader::finished() const {
+    return cursor == end;
+}
@@ -0,0 +1,85 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+#include <string>
+#include <map>
+#include <fstream>
+#include <cstdint>
+#include <stdexcept>
+#include <algorithm>
+
+/*
+ * Checkpoint files are written sequentially and have the layout
+ *
+ *   magic (8) | version (4) | kind (4) | payload length (8) | checksum (8) | payload
+ *
+ * where the checksum covers the payload. A reader maps the whole file,
+ * validates the header and the checksum in one pass and then hands out
+ * pointers into the mapping.
+ */
+class CheckpointChecksum {
+private:
+    uint64_t state;
+    uint64_t length;
+    uint8_t pending[8];
+    size_t pendingSize;
+    void mix(uint64_t word);
+
+public:
+    CheckpointChecksum();
+    void update(const uint8_t* data, size_t len);
+    uint64_t digest() const;
+};
+
+class CheckpointWriter {
+private:
+    std::ofstream out;
+    CheckpointChecksum checksum;
+    uint64_t payloadSize;
+    uint32_t kind;
+    bool closed;
+
+public:
+    CheckpointWriter(std::string path, uint32_t kind);
+    ~CheckpointWriter();
+    void write(const void* data, size_t len);
+    void writeString(const std::string& value);
+    void writeMap(const std::map<std::string, int>& values);
+    void close();
+
+    template <typename T>
+    void writeValue(const T& value) {
+        write(&value, sizeof (T));
+    }
+};
+
+class CheckpointReader {
+private:
+    int fd;
+    uint8_t* mapping;
+    size_t mappingSize;
+    const uint8_t* cursor;
+    const uint8_t* end;
+
+public:
+    CheckpointReader(std::string path, uint32_t kind);
+    ~CheckpointReader();
+    const uint8_t* read(size_t len);
+    std::string readString();
+    std::map<std::string, int> readMap();
+    bool finished() const;
+
+    template <typename T>
+    T readValue() {
+        T value;
+        const uint8_t* data = read(sizeof (T));
+        std::copy(data, data + sizeof (T), reinterpret_cast<uint8_t*> (&value));
+        return value;
+    }
+};
+
+constexpr uint32_t CHECKPOINT_VERSION = 1;
+constexpr uint32_t CHECKPOINT_ORION = 1;
+constexpr uint32_t CHECKPOINT_HORUS = 2;
+constexpr uint32_t CHECKPOINT_COUNTERS = 3;
+
+#endif /* CHECKPOINT_H */
@@ -0,0 +1,344 @@
+#pragma once
+
+#include "flat_token_map.hpp"
+#include "rocksdb_wrapper.hpp"
+#include "Checkpoint.h"
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace sse {
+    namespace sophos {
+
+        enum class StoreBackend {
+            kMemory,
+            kRocksDB,
+            kSnapshot
+        };
+
+        /*
+         * Fixed size records of the clients, indexed by the 16 bytes keyword
+         * index: the keyword counters of Sophos (CounterStore) and the
+         * keyword states of Diana. The backend is chosen when the client is
+         * built:
+         *  - kMemory: flat hash table, lost when the client exits;
+         *  - kRocksDB: RocksDBCounter (with a block cache) at path, under a
+         *    write-back table flushed as one WriteBatch every kWriteBackSize
+         *    modified keywords, on flush() and on destruction;
+         *  - kSnapshot: read-only sorted snapshot at path, as written by
+         *    write_snapshot, mapped in memory and binary searched. It is for
+         *    the clients that only search: an update throws logic_error.
+         * V is copied as raw bytes, so it must be trivially copyable.
+         */
+        template <typename V>
+        class RecordStore {
+        public:
+            static_assert(std::is_trivially_copyable<V>::value, "The records are stored as raw bytes");
+
+            static constexpr size_t kKeySize = 16;
+            typedef std::array<uint8_t, kKeySize> key_type;
+            typedef V value_type;
+            typedef StoreBackend Backend;
+
+            static std::unique_ptr<RecordStore> open(const Backend backend, const std::string& path);
+
+            virtual ~RecordStore() {
+            }
+
+            virtual bool get(const key_type& key, V& val) const = 0;
+            virtual void set(const key_type& key, const V& val) = 0;
+            virtual bool remove(const key_type& key) = 0;
+            // approximate for kRocksDB
+            virtual size_t size() const = 0;
+
+            virtual void flush() {
+            }
+
+            // writes every record in a file readable with kSnapshot
+            virtual void write_snapshot(const std::string& path) const = 0;
+
+        protected:
+            typedef std::vector<std::pair<key_type, V> > record_list;
+
+            // count (8) | record size (4) | records sorted by key
+            static void write_records(const std::string& path, record_list& records);
+        };
+
+        typedef RecordStore<uint32_t> CounterStore;
+
+        template <typename V>
+        class MemoryRecordStore : public RecordStore<V> {
+        public:
+            typedef typename RecordStore<V>::key_type key_type;
+
+            bool get(const key_type& key, V& val) const;
+            void set(const key_type& key, const V& val);
+            bool remove(const key_type& key);
+            size_t size() const;
+            void write_snapshot(const std::string& path) const;
+
+        private:
+            FlatTokenMap<RecordStore<V>::kKeySize, V> records_;
+        };
+
+        template <typename V>
+        class RocksDBRecordStore : public RecordStore<V> {
+        public:
+            typedef typename RecordStore<V>::key_type key_type;
+            static constexpr size_t kWriteBackSize = 1 << 16;
+
+            RocksDBRecordStore(const std::string& path);
+            ~RocksDBRecordStore();
+
+            bool get(const key_type& key, V& val) const;
+            void set(const key_type& key, const V& val);
+            bool remove(const key_type& key);
+            size_t size() const;
+            void flush();
+            void write_snapshot(const std::string& path) const;
+
+        private:
+            RocksDBCounter db_;
+            // records modified since the last flush
+            FlatTokenMap<RecordStore<V>::kKeySize, V> dirty_;
+        };
+
+        template <typename V>
+        class SnapshotRecordStore : public RecordStore<V> {
+        public:
+            typedef typename RecordStore<V>::key_type key_type;
+            // a record is the key followed by the value
+            static constexpr size_t kRecordSize = RecordStore<V>::kKeySize + sizeof (V);
+
+            SnapshotRecordStore(const std::string& path);
+
+            bool get(const key_type& key, V& val) const;
+            void set(const key_type& key, const V& val);
+            bool remove(const key_type& key);
+            size_t size() const;
+            void write_snapshot(const std::string& path) const;
+
+        private:
+            CheckpointReader reader_;
+            const uint8_t* records_;
+            uint64_t count_;
+        };
+
+        typedef MemoryRecordStore<uint32_t> MemoryCounterStore;
+        typedef RocksDBRecordStore<uint32_t> RocksDBCounterStore;
+        typedef SnapshotRecordStore<uint32_t> SnapshotCounterStore;
+
+        template <typename V>
+        constexpr size_t RecordStore<V>::kKeySize;
+        template <typename V>
+        constexpr size_t RocksDBRecordStore<V>::kWriteBackSize;
+        template <typename V>
+        constexpr size_t SnapshotRecordStore<V>::kRecordSize;
+
+        template <typename V>
+        std::unique_ptr<RecordStore<V> > RecordStore<V>::open(const Backend backend, const std::string& path) {
+            switch (backend) {
+                case Backend::kMemory:
+                    return std::unique_ptr<RecordStore>(new MemoryRecordStore<V>());
+                case Backend::kRocksDB:
+                    return std::unique_ptr<RecordStore>(new RocksDBRecordStore<V>(path));
+                case Backend::kSnapshot:
+                    return std::unique_ptr<RecordStore>(new SnapshotRecordStore<V>(path));
+            }
+            throw std::invalid_argument("Unknown record store backend");
+        }
+
+        template <typename V>
+        void RecordStore<V>::write_records(const std::string& path, record_list& records) {
+            std::sort(records.begin(), records.end(), [](const std::pair<key_type, V>& a, const std::pair<key_type, V>& b) {
+                return a.first < b.first;
+            });
+
+            CheckpointWriter writer(path, CHECKPOINT_COUNTERS);
+            writer.writeValue<uint64_t>(records.size());
+            writer.writeValue<uint32_t>(kKeySize + sizeof (V));
+            for (const auto& record : records) {
+                writer.write(record.first.data(), record.first.size());
+                writer.write(&record.second, sizeof (V));
+            }
+            writer.close();
+        }
+
+        template <typename V>
+        bool MemoryRecordStore<V>::get(const key_type& key, V& val) const {
+            return records_.get(key, val);
+        }
+
+        template <typename V>
+        void MemoryRecordStore<V>::set(const key_type& key, const V& val) {
+            records_.put(key, val);
+        }
+
+        template <typename V>
+        bool MemoryRecordStore<V>::remove(const key_type& key) {
+            return records_.remove(key);
+        }
+
+        template <typename V>
+        size_t MemoryRecordStore<V>::size() const {
+            return records_.size();
+        }
+
+        template <typename V>
+        void MemoryRecordStore<V>::write_snapshot(const std::string& path) const {
+            typename RecordStore<V>::record_list records;
+            records.reserve(records_.size());
+            records_.for_each([&records](const key_type& key, const V& val) {
+                records.push_back(std::make_pair(key, val));
+            });
+            RecordStore<V>::write_records(path, records);
+        }
+
+        template <typename V>
+        RocksDBRecordStore<V>::RocksDBRecordStore(const std::string& path) : db_(path) {
+        }
+
+        template <typename V>
+        RocksDBRecordStore<V>::~RocksDBRecordStore() {
+            flush();
+        }
+
+        template <typename V>
+        bool RocksDBRecordStore<V>::get(const key_type& key, V& val) const {
+            if (dirty_.get(key, val)) {
+                return true;
+            }
+            std::string data;
+            if (!db_.get(std::string(key.begin(), key.end()), data) || data.size() != sizeof (V)) {
+                return false;
+            }
+            ::memcpy(&val, data.data(), sizeof (V));
+            return true;
+        }
+
+        template <typename V>
+        void RocksDBRecordStore<V>::set(const key_type& key, const V& val) {
+            dirty_.put(key, val);
+            if (dirty_.size() >= kWriteBackSize) {
+                flush();
+            }
+        }
+
+        template <typename V>
+        bool RocksDBRecordStore<V>::remove(const key_type& key) {
+            V val;
+            bool found = get(key, val);
+            dirty_.remove(key);
+            db_.remove_key(std::string(key.begin(), key.end()));
+            return found;
+        }
+
+        template <typename V>
+        size_t RocksDBRecordStore<V>::size() const {
+            return db_.approximate_size() + dirty_.size();
+        }
+
+        template <typename V>
+        void RocksDBRecordStore<V>::flush() {
+            if (dirty_.size() == 0) {
+                return;
+            }
+            rocksdb::WriteBatch batch;
+            dirty_.for_each([&batch](const key_type& key, const V& val) {
+                batch.Put(rocksdb::Slice(reinterpret_cast<const char*> (key.data()), key.size()),
+                        rocksdb::Slice(reinterpret_cast<const char*> (&val), sizeof (V)));
+            });
+            if (db_.write(batch)) {
+                dirty_.clear();
+            }
+        }
+
+        template <typename V>
+        void RocksDBRecordStore<V>::write_snapshot(const std::string& path) const {
+            typename RecordStore<V>::record_list records;
+            db_.for_each([this, &records](const std::string& db_key, const std::string& data) {
+                if (db_key.size() != RecordStore<V>::kKeySize || data.size() != sizeof (V)) {
+                    return;
+                }
+                key_type key;
+                V val;
+                std::copy_n(db_key.begin(), RecordStore<V>::kKeySize, key.begin());
+                ::memcpy(&val, data.data(), sizeof (V));
+                // the write-back table is more recent
+                dirty_.get(key, val);
+                records.push_back(std::make_pair(key, val));
+            });
+            dirty_.for_each([this, &records](const key_type& key, const V& val) {
+                std::string data;
+                if (!db_.get(std::string(key.begin(), key.end()), data)) {
+                    records.push_back(std::make_pair(key, val));
+                }
+            });
+            RecordStore<V>::write_records(path, records);
+        }
+
+        template <typename V>
+        SnapshotRecordStore<V>::SnapshotRecordStore(const std::string& path) : reader_(path, CHECKPOINT_COUNTERS) {
+            count_ = reader_.readValue<uint64_t>();
+            if (reader_.readValue<uint32_t>() != kRecordSize) {
+                throw std::runtime_error("Invalid record size in the snapshot " + path);
+            }
+            records_ = reader_.read(count_ * kRecordSize);
+            if (!reader_.finished()) {
+                throw std::runtime_error("Invalid record snapshot " + path);
+            }
+        }
+
+        template <typename V>
+        bool SnapshotRecordStore<V>::get(const key_type& key, V& val) const {
+            uint64_t low = 0, high = count_;
+            while (low < high) {
+                uint64_t mid = low + (high - low) / 2;
+                int c = ::memcmp(records_ + mid * kRecordSize, key.data(), RecordStore<V>::kKeySize);
+                if (c == 0) {
+                    ::memcpy(&val, records_ + mid * kRecordSize + RecordStore<V>::kKeySize, sizeof (V));
+                    return true;
+                }
+                if (c < 0) {
+                    low = mid + 1;
+                } else {
+                    high = mid;
+                }
+            }
+            return false;
+        }
+
+        template <typename V>
+        void SnapshotRecordStore<V>::set(const key_type& key, const V& val) {
+            throw std::logic_error("The record snapshot is read-only");
+        }
+
+        template <typename V>
+        bool SnapshotRecordStore<V>::remove(const key_type& key) {
+            throw std::logic_error("The record snapshot is read-only");
+        }
+
+        template <typename V>
+        size_t SnapshotRecordStore<V>::size() const {
+            return count_;
+        }
+
+        template <typename V>
+        void SnapshotRecordStore<V>::write_snapshot(const std::string& path) const {
+            typename RecordStore<V>::record_list records(count_);
+            for (uint64_t i = 0; i < count_; i++) {
+                std::copy_n(records_ + i * kRecordSize, RecordStore<V>::kKeySize, records[i].first.begin());
+                ::memcpy(&records[i].second, records_ + i * kRecordSize + RecordStore<V>::kKeySize, sizeof (V));
+            }
+            RecordStore<V>::write_records(path, records);
+        }
+    }
+}
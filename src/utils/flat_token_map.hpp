@@ -0,0 +1,234 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+namespace sse {
+    namespace sophos {
+
+        /*
+         * Open addressing (linear probing) hash table for fixed size tokens.
+         *
+         * The keys are PRF outputs, so their first 8 bytes are used as the hash.
+         * Deletions shift the following entries back instead of leaving
+         * tombstones, so the probe sequences stay short in cleaning mode.
+         * Lookups are not synchronized with modifications.
+         */
+        template <size_t N, typename V>
+        class FlatTokenMap {
+        public:
+            static_assert(N >= sizeof (uint64_t), "Tokens must be at least 8 bytes long");
+
+            typedef std::array<uint8_t, N> key_type;
+
+            // number of keys whose buckets are prefetched ahead in lookup_many
+            static constexpr size_t kPrefetchGroup = 8;
+
+            FlatTokenMap(size_t initial_capacity = 1024);
+
+            size_t size() const {
+                return size_;
+            }
+
+            void reserve(size_t count);
+            void clear();
+
+            // returns false if the key was already there (the value is left untouched)
+            bool insert(const key_type& key, const V& value);
+            void put(const key_type& key, const V& value);
+
+            bool get(const uint8_t* key, V& value) const;
+            bool get(const key_type& key, V& value) const {
+                return get(key.data(), value);
+            }
+
+            // pointer to the value of key, or nullptr; invalidated by insertions and removals
+            V* find(const key_type& key) {
+                Slot& s = slots_[find_slot(key.data())];
+                return s.used ? &s.value : nullptr;
+            }
+
+            bool remove(const uint8_t* key);
+            bool remove(const key_type& key) {
+                return remove(key.data());
+            }
+
+            // Looks up the n consecutive keys (N bytes each), setting found[i]
+            // and values[i]. The buckets of the next group of keys are prefetched
+            // while the current one is probed. Returns the number of hits.
+            size_t lookup_many(const uint8_t* keys, const size_t n, V* values, uint8_t* found) const;
+
+            // calls f(key, value) for every entry, in no particular order
+            template <typename F>
+            void for_each(F f) const {
+                for (const auto& s : slots_) {
+                    if (s.used) {
+                        f(s.key, s.value);
+                    }
+                }
+            }
+
+        private:
+
+            struct Slot {
+                key_type key;
+                V value;
+                bool used;
+            };
+
+            inline size_t bucket(const uint8_t* key) const {
+                uint64_t h;
+                memcpy(&h, key, sizeof (h));
+                return h & mask_;
+            }
+
+            inline void prefetch(const uint8_t* key) const {
+                __builtin_prefetch(&slots_[bucket(key)]);
+            }
+
+            // index of the key's slot, or of the empty slot ending its probe sequence
+            inline size_t find_slot(const uint8_t* key) const {
+                size_t i = bucket(key);
+                while (slots_[i].used && memcmp(slots_[i].key.data(), key, N) != 0) {
+                    i = (i + 1) & mask_;
+                }
+                return i;
+            }
+
+            void grow();
+
+            std::vector<Slot> slots_;
+            size_t mask_;
+            size_t size_;
+        };
+
+        template <size_t N, typename V>
+        FlatTokenMap<N, V>::FlatTokenMap(size_t initial_capacity) : mask_(0), size_(0) {
+            size_t capacity = 16;
+            while (capacity < initial_capacity) {
+                capacity <<= 1;
+            }
+            slots_.resize(capacity);
+            mask_ = capacity - 1;
+            for (auto& s : slots_) {
+                s.used = false;
+            }
+        }
+
+        template <size_t N, typename V>
+        void FlatTokenMap<N, V>::reserve(size_t count) {
+            // keep the load factor below 3/4
+            while (4 * count > 3 * slots_.size()) {
+                grow();
+            }
+        }
+
+        template <size_t N, typename V>
+        void FlatTokenMap<N, V>::clear() {
+            for (auto& s : slots_) {
+                s.used = false;
+            }
+            size_ = 0;
+        }
+
+        template <size_t N, typename V>
+        void FlatTokenMap<N, V>::grow() {
+            std::vector<Slot> old_slots(slots_.size() * 2);
+            old_slots.swap(slots_);
+            mask_ = slots_.size() - 1;
+            for (auto& s : slots_) {
+                s.used = false;
+            }
+
+            for (const auto& s : old_slots) {
+                if (s.used) {
+                    slots_[find_slot(s.key.data())] = s;
+                }
+            }
+        }
+
+        template <size_t N, typename V>
+        bool FlatTokenMap<N, V>::insert(const key_type& key, const V& value) {
+            reserve(size_ + 1);
+
+            size_t i = find_slot(key.data());
+            if (slots_[i].used) {
+                return false;
+            }
+            slots_[i].key = key;
+            slots_[i].value = value;
+            slots_[i].used = true;
+            size_++;
+            return true;
+        }
+
+        template <size_t N, typename V>
+        void FlatTokenMap<N, V>::put(const key_type& key, const V& value) {
+            if (!insert(key, value)) {
+                slots_[find_slot(key.data())].value = value;
+            }
+        }
+
+        template <size_t N, typename V>
+        bool FlatTokenMap<N, V>::get(const uint8_t* key, V& value) const {
+            const Slot& s = slots_[find_slot(key)];
+            if (!s.used) {
+                return false;
+            }
+            value = s.value;
+            return true;
+        }
+
+        template <size_t N, typename V>
+        bool FlatTokenMap<N, V>::remove(const uint8_t* key) {
+            size_t hole = find_slot(key);
+            if (!slots_[hole].used) {
+                return false;
+            }
+
+            // backward shift: move back every following entry of the cluster
+            // whose home bucket is not between the hole and its position
+            size_t i = hole;
+            while (true) {
+                i = (i + 1) & mask_;
+                if (!slots_[i].used) {
+                    break;
+                }
+                size_t home = bucket(slots_[i].key.data());
+                if (((i - home) & mask_) >= ((i - hole) & mask_)) {
+                    slots_[hole] = slots_[i];
+                    hole = i;
+                }
+            }
+            slots_[hole].used = false;
+            size_--;
+            return true;
+        }
+
+        template <size_t N, typename V>
+        size_t FlatTokenMap<N, V>::lookup_many(const uint8_t* keys, const size_t n, V* values, uint8_t* found) const {
+            size_t hits = 0;
+
+            for (size_t i = 0; i < n && i < kPrefetchGroup; i++) {
+                prefetch(keys + i * N);
+            }
+
+            for (size_t group = 0; group < n; group += kPrefetchGroup) {
+                size_t group_end = (group + kPrefetchGroup < n) ? group + kPrefetchGroup : n;
+
+                for (size_t i = group_end; i < n && i < group_end + kPrefetchGroup; i++) {
+                    prefetch(keys + i * N);
+                }
+
+                for (size_t i = group; i < group_end; i++) {
+                    found[i] = get(keys + i * N, values[i]);
+                    hits += found[i];
+                }
+            }
+            return hits;
+        }
+    }
+}
@@ -0,0 +1,69 @@
+#include "payload_codec.hpp"
+#include "Utilities.h"
+
+#include <openssl/evp.h>
+
+#include <cerrno>
+#include <cstdlib>
+
+namespace sse {
+    namespace sophos {
+
+        constexpr size_t Payload::kSize;
+        constexpr size_t Payload::kIdOffset;
+        constexpr size_t Payload::kCounterOffset;
+        constexpr size_t Payload::kFlagsOffset;
+        constexpr uint8_t Payload::kInsertionFlag;
+        constexpr uint8_t Payload::kVersionFlags;
+        constexpr uint8_t Payload::kVersionMask;
+
+        // Utilities::decode, but a value that is not a padded single block
+        // plaintext is rejected instead of aborting
+        static bool legacy_plaintext(const Payload::value_type& value, std::string& plain) {
+            unsigned char out[2 * Payload::kSize];
+            int len = 0, final_len = 0;
+            bool valid = false;
+
+            EVP_CIPHER_CTX* ctx = EVP_CIPHER_CTX_new();
+            if (ctx == nullptr) {
+                return false;
+            }
+            if (EVP_DecryptInit_ex(ctx, EVP_aes_128_cbc(), NULL, Utilities::key, Utilities::iv) == 1
+                    && EVP_DecryptUpdate(ctx, out, &len, value.data(), (int) value.size()) == 1
+                    && EVP_DecryptFinal_ex(ctx, out + len, &final_len) == 1) {
+                plain.assign(reinterpret_cast<const char*> (out), len + final_len);
+                valid = true;
+            }
+            EVP_CIPHER_CTX_free(ctx);
+            return valid;
+        }
+
+        // parses a non empty decimal string, without sign nor spaces
+        static bool parse_decimal(const std::string& str, uint64_t& val) {
+            if (str.empty() || str.find_first_not_of("0123456789") != std::string::npos) {
+                return false;
+            }
+            errno = 0;
+            val = strtoull(str.c_str(), nullptr, 10);
+            return errno == 0;
+        }
+
+        bool PayloadCodec::decode_legacy_record(const Payload::value_type& value, Payload& payload) {
+            std::string plain;
+            if (!legacy_plaintext(value, plain)) {
+                return false;
+            }
+            size_t sep = plain.find('|');
+
+            if (sep == std::string::npos || sep + 2 != plain.size() || (plain[sep + 1] != '0' && plain[sep + 1] != '1')) {
+                return false;
+            }
+            if (!parse_decimal(plain.substr(0, sep), payload.id)) {
+                return false;
+            }
+            payload.counter = 0;
+            payload.insertion = plain[sep + 1] == '1';
+            return true;
+        }
+    }
+}
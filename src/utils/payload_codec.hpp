@@ -0,0 +1,113 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+namespace sse {
+    namespace sophos {
+
+        /*
+         * Fixed layout of the 16 bytes payloads of Fides (the values of the
+         * Sophos index) and of the Diana delCntMap:
+         *
+         *   id (8, little endian) | counter (4, little endian) | flags (1) | zeros (3)
+         *
+         * The flags hold the op bit and the format version. They and the zeros
+         * are checked when decoding, which rejects a payload unmasked with the
+         * wrong mask and the values written in the former (AES) format.
+         * Masking is a XOR with a PRF output given by the caller, so neither
+         * side calls a cipher.
+         */
+        struct Payload {
+            static constexpr size_t kSize = 16;
+            static constexpr size_t kIdOffset = 0;
+            static constexpr size_t kCounterOffset = 8;
+            static constexpr size_t kFlagsOffset = 12;
+
+            static constexpr uint8_t kInsertionFlag = 0x01;
+            static constexpr uint8_t kVersionFlags = 0x10;
+            static constexpr uint8_t kVersionMask = 0xf0;
+
+            typedef std::array<uint8_t, kSize> value_type;
+
+            uint64_t id;
+            uint32_t counter;
+            bool insertion;
+        };
+
+        class PayloadCodec {
+        public:
+            // mask points to kSize bytes
+            static inline Payload::value_type encode(const Payload& payload, const uint8_t* mask);
+            // returns false if the flags or the zeros do not match
+            static inline bool decode(const Payload::value_type& value, const uint8_t* mask, Payload& payload);
+
+            // For the payloads masked with zeros over the counter: it can be
+            // read before the mask (usually derived from it) is computed.
+            static inline uint32_t clear_counter(const Payload::value_type& value);
+
+            /*
+             * Migration reader for the Fides databases written before this
+             * layout, where the values were Utilities::encode (AES-CBC) of
+             * "id|op". Only try it on the values decode rejected: there is one
+             * EVP call per value.
+             */
+            static bool decode_legacy_record(const Payload::value_type& value, Payload& payload);
+        };
+
+        inline Payload::value_type PayloadCodec::encode(const Payload& payload, const uint8_t* mask) {
+            Payload::value_type value;
+            value.fill(0);
+
+            for (size_t i = 0; i < sizeof (payload.id); i++) {
+                value[Payload::kIdOffset + i] = (uint8_t) (payload.id >> (8 * i));
+            }
+            for (size_t i = 0; i < sizeof (payload.counter); i++) {
+                value[Payload::kCounterOffset + i] = (uint8_t) (payload.counter >> (8 * i));
+            }
+            value[Payload::kFlagsOffset] = Payload::kVersionFlags | (payload.insertion ? Payload::kInsertionFlag : 0);
+
+            for (size_t i = 0; i < Payload::kSize; i++) {
+                value[i] ^= mask[i];
+            }
+            return value;
+        }
+
+        inline bool PayloadCodec::decode(const Payload::value_type& value, const uint8_t* mask, Payload& payload) {
+            uint8_t plain[Payload::kSize];
+            for (size_t i = 0; i < Payload::kSize; i++) {
+                plain[i] = value[i] ^ mask[i];
+            }
+
+            uint8_t padding = 0;
+            for (size_t i = Payload::kFlagsOffset + 1; i < Payload::kSize; i++) {
+                padding |= plain[i];
+            }
+            uint8_t flags = plain[Payload::kFlagsOffset];
+            if (padding != 0 || (flags & Payload::kVersionMask) != Payload::kVersionFlags || (flags & ~(Payload::kVersionMask | Payload::kInsertionFlag)) != 0) {
+                return false;
+            }
+
+            payload.id = 0;
+            for (size_t i = 0; i < sizeof (payload.id); i++) {
+                payload.id |= ((uint64_t) plain[Payload::kIdOffset + i]) << (8 * i);
+            }
+            payload.counter = 0;
+            for (size_t i = 0; i < sizeof (payload.counter); i++) {
+                payload.counter |= ((uint32_t) plain[Payload::kCounterOffset + i]) << (8 * i);
+            }
+            payload.insertion = (flags & Payload::kInsertionFlag) != 0;
+            return true;
+        }
+
+        inline uint32_t PayloadCodec::clear_counter(const Payload::value_type& value) {
+            uint32_t counter = 0;
+            for (size_t i = 0; i < sizeof (counter); i++) {
+                counter |= ((uint32_t) value[Payload::kCounterOffset + i]) << (8 * i);
+            }
+            return counter;
+        }
+    }
+}
@@ -0,0 +1,144 @@
+#pragma once
+
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace sse {
+    namespace sophos {
+
+        /*
+         * LRU cache of the results of the Sophos and Diana searches, keyed by
+         * the bytes of the search request (search token(s) and add count).
+         * An update of a keyword changes both, so the entries of a modified
+         * keyword are never hit again and just age out. The capacity bounds
+         * the number of cached results (an entry counts for at least one);
+         * 0 disables the cache. The calls are thread safe.
+         */
+        template <typename V>
+        class ResultCache {
+        public:
+            typedef V value_type;
+
+            struct Stats {
+                uint64_t hits;
+                uint64_t misses;
+                uint64_t evictions;
+                size_t entries;
+                size_t results;
+            };
+
+            explicit ResultCache(const size_t capacity = 0) : capacity_(capacity), size_(0), hits_(0), misses_(0), evictions_(0) {
+            }
+
+            bool enabled() const {
+                std::lock_guard<std::mutex> lock(mtx_);
+                return capacity_ > 0;
+            }
+
+            // shrinking evicts the least recently used entries
+            void set_capacity(const size_t capacity) {
+                std::lock_guard<std::mutex> lock(mtx_);
+                capacity_ = capacity;
+                evict(0);
+            }
+
+            // appends the cached results of key to out (any container of V)
+            template <typename C>
+            bool get(const std::string& key, C& out) {
+                std::lock_guard<std::mutex> lock(mtx_);
+                auto it = index_.find(key);
+                if (it == index_.end()) {
+                    misses_++;
+                    return false;
+                }
+                entries_.splice(entries_.begin(), entries_, it->second);
+                out.insert(out.end(), it->second->results.begin(), it->second->results.end());
+                hits_++;
+                return true;
+            }
+
+            // replaces the entry of key, if any; too large result sets are not kept
+            template <typename It>
+            void put(const std::string& key, It first, It last) {
+                std::vector<V> results(first, last);
+                const size_t cost = charge(results);
+
+                std::lock_guard<std::mutex> lock(mtx_);
+                erase_locked(key);
+                if (cost > capacity_) {
+                    return;
+                }
+                evict(cost);
+                entries_.push_front(Entry{key, std::move(results)});
+                index_[key] = entries_.begin();
+                size_ += cost;
+            }
+
+            void erase(const std::string& key) {
+                std::lock_guard<std::mutex> lock(mtx_);
+                erase_locked(key);
+            }
+
+            void clear() {
+                std::lock_guard<std::mutex> lock(mtx_);
+                entries_.clear();
+                index_.clear();
+                size_ = 0;
+            }
+
+            Stats stats() const {
+                std::lock_guard<std::mutex> lock(mtx_);
+                Stats s;
+                s.hits = hits_;
+                s.misses = misses_;
+                s.evictions = evictions_;
+                s.entries = entries_.size();
+                s.results = size_;
+                return s;
+            }
+
+        private:
+            struct Entry {
+                std::string key;
+                std::vector<V> results;
+            };
+
+            static size_t charge(const std::vector<V>& results) {
+                return results.empty() ? 1 : results.size();
+            }
+
+            void erase_locked(const std::string& key) {
+                auto it = index_.find(key);
+                if (it != index_.end()) {
+                    size_ -= charge(it->second->results);
+                    entries_.erase(it->second);
+                    index_.erase(it);
+                }
+            }
+
+            // makes room for cost more results
+            void evict(const size_t cost) {
+                while (!entries_.empty() && size_ + cost > capacity_) {
+                    size_ -= charge(entries_.back().results);
+                    index_.erase(entries_.back().key);
+                    entries_.pop_back();
+                    evictions_++;
+                }
+            }
+
+            mutable std::mutex mtx_;
+            std::list<Entry> entries_;
+            std::unordered_map<std::string, typename std::list<Entry>::iterator> index_;
+            size_t capacity_;
+            size_t size_;
+            uint64_t hits_;
+            uint64_t misses_;
+            uint64_t evictions_;
+        };
+    }
+}
@@ -44,6 +44,11 @@ namespace sse {
             
 //            options.table_factory.reset(rocksdb::NewCuckooTableFactory(cuckoo_options));
             
+            // keep the hot counters in memory between the flushes
+            rocksdb::BlockBasedTableOptions table_options;
+            table_options.block_cache = rocksdb::NewLRUCache(kBlockCacheSize);
+            options.table_factory.reset(rocksdb::NewBlockBasedTableFactory(table_options));
+            
             options.compression = rocksdb::kNoCompression;
             options.bottommost_compression = rocksdb::kDisableCompressionOption;
             
@@ -96,6 +101,13 @@ namespace sse {
             return s.ok();
         }
         
+        bool RocksDBCounter::get(const std::string &key, std::string &data) const
+        {
+            rocksdb::Status s = db_->Get(rocksdb::ReadOptions(), key, &data);
+
+            return s.ok();
+        }
+
         bool RocksDBCounter::get_and_increment(const std::string &key, uint32_t &val)
         {
 
@@ -179,6 +191,26 @@ namespace sse {
             return s.ok();
         }
 
+        bool RocksDBCounter::write(rocksdb::WriteBatch &batch)
+        {
+            rocksdb::Status s = db_->Write(rocksdb::WriteOptions(), &batch);
+            
+            if (!s.ok()) {
+                logger::log(logger::ERROR) << "Unable to write the batch in the database: " << s.ToString() << std::endl;
+            }
+            
+            return s.ok();
+        }
+        
+        void RocksDBCounter::for_each(const std::function<void(const std::string&, const std::string&)> &f) const
+        {
+            std::unique_ptr<rocksdb::Iterator> it(db_->NewIterator(rocksdb::ReadOptions()));
+            
+            for (it->SeekToFirst(); it->Valid(); it->Next()) {
+                f(it->key().ToString(), it->value().ToString());
+            }
+        }
+        
         inline void RocksDBCounter::flush(bool blocking)
         {
             rocksdb::FlushOptions options;
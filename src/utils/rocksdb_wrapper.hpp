@@ -24,11 +24,15 @@
 #include "utils.hpp"
 #include <stdlib.h>
 #include <rocksdb/db.h>
+#include <rocksdb/cache.h>
 #include <rocksdb/table.h>
 #include <rocksdb/memtablerep.h>
 #include <rocksdb/options.h>
+#include <rocksdb/write_batch.h>
 
+#include <functional>
 #include <list>
+#include <vector>
 #include <iostream>
 #include "Utilities.h"
 
@@ -60,6 +64,16 @@ namespace sse {
 
             inline bool remove(const uint8_t *key, const uint8_t key_length);
 
+            // Looks up the n consecutive keys with a single MultiGet, setting
+            // found[i] and values[i]. Returns the number of hits.
+            template <typename V>
+            inline size_t get_many(const uint8_t *keys, const uint8_t key_length, const size_t n, V *values, uint8_t *found) const;
+
+            // applies the batch atomically
+            inline bool write(rocksdb::WriteBatch &batch);
+
+            inline bool remove_many(const uint8_t *keys, const uint8_t key_length, const size_t n);
+
             inline void flush(bool blocking = true);
 
             inline uint64_t approximate_size() const;
@@ -226,6 +240,47 @@ namespace sse {
             return s.ok();
         }
 
+        template <typename V>
+        size_t RockDBWrapper::get_many(const uint8_t *keys, const uint8_t key_length, const size_t n, V *values, uint8_t *found) const {
+            std::vector<rocksdb::Slice> k_s;
+            std::vector<std::string> raw_values;
+
+            k_s.reserve(n);
+            for (size_t i = 0; i < n; i++) {
+                k_s.push_back(rocksdb::Slice(reinterpret_cast<const char*> (keys + i * key_length), key_length));
+            }
+
+            std::vector<rocksdb::Status> s = db_->MultiGet(rocksdb::ReadOptions(false, true), k_s, &raw_values);
+
+            size_t hits = 0;
+            for (size_t i = 0; i < n; i++) {
+                found[i] = s[i].ok();
+                if (found[i]) {
+                    ::memcpy(&values[i], raw_values[i].data(), sizeof (V));
+                    hits++;
+                }
+            }
+            return hits;
+        }
+
+        bool RockDBWrapper::write(rocksdb::WriteBatch &batch) {
+            rocksdb::Status s = db_->Write(rocksdb::WriteOptions(), &batch);
+
+            if (!s.ok()) {
+                logger::log(logger::ERROR) << "Unable to write batch in the database: " << s.ToString() << std::endl;
+            }
+            return s.ok();
+        }
+
+        bool RockDBWrapper::remove_many(const uint8_t *keys, const uint8_t key_length, const size_t n) {
+            rocksdb::WriteBatch batch;
+
+            for (size_t i = 0; i < n; i++) {
+                batch.Delete(rocksdb::Slice(reinterpret_cast<const char*> (keys + i * key_length), key_length));
+            }
+            return write(batch);
+        }
+
         void RockDBWrapper::flush(bool blocking) {
             rocksdb::FlushOptions options;
 
@@ -250,6 +305,8 @@ namespace sse {
 
         class RocksDBCounter {
         public:
+            static constexpr size_t kBlockCacheSize = 256 << 20;
+
             RocksDBCounter() = delete;
             RocksDBCounter(const std::string &path);
 
@@ -261,6 +318,9 @@ namespace sse {
 
             bool get(const std::string &key, uint32_t &val) const;
 
+            // raw value, for the records that are not a single counter
+            bool get(const std::string &key, std::string &data) const;
+
             bool get_and_increment(const std::string &key, uint32_t &val);
 
             bool increment(const std::string &key, uint32_t default_value = 0);
@@ -269,6 +329,12 @@ namespace sse {
 
             bool remove_key(const std::string &key);
 
+            // applies the puts and deletes of batch at once
+            bool write(rocksdb::WriteBatch &batch);
+
+            // calls f(key, raw value) for every entry, in key order
+            void for_each(const std::function<void(const std::string&, const std::string&)> &f) const;
+
             inline void flush(bool blocking = true);
 
             inline uint64_t approximate_size() const {
@@ -0,0 +1,258 @@
+#ifndef WORK_STEALING_POOL_H
+#define WORK_STEALING_POOL_H
+
+#include <vector>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <exception>
+#include <cstdint>
+#include <list>
+
+/*
+ * Long-lived pool running loops over an index space.
+ *
+ * Each worker starts with a contiguous share of the indices and consumes it
+ * from the front. Once its share is exhausted, it steals the back half of the
+ * largest remaining share, so uneven tasks still balance. The calling thread
+ * takes part as worker 0: a pool of size 1 never spawns threads, and loops
+ * with a single index run inline without waking the workers.
+ *
+ * Several threads can run loops at the same time: the idle workers spread
+ * over the open loops, and a worker moves to another open loop once the
+ * shares of its own are exhausted.
+ */
+class WorkStealingPool {
+public:
+    explicit WorkStealingPool(uint32_t threads);
+    ~WorkStealingPool();
+
+    uint32_t size() const {
+        return size_;
+    }
+
+    // Calls task(worker_id, i) for every i in [0, n) and returns when all the
+    // calls are done. Within a loop, two concurrent calls never get the same
+    // worker_id, which is smaller than size().
+    void parallel_for(size_t n, const std::function<void(uint32_t, size_t)> &task);
+
+private:
+
+    struct Share {
+        std::mutex mutex;
+        size_t begin;
+        size_t end;
+    };
+
+    // a running parallel_for
+    struct Loop {
+        Loop(uint32_t size, size_t n, const std::function<void(uint32_t, size_t)> *task);
+
+        const std::function<void(uint32_t, size_t)> *task;
+        std::unique_ptr<Share[]> shares;
+        // no more indices to hand out (protected by state_mutex_)
+        bool closed;
+        // threads in run() for this loop (protected by state_mutex_)
+        uint32_t active;
+        std::exception_ptr error;
+    };
+
+    void worker_loop(uint32_t id);
+    // the open loop worker id joins, nullptr if there is none (with state_mutex_)
+    Loop* next_loop(uint32_t id) const;
+    void run(uint32_t id, Loop &loop);
+    bool take(uint32_t id, Loop &loop, size_t &index);
+    bool steal(uint32_t id, Loop &loop);
+
+    uint32_t size_;
+    std::vector<std::thread> workers_;
+
+    std::mutex state_mutex_;
+    std::condition_variable start_cv_;
+    std::condition_variable done_cv_;
+    std::list<Loop*> loops_;
+    bool stop_;
+};
+
+inline WorkStealingPool::Loop::Loop(uint32_t size, size_t n, const std::function<void(uint32_t, size_t)> *task)
+: task(task), shares(new Share[size]), closed(false), active(0) {
+    for (uint32_t i = 0; i < size; i++) {
+        shares[i].begin = (n * i) / size;
+        shares[i].end = (n * (i + 1)) / size;
+    }
+}
+
+inline WorkStealingPool::WorkStealingPool(uint32_t threads)
+: size_(threads > 0 ? threads : 1), stop_(false) {
+    for (uint32_t i = 1; i < size_; i++) {
+        workers_.emplace_back(&WorkStealingPool::worker_loop, this, i);
+    }
+}
+
+inline WorkStealingPool::~WorkStealingPool() {
+    {
+        std::unique_lock<std::mutex> lock(state_mutex_);
+        stop_ = true;
+    }
+    start_cv_.notify_all();
+    for (std::thread &worker : workers_) {
+        if (worker.joinable()) {
+            worker.join();
+        }
+    }
+}
+
+inline void WorkStealingPool::parallel_for(size_t n, const std::function<void(uint32_t, size_t)> &task) {
+    if (n == 0) {
+        return;
+    }
+    if (size_ == 1 || n == 1) {
+        for (size_t i = 0; i < n; i++) {
+            task(0, i);
+        }
+        return;
+    }
+
+    Loop loop(size_, n, &task);
+    {
+        std::unique_lock<std::mutex> lock(state_mutex_);
+        loop.active = 1;
+        loops_.push_back(&loop);
+    }
+    start_cv_.notify_all();
+
+    run(0, loop);
+
+    {
+        std::unique_lock<std::mutex> lock(state_mutex_);
+        loop.closed = true;
+        loop.active--;
+        done_cv_.wait(lock, [&loop] {
+            return loop.active == 0;
+        });
+        loops_.remove(&loop);
+    }
+
+    if (loop.error) {
+        std::rethrow_exception(loop.error);
+    }
+}
+
+inline WorkStealingPool::Loop* WorkStealingPool::next_loop(uint32_t id) const {
+    std::vector<Loop*> open;
+    for (Loop* loop : loops_) {
+        if (!loop->closed) {
+            open.push_back(loop);
+        }
+    }
+    if (open.empty()) {
+        return nullptr;
+    }
+    return open[id % open.size()];
+}
+
+inline void WorkStealingPool::worker_loop(uint32_t id) {
+    for (;;) {
+        Loop* loop = nullptr;
+        {
+            std::unique_lock<std::mutex> lock(state_mutex_);
+            start_cv_.wait(lock, [this, id, &loop] {
+                return stop_ || (loop = next_loop(id)) != nullptr;
+            });
+            if (stop_) {
+                return;
+            }
+            loop->active++;
+        }
+
+        run(id, *loop);
+
+        {
+            std::unique_lock<std::mutex> lock(state_mutex_);
+            // run() only returns once every share was empty
+            loop->closed = true;
+            if (--loop->active == 0) {
+                done_cv_.notify_all();
+            }
+        }
+    }
+}
+
+inline void WorkStealingPool::run(uint32_t id, Loop &loop) {
+    size_t index;
+
+    try {
+        do {
+            while (take(id, loop, index)) {
+                (*loop.task)(id, index);
+            }
+        } while (steal(id, loop));
+    } catch (...) {
+        std::unique_lock<std::mutex> lock(state_mutex_);
+        if (!loop.error) {
+            loop.error = std::current_exception();
+        }
+        // drop the remaining work of this share
+        std::unique_lock<std::mutex> share_lock(loop.shares[id].mutex);
+        loop.shares[id].begin = loop.shares[id].end;
+    }
+}
+
+inline bool WorkStealingPool::take(uint32_t id, Loop &loop, size_t &index) {
+    Share &share = loop.shares[id];
+    std::unique_lock<std::mutex> lock(share.mutex);
+
+    if (share.begin == share.end) {
+        return false;
+    }
+    index = share.begin++;
+    return true;
+}
+
+inline bool WorkStealingPool::steal(uint32_t id, Loop &loop) {
+    Share* shares = loop.shares.get();
+
+    for (;;) {
+        // pick the largest share
+        uint32_t victim = id;
+        size_t victim_size = 0;
+
+        for (uint32_t i = 0; i < size_; i++) {
+            if (i == id) {
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(shares[i].mutex);
+            size_t remaining = shares[i].end - shares[i].begin;
+            if (remaining > victim_size) {
+                victim = i;
+                victim_size = remaining;
+            }
+        }
+
+        if (victim_size == 0) {
+            return false;
+        }
+
+        size_t begin, end;
+        {
+            std::unique_lock<std::mutex> lock(shares[victim].mutex);
+            if (shares[victim].begin == shares[victim].end) {
+                // someone was faster, try again
+                continue;
+            }
+            end = shares[victim].end;
+            begin = shares[victim].begin + (end - shares[victim].begin) / 2;
+            shares[victim].end = begin;
+        }
+        {
+            std::unique_lock<std::mutex> lock(shares[id].mutex);
+            shares[id].begin = begin;
+            shares[id].end = end;
+        }
+        return true;
+    }
+}
+
+#endif
@@ -0,0 +1,121 @@
+#include "utils/counter_store.hpp"
+#include "fides/sophos_client.hpp"
+
+#include <sse/crypto/utils.hpp>
+
+#include <iostream>
+#include <string>
+
+using namespace sse::sophos;
+using namespace std;
+
+// a Diana keyword state
+struct State {
+    uint32_t generation;
+    uint32_t insCount;
+    uint32_t delCount;
+};
+
+static bool operator!=(const State& a, const State& b) {
+    return a.generation != b.generation || a.insCount != b.insCount || a.delCount != b.delCount;
+}
+
+static const size_t kRecords = 1000;
+
+static RecordStore<uint32_t>::key_type key(size_t i) {
+    RecordStore<uint32_t>::key_type k;
+    k.fill(0x5a);
+    k[0] = (uint8_t) i;
+    k[7] = (uint8_t) (i >> 8);
+    return k;
+}
+
+static void value(size_t i, uint32_t& v) {
+    v = (uint32_t) (3 * i);
+}
+
+static void value(size_t i, State& v) {
+    v = State{(uint32_t) i, (uint32_t) (2 * i), (uint32_t) (i / 2)};
+}
+
+// Fills a store, overwrites the first hundred records (the RocksDB store keeps
+// them in its write-back table) and removes the last one, then writes its
+// snapshot and reads it back with kSnapshot. Returns the number of mismatches.
+template <typename V>
+static int round_trip(StoreBackend backend, const string& path, const string& snapshot_path) {
+    int errors = 0;
+    V v, expected;
+    {
+        auto store = RecordStore<V>::open(backend, path);
+        for (size_t i = 0; i < kRecords; i++) {
+            value(i, v);
+            store->set(key(i), v);
+        }
+        store->flush();
+        for (size_t i = 0; i < 100; i++) {
+            value(i + kRecords, v);
+            store->set(key(i), v);
+        }
+        store->remove(key(kRecords - 1));
+        store->write_snapshot(snapshot_path);
+    }
+
+    auto snapshot = RecordStore<V>::open(StoreBackend::kSnapshot, snapshot_path);
+    if (snapshot->size() != kRecords - 1) {
+        errors++;
+    }
+    for (size_t i = 0; i < kRecords - 1; i++) {
+        value(i < 100 ? i + kRecords : i, expected);
+        if (!snapshot->get(key(i), v) || v != expected) {
+            errors++;
+        }
+    }
+    if (snapshot->get(key(kRecords - 1), v) || snapshot->get(key(kRecords + 1), v)) {
+        errors++;
+    }
+    try {
+        snapshot->set(key(0), v);
+        errors++;
+    } catch (std::logic_error&) {
+    }
+    return errors;
+}
+
+// a search-only client on the snapshot of a client's counters sends the same
+// search requests
+static int client_round_trip() {
+    int errors = 0;
+    SophosClient client("counters_client.db", 10, StoreBackend::kRocksDB);
+    std::array<uint8_t, kUpdateTokenSize> index;
+    index.fill(0);
+    for (size_t i = 0; i < 10; i++) {
+        client.update_request("keyword" + to_string(i % 3), index);
+    }
+    client.write_counter_snapshot("counters_client.snap");
+
+    SophosClient reader("counters_client.snap", client.private_key(), client.master_derivation_key(), client.rsa_prg_key(), StoreBackend::kSnapshot);
+    for (size_t i = 0; i < 4; i++) {
+        SearchRequest a = client.search_request("keyword" + to_string(i));
+        SearchRequest b = reader.search_request("keyword" + to_string(i));
+        if (a.add_count != b.add_count || (a.add_count > 0 && (a.token != b.token || a.derivation_key != b.derivation_key))) {
+            errors++;
+        }
+    }
+    return errors;
+}
+
+int main(int, char**) {
+    sse::crypto::init_crypto_lib();
+
+    int errors = 0;
+    errors += round_trip<uint32_t>(StoreBackend::kMemory, "", "counters_memory.snap");
+    errors += round_trip<uint32_t>(StoreBackend::kRocksDB, "counters_rocksdb.db", "counters_rocksdb.snap");
+    errors += round_trip<State>(StoreBackend::kMemory, "", "states_memory.snap");
+    errors += round_trip<State>(StoreBackend::kRocksDB, "states_rocksdb.db", "states_rocksdb.snap");
+    errors += client_round_trip();
+
+    cout << (errors == 0 ? "Snapshot round trips OK" : "Snapshot round trips FAILED: " + to_string(errors) + " mismatches") << endl;
+
+    sse::crypto::cleanup_crypto_lib();
+    return errors == 0 ? 0 : 1;
+}
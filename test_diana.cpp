@@ -15,7 +15,9 @@ using namespace std;
 
 int main(int, char**) {
     bool usehdd=false,cleaningMode=true;
-    DianaInterface diana(usehdd, true, cleaningMode);
+    // the keyword states persist with the index, like the keys
+    sse::sophos::CounterStore::Backend stateBackend = usehdd ? sse::sophos::CounterStore::Backend::kRocksDB : sse::sophos::CounterStore::Backend::kMemory;
+    DianaInterface diana(usehdd, true, cleaningMode, stateBackend);
     diana.insertKeyword("test1",1);
     diana.insertKeyword("test1",2);
     diana.insertKeyword("test1",3);
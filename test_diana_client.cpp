@@ -20,7 +20,9 @@ using namespace std;
 
 int main(int argv, char** argc) {
     bool usehdd = false, cleaningMode = true;
-    DianaClientRunner diana_runner("localhost:4241", usehdd, cleaningMode);
+    // the keyword states persist with the index, like the keys
+    sse::sophos::CounterStore::Backend stateBackend = usehdd ? sse::sophos::CounterStore::Backend::kRocksDB : sse::sophos::CounterStore::Backend::kMemory;
+    DianaClientRunner diana_runner("localhost:4241", usehdd, cleaningMode, stateBackend);
     diana_runner.setup();
     diana_runner.insertKeyword("test1", 1);
     diana_runner.insertKeyword("test1", 2);
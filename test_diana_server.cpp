@@ -7,13 +7,16 @@
 #include <sse/crypto/utils.hpp>
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <csignal>
 #include <unistd.h>
 
 int main(int argc, char** argv) {
     sse::crypto::init_crypto_lib();
 
-    DianaServerRunner service;
+    // optional arguments: number of search threads (default: one per core)
+    // and capacity of the search result cache (default: disabled)
+    DianaServerRunner service(argc > 1 ? atoi(argv[1]) : 0, argc > 2 ? strtoul(argv[2], nullptr, 10) : 0);
 
     grpc::ServerBuilder builder;
     builder.AddListeningPort("0.0.0.0:4241", grpc::InsecureServerCredentials());
@@ -11,7 +11,9 @@ using namespace std;
 
 int main(int, char**) {
     bool usehdd = false, cleaningMode = true;
-    FidesClient fides(usehdd, cleaningMode);
+    // the counters persist with the index, like the keys
+    CounterStore::Backend counterBackend = usehdd ? CounterStore::Backend::kRocksDB : CounterStore::Backend::kMemory;
+    FidesClient fides(usehdd, cleaningMode, counterBackend);
     fides.insertKeyword("test1", 1);
     fides.insertKeyword("test1", 2);
     fides.insertKeyword("test1", 3);
@@ -21,7 +21,9 @@ using namespace std;
 
 int main(int argv, char** argc) {
     bool usehdd = false, cleaningMode = true;
-    FidesClientRunner fides_runner("localhost:4241", usehdd, cleaningMode);
+    // the counters persist with the index, like the keys
+    CounterStore::Backend counterBackend = usehdd ? CounterStore::Backend::kRocksDB : CounterStore::Backend::kMemory;
+    FidesClientRunner fides_runner("localhost:4241", usehdd, cleaningMode, counterBackend);
     fides_runner.setup();
     fides_runner.insertKeyword("test1", 1);
     fides_runner.insertKeyword("test1", 2);
@@ -7,13 +7,15 @@
 #include <sse/crypto/utils.hpp>
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <csignal>
 #include <unistd.h>
 
 int main(int argc, char** argv) {
     sse::crypto::init_crypto_lib();
 
-    FidesServerRunner service;
+    // optional argument: capacity of the search result cache (default: disabled)
+    FidesServerRunner service(argc > 1 ? strtoul(argv[1], nullptr, 10) : 0);
 
     grpc::ServerBuilder builder;
     builder.AddListeningPort("0.0.0.0:4241", grpc::InsecureServerCredentials());
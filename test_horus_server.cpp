@@ -0,0 +1,20 @@
+#include "horus/BucketStoreServerRunner.h"
+
+#include <grpc++/server.h>
+#include <grpc++/server_builder.h>
+
+#include <sse/crypto/utils.hpp>
+
+int main(int argc, char** argv) {
+    sse::crypto::init_crypto_lib();
+
+    BucketStoreServerRunner service;
+
+    grpc::ServerBuilder builder;
+    builder.AddListeningPort("0.0.0.0:4241", grpc::InsecureServerCredentials());
+    builder.RegisterService(&service);
+    std::unique_ptr<grpc::Server> server(builder.BuildAndStart());
+    server->Wait();
+    sse::crypto::cleanup_crypto_lib();
+    return 0;
+}
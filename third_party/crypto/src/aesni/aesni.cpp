@@ -2529,6 +2529,83 @@ S8 = _mm_aesenclast_si128(S8, K);
         
         
         
+        // Multi-key CTR: 8 independent keys, 2 blocks per key.
+        // The key schedules are computed on the fly and the 8 expansions are
+        // interleaved with the 16 encryptions to hide the aesenc latency.
+        
+#define MULTI_EXP_ENCRYPT_ROUND_8(K, I, S, Rcon) \
+for (int j = 0; j < 8; j++) { \
+KEYEXP_128(K[j], I[j], Rcon); \
+S[2*j] = _mm_aesenc_si128(S[2*j], K[j]); \
+S[2*j+1] = _mm_aesenc_si128(S[2*j+1], K[j]); \
+}
+        
+#define MULTI_EXP_ENCRYPT_ROUND_8_LAST(K, I, S) \
+for (int j = 0; j < 8; j++) { \
+KEYEXP_128(K[j], I[j], 0x36); \
+S[2*j] = _mm_aesenclast_si128(S[2*j], K[j]); \
+S[2*j+1] = _mm_aesenclast_si128(S[2*j+1], K[j]); \
+}
+        
+        void aesni_ctr2_multikey8(const uint64_t iv, const uint8_t* keys, uint8_t *out)
+        {
+            __m128i K[8], I[8], S[16], mask, R;
+            
+            mask = _mm_set_epi32(0x0c0f0e0d,0x0c0f0e0d,0x0c0f0e0d,0x0c0f0e0d);
+            
+            // load all the keys before anything is written:
+            // out is allowed to overlap keys
+            for (int j = 0; j < 8; j++) {
+                K[j] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(keys)+j);
+            }
+            
+            const __m128i ctr0 = _mm_set_epi64x(0x00, iv);
+            const __m128i ctr1 = _mm_set_epi64x(0x00, iv+1);
+            
+            // ROUND 0
+            for (int j = 0; j < 8; j++) {
+                S[2*j] = _mm_xor_si128(ctr0, K[j]);
+                S[2*j+1] = _mm_xor_si128(ctr1, K[j]);
+            }
+            
+            MULTI_EXP_ENCRYPT_ROUND_8(K, I, S, 0x01);
+            MULTI_EXP_ENCRYPT_ROUND_8(K, I, S, 0x02);
+            MULTI_EXP_ENCRYPT_ROUND_8(K, I, S, 0x04);
+            MULTI_EXP_ENCRYPT_ROUND_8(K, I, S, 0x08);
+            MULTI_EXP_ENCRYPT_ROUND_8(K, I, S, 0x10);
+            MULTI_EXP_ENCRYPT_ROUND_8(K, I, S, 0x20);
+            MULTI_EXP_ENCRYPT_ROUND_8(K, I, S, 0x40);
+            MULTI_EXP_ENCRYPT_ROUND_8(K, I, S, 0x80);
+            MULTI_EXP_ENCRYPT_ROUND_8(K, I, S, 0x1b);
+            MULTI_EXP_ENCRYPT_ROUND_8_LAST(K, I, S);
+            
+            // cleanup
+            for (int j = 0; j < 8; j++) {
+                K[j] = _mm_set_epi64x(0x00, 0x00);
+                I[j] = _mm_set_epi64x(0x00, 0x00);
+            }
+            
+            for (int j = 0; j < 16; j++) {
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(out)+j, S[j]);
+            }
+        }
+        
+        void aesni_ctr2_multikey(const uint64_t N, const uint64_t iv, const uint8_t* keys, uint8_t *out)
+        {
+            // go backwards: when out == keys, the outputs of the i-th key
+            // only overwrite keys that have already been processed
+            uint64_t i = N;
+            
+            while (i >= 8) {
+                i -= 8;
+                aesni_ctr2_multikey8(iv, keys + i*kAESBlockSize, out + 2*i*kAESBlockSize);
+            }
+            while (i > 0) {
+                i--;
+                aesni_ctr2(iv, keys + i*kAESBlockSize, out + 2*i*kAESBlockSize);
+            }
+        }
+        
         void aesni_ctr(const uint64_t N, const uint64_t iv, const aes_subkeys_type &subkeys, uint8_t *out)
         {
             uint64_t i = 0;
@@ -105,6 +105,11 @@ namespace sse
         
         aes_subkeys_type aesni_ctr_exp8(const uint64_t iv, const uint8_t* key, uint8_t *out);
 
+        // 2 CTR blocks (iv, iv+1) for each of the 8 (resp. N) consecutive keys
+        // out receives 32 bytes per key and may be equal to keys
+        void aesni_ctr2_multikey8(const uint64_t iv, const uint8_t* keys, uint8_t *out);
+        void aesni_ctr2_multikey(const uint64_t N, const uint64_t iv, const uint8_t* keys, uint8_t *out);
+
         void aesni_ctr(const uint64_t N, const uint64_t iv, const aes_subkeys_type &subkeys, uint8_t *out);
         void aesni_ctr(const uint64_t N, const uint64_t iv, const uint8_t* key, uint8_t *out);
 
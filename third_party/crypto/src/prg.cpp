@@ -159,6 +159,22 @@ namespace sse
             Prg::PrgImpl::derive(k, offset, len, out);
         }
 
+        void Prg::derive_batch(const uint8_t* keys, const size_t count, unsigned char* out)
+        {
+            if (keys == NULL) {
+                throw std::invalid_argument("PRG input keys are NULL");
+            }
+            
+#if USE_AESNI
+            aesni_ctr2_multikey(count, 0, keys, out);
+#else
+            // go backwards to allow in place expansion
+            for (size_t i = count; i > 0; i--) {
+                Prg::PrgImpl::derive(keys+(i-1)*kKeySize, 0, kBatchOutputSize, out+(i-1)*kBatchOutputSize);
+            }
+#endif
+        }
+
         std::string Prg::derive(const std::array<uint8_t,Prg::kKeySize>& k, const size_t len)
         {
             unsigned char *data = new unsigned char[len];
@@ -71,6 +71,14 @@ namespace sse
             static void derive(const uint8_t* k, const uint32_t offset, const size_t len, unsigned char* out);
 
             template <size_t N> static inline void derive(const std::array<uint8_t,kKeySize>& k, const uint32_t offset, std::array<uint8_t, N> &out);
+
+            // Batch derivation: for each of the count consecutive keys, write
+            // the first kBatchOutputSize bytes of its stream (i.e. the same
+            // as derive(k_i, 0, kBatchOutputSize, out+i*kBatchOutputSize)).
+            // Keys are processed 8 at a time. out can be equal to keys, in
+            // which case the keys are expanded in place.
+            static constexpr uint8_t kBatchOutputSize = 2*kKeySize;
+            static void derive_batch(const uint8_t* keys, const size_t count, unsigned char* out);
             
             static std::string derive(const std::array<uint8_t,kKeySize>& k, const size_t len);
             static void derive(const std::array<uint8_t,kKeySize>& k, const uint32_t offset, const size_t len, std::string &out);
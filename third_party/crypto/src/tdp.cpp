@@ -24,9 +24,11 @@
 #include "random.hpp"
 
 #include <cstring>
+#include <algorithm>
 #include <exception>
 #include <iostream>
 #include <iomanip>
+#include <vector>
 
 #include <openssl/rsa.h>
 #include <openssl/bio.h>
@@ -42,8 +44,12 @@ namespace crypto
     
 static_assert(Tdp::kMessageSize == TdpInverse::kMessageSize, "Constants kMessageSize of Tdp and TdpInverse do not match");
 
-#define RSA_MODULUS_SIZE TdpInverse::kMessageSize*8
-#define RSA_PK RSA_3
+#define RSA_MODULUS_SIZE Tdp::kModulusBits
+
+constexpr size_t Tdp::kModulusBits;
+constexpr size_t Tdp::kMessageSize;
+constexpr uint32_t Tdp::kDefaultPublicExponent;
+constexpr TdpBackend Tdp::kDefaultBackend;
 
     
 class TdpImpl
@@ -83,7 +89,11 @@ protected:
 class TdpInverseImpl : public TdpImpl
 {
 public:
+    // bits of the inversion orders
+    static constexpr size_t kOrderBits = 32;
+    
     TdpInverseImpl();
+    TdpInverseImpl(const uint32_t public_exponent);
     TdpInverseImpl(const std::string& sk);
     TdpInverseImpl(const TdpInverseImpl& tdp);
     ~TdpInverseImpl();
@@ -95,8 +105,20 @@ public:
     std::array<uint8_t, kMessageSpaceSize> invert_mult(const std::array<uint8_t, kMessageSpaceSize> &in, uint32_t order) const;
     void invert_mult(const std::string &in, std::string &out, uint32_t order) const;
     
+    void set_backend(const TdpBackend backend);
+    TdpBackend backend() const;
+    
 private:
+    void init_crt();
+    
     BIGNUM *phi_, *p_1_, *q_1_;
+    
+    TdpBackend backend_;
+    // Montgomery contexts of p and q
+    BN_MONT_CTX *mont_p_, *mont_q_;
+    // dP^(2^i) mod p-1 and dQ^(2^i) mod q-1: raising them to an order only
+    // takes a multiplication per bit set
+    BIGNUM *dp_pows_[kOrderBits], *dq_pows_[kOrderBits];
 };
 
 class TdpMultPoolImpl : public TdpImpl
@@ -109,14 +131,60 @@ public:
     
     std::array<uint8_t, TdpImpl::kMessageSpaceSize> eval(const std::array<uint8_t, kMessageSpaceSize> &in, const uint8_t order) const;
     void eval(const std::string &in, std::string &out, const uint8_t order) const;
+    void eval_chain(const std::array<uint8_t, kMessageSpaceSize> &in, const uint8_t order, const size_t count, std::array<uint8_t, kMessageSpaceSize> *out) const;
 
     uint8_t maximum_order() const;
     uint8_t pool_size() const;
+    
+    void set_backend(const TdpBackend backend);
+    TdpBackend backend() const;
 private:
+    static constexpr int kMaxWindowBits = 6;
+    
+    // fixed-window decomposition of an exponent, most significant digit first
+    struct ExpWindows
+    {
+        int bits;
+        std::vector<uint8_t> digits;
+        // largest digit: the powers of the base are precomputed up to it
+        uint8_t max_digit;
+        
+        // in modular multiplications
+        size_t cost() const;
+    };
+    
+    void init_mont_ctx();
+    void init_windows();
+    const BIGNUM* exponent(const uint8_t order) const;
+    // r = a^e, with a and r in Montgomery form
+    void mont_exp(BIGNUM *r, const BIGNUM *a, const ExpWindows &windows, BN_CTX *ctx) const;
+    
     RSA **keys_;
     uint8_t keys_count_;
+    BN_MONT_CTX *mont_ctx_;
+    TdpBackend backend_;
+    // windows of e^order, at index order-1
+    std::vector<ExpWindows> windows_;
 };
 
+static void split_windows(const BIGNUM *e, const int bits, std::vector<uint8_t> &digits, uint8_t &max_digit)
+{
+    const int e_bits = BN_num_bits(e);
+    
+    digits.resize((size_t)((e_bits + bits - 1) / bits));
+    max_digit = 0;
+    
+    // the least significant digit is at the end
+    for (size_t i = 0; i < digits.size(); i++) {
+        uint8_t digit = 0;
+        for (int b = bits - 1; b >= 0; b--) {
+            digit = (uint8_t)((digit << 1) | BN_is_bit_set(e, (int)(i * bits) + b));
+        }
+        digits[digits.size() - 1 - i] = digit;
+        max_digit = std::max(max_digit, digit);
+    }
+}
+
 TdpImpl::TdpImpl() : rsa_key_(NULL)
 {
 }
@@ -147,6 +215,11 @@ TdpImpl::TdpImpl(const std::string& pk) : rsa_key_(NULL)
         // always returns 1 ...
     }
     BIO_free(mem);
+    
+    if(rsa_size() != kMessageSpaceSize)
+    {
+        throw std::invalid_argument("Invalid RSA key: the modulus size does not match the TDP message size.");
+    }
 }
     
 TdpImpl::TdpImpl(const TdpImpl& tdp)
@@ -346,19 +419,27 @@ std::array<uint8_t, TdpImpl::kMessageSpaceSize> TdpImpl::generate_array(const st
     return generate_array(prg, seed);
 }
 
-TdpInverseImpl::TdpInverseImpl()
+TdpInverseImpl::TdpInverseImpl() : TdpInverseImpl(Tdp::kDefaultPublicExponent)
+{
+}
+
+TdpInverseImpl::TdpInverseImpl(const uint32_t public_exponent) : backend_(Tdp::kDefaultBackend)
 {
     int ret;
     
+    if(public_exponent != 3 && public_exponent != 65537)
+    {
+        throw std::invalid_argument("Invalid RSA public exponent. It should be 3 or 65537.");
+    }
+    
     // initialize the key
     set_rsa_key(RSA_new());
     
     // generate a new random key
     
-    unsigned long e = RSA_PK;
     BIGNUM *bne = NULL;
     bne = BN_new();
-    ret = BN_set_word(bne, e);
+    ret = BN_set_word(bne, public_exponent);
     if(ret != 1)
     {
         throw std::runtime_error("Invalid BIGNUM initialization."); /* LCOV_EXCL_LINE */
@@ -370,22 +451,11 @@ TdpInverseImpl::TdpInverseImpl()
         throw std::runtime_error("Invalid RSA key generation."); /* LCOV_EXCL_LINE */
     }
     
-    // initialize the useful variables
-    phi_ = BN_new();
-    p_1_ = BN_dup(get_rsa_key()->p);
-    q_1_ = BN_dup(get_rsa_key()->q);
-    BN_sub_word(p_1_, 1);
-    BN_sub_word(q_1_, 1);
-    
-    BN_CTX* ctx = BN_CTX_new();
-
-    BN_mul(phi_, p_1_, q_1_, ctx);
-
-    BN_CTX_free(ctx);
+    init_crt();
     BN_free(bne);
 }
 
-TdpInverseImpl::TdpInverseImpl(const std::string& sk)
+TdpInverseImpl::TdpInverseImpl(const std::string& sk) : backend_(Tdp::kDefaultBackend)
 {
     // create a BIO from the std::string
     BIO *mem;
@@ -419,41 +489,72 @@ TdpInverseImpl::TdpInverseImpl(const std::string& sk)
     
     BIO_free(mem);
     
-    // initialize the useful variables
-    phi_ = BN_new();
-    p_1_ = BN_dup(get_rsa_key()->p);
-    q_1_ = BN_dup(get_rsa_key()->q);
-    BN_sub_word(p_1_, 1);
-    BN_sub_word(q_1_, 1);
+    if(rsa_size() != kMessageSpaceSize)
+    {
+        throw std::invalid_argument("Invalid RSA key: the modulus size does not match the TDP message size.");
+    }
     
-    BN_CTX* ctx = BN_CTX_new();
-    BN_mul(phi_, p_1_, q_1_, ctx);
-    BN_CTX_free(ctx);
+    init_crt();
 }
 
-TdpInverseImpl::TdpInverseImpl(const TdpInverseImpl& tdp)
+TdpInverseImpl::TdpInverseImpl(const TdpInverseImpl& tdp) : backend_(tdp.backend_)
 {
     set_rsa_key(RSAPrivateKey_dup(tdp.rsa_key_));
 
+    init_crt();
+}
+    
+TdpInverseImpl::~TdpInverseImpl()
+{
+    BN_free(phi_);
+    BN_free(p_1_);
+    BN_free(q_1_);
+    BN_MONT_CTX_free(mont_p_);
+    BN_MONT_CTX_free(mont_q_);
+    for (size_t i = 0; i < kOrderBits; i++) {
+        BN_clear_free(dp_pows_[i]);
+        BN_clear_free(dq_pows_[i]);
+    }
+}
+
+void TdpInverseImpl::init_crt()
+{
+    BN_CTX* ctx = BN_CTX_new();
+    
     // initialize the useful variables
     phi_ = BN_new();
     p_1_ = BN_dup(get_rsa_key()->p);
     q_1_ = BN_dup(get_rsa_key()->q);
     BN_sub_word(p_1_, 1);
     BN_sub_word(q_1_, 1);
-
-    BN_CTX* ctx = BN_CTX_new();
-
+    
     BN_mul(phi_, p_1_, q_1_, ctx);
     
+    mont_p_ = BN_MONT_CTX_new();
+    mont_q_ = BN_MONT_CTX_new();
+    BN_MONT_CTX_set(mont_p_, get_rsa_key()->p, ctx);
+    BN_MONT_CTX_set(mont_q_, get_rsa_key()->q, ctx);
+    
+    dp_pows_[0] = BN_dup(get_rsa_key()->dmp1);
+    dq_pows_[0] = BN_dup(get_rsa_key()->dmq1);
+    for (size_t i = 1; i < kOrderBits; i++) {
+        dp_pows_[i] = BN_new();
+        dq_pows_[i] = BN_new();
+        BN_mod_sqr(dp_pows_[i], dp_pows_[i-1], p_1_, ctx);
+        BN_mod_sqr(dq_pows_[i], dq_pows_[i-1], q_1_, ctx);
+    }
+    
     BN_CTX_free(ctx);
 }
-    
-TdpInverseImpl::~TdpInverseImpl()
+
+void TdpInverseImpl::set_backend(const TdpBackend backend)
 {
-    BN_free(phi_);
-    BN_free(p_1_);
-    BN_free(q_1_);
+    backend_ = backend;
+}
+
+TdpBackend TdpInverseImpl::backend() const
+{
+    return backend_;
 }
 
 std::string TdpInverseImpl::private_key() const
@@ -530,6 +631,10 @@ std::array<uint8_t, TdpInverseImpl::kMessageSpaceSize> TdpInverseImpl::invert_mu
     if (order == 0) {
         return in;
     }
+    if (order == 1 && backend_ == TdpBackend::kMontgomery) {
+        // RSA_private_decrypt already is a CRT with dP and dQ
+        return invert(in);
+    }
     
     std::array<uint8_t, TdpImpl::kMessageSpaceSize> out;
     
@@ -543,10 +648,6 @@ std::array<uint8_t, TdpInverseImpl::kMessageSpaceSize> TdpInverseImpl::invert_mu
     BIGNUM *bn_order = BN_new();
     BIGNUM *d_p = BN_new();
     BIGNUM *d_q = BN_new();
-    BN_set_word(bn_order, order);
-    
-    BN_mod_exp(d_p, get_rsa_key()->d, bn_order, p_1_, ctx);
-    BN_mod_exp(d_q, get_rsa_key()->d, bn_order, q_1_, ctx);
     
     BIGNUM *x = BN_new();
     BN_bin2bn(in.data(), (unsigned int)in.size(), x);
@@ -556,8 +657,38 @@ std::array<uint8_t, TdpInverseImpl::kMessageSpaceSize> TdpInverseImpl::invert_mu
     BIGNUM *h = BN_new();
     BIGNUM *y = BN_new();
     
-    BN_mod_exp(y_p,x,d_p, get_rsa_key()->p, ctx);
-    BN_mod_exp(y_q,x,d_q, get_rsa_key()->q, ctx);
+    if (backend_ == TdpBackend::kMontgomery) {
+        // d^order = dP^order mod p-1 (resp. q-1): multiply the precomputed
+        // powers of the bits set in order
+        bool first = true;
+        for (size_t i = 0; i < kOrderBits; i++) {
+            if (((order >> i) & 1) == 0) {
+                continue;
+            }
+            if (first) {
+                BN_copy(d_p, dp_pows_[i]);
+                BN_copy(d_q, dq_pows_[i]);
+                first = false;
+            }else{
+                BN_mod_mul(d_p, d_p, dp_pows_[i], p_1_, ctx);
+                BN_mod_mul(d_q, d_q, dq_pows_[i], q_1_, ctx);
+            }
+        }
+        
+        // the contexts of p and q are not rebuilt at every call
+        BN_nnmod(y_p, x, get_rsa_key()->p, ctx);
+        BN_nnmod(y_q, x, get_rsa_key()->q, ctx);
+        BN_mod_exp_mont(y_p, y_p, d_p, get_rsa_key()->p, ctx, mont_p_);
+        BN_mod_exp_mont(y_q, y_q, d_q, get_rsa_key()->q, ctx, mont_q_);
+    }else{
+        BN_set_word(bn_order, order);
+        
+        BN_mod_exp(d_p, get_rsa_key()->d, bn_order, p_1_, ctx);
+        BN_mod_exp(d_q, get_rsa_key()->d, bn_order, q_1_, ctx);
+        
+        BN_mod_exp(y_p,x,d_p, get_rsa_key()->p, ctx);
+        BN_mod_exp(y_q,x,d_q, get_rsa_key()->q, ctx);
+    }
     
     BN_mod_sub(h, y_p, y_q, get_rsa_key()->p, ctx);
     BN_mod_mul(h, h, get_rsa_key()->iqmp, get_rsa_key()->p, ctx);
@@ -573,8 +704,8 @@ std::array<uint8_t, TdpInverseImpl::kMessageSpaceSize> TdpInverseImpl::invert_mu
     BN_bn2bin(y, out.data()+pos);
     
     BN_free(bn_order);
-    BN_free(d_p);
-    BN_free(d_q);
+    BN_clear_free(d_p);
+    BN_clear_free(d_q);
     BN_free(y_p);
     BN_free(y_q);
     BN_free(h);
@@ -598,7 +729,7 @@ void TdpInverseImpl::invert_mult(const std::string &in, std::string &out, uint32
 
 
 TdpMultPoolImpl::TdpMultPoolImpl(const std::string& sk, const uint8_t size)
-: TdpImpl(sk), keys_count_(size-1)
+: TdpImpl(sk), keys_count_(size-1), backend_(Tdp::kDefaultBackend)
 {
     if (size == 0) {
         throw std::invalid_argument("Invalid Multiple TDP pool input size. Pool size should be > 0.");
@@ -606,19 +737,21 @@ TdpMultPoolImpl::TdpMultPoolImpl(const std::string& sk, const uint8_t size)
     
     keys_ = new RSA* [keys_count_];
     
-    keys_[0] = RSAPublicKey_dup(get_rsa_key());
-    BN_mul_word(keys_[0]->e, RSA_PK);
-
-    for (uint8_t i = 1; i < keys_count_; i++) {
+    // the key of order i+2 has the public exponent e^(i+2)
+    BN_CTX* ctx = BN_CTX_new();
+    for (uint8_t i = 0; i < keys_count_; i++) {
         
-        keys_[i] = RSAPublicKey_dup(keys_[i-1]);
-        BN_mul_word(keys_[i]->e, RSA_PK);
+        keys_[i] = RSAPublicKey_dup((i == 0) ? get_rsa_key() : keys_[i-1]);
+        BN_mul(keys_[i]->e, keys_[i]->e, get_rsa_key()->e, ctx);
     }
+    BN_CTX_free(ctx);
     
+    init_mont_ctx();
+    init_windows();
 }
 
 TdpMultPoolImpl::TdpMultPoolImpl(const TdpMultPoolImpl& pool_impl)
-: TdpImpl(pool_impl), keys_count_(pool_impl.keys_count_)
+: TdpImpl(pool_impl), keys_count_(pool_impl.keys_count_), backend_(pool_impl.backend_), windows_(pool_impl.windows_)
 {
     keys_ = new RSA* [keys_count_];
     
@@ -627,6 +760,7 @@ TdpMultPoolImpl::TdpMultPoolImpl(const TdpMultPoolImpl& pool_impl)
         keys_[i] = RSAPublicKey_dup(pool_impl.keys_[i]);
     }
 
+    init_mont_ctx();
 }
     
 TdpMultPoolImpl::~TdpMultPoolImpl()
@@ -635,13 +769,112 @@ TdpMultPoolImpl::~TdpMultPoolImpl()
         RSA_free(keys_[i]);
     }
     delete [] keys_;
+    BN_MONT_CTX_free(mont_ctx_);
+}
+
+void TdpMultPoolImpl::init_mont_ctx()
+{
+    BN_CTX* ctx = BN_CTX_new();
+    mont_ctx_ = BN_MONT_CTX_new();
+    BN_MONT_CTX_set(mont_ctx_, get_rsa_key()->n, ctx);
+    BN_CTX_free(ctx);
+}
+
+size_t TdpMultPoolImpl::ExpWindows::cost() const
+{
+    size_t nonzero = (size_t)std::count_if(digits.begin(), digits.end(), [](uint8_t d) { return d != 0; });
+    
+    return (max_digit - 1) + (nonzero - 1) + (digits.size() - 1) * (size_t)bits;
+}
+
+void TdpMultPoolImpl::init_windows()
+{
+    windows_.resize(maximum_order());
+    
+    // the exponents are public and known in advance: pick the window size
+    // of each one by counting its multiplications
+    for (size_t order = 1; order <= maximum_order(); order++) {
+        const BIGNUM *e = exponent((uint8_t)order);
+        ExpWindows &best = windows_[order-1];
+        ExpWindows w;
+        
+        for (w.bits = 1; w.bits <= kMaxWindowBits; w.bits++) {
+            split_windows(e, w.bits, w.digits, w.max_digit);
+            
+            if (w.bits == 1 || w.cost() < best.cost()) {
+                best = w;
+            }
+        }
+    }
+}
+
+const BIGNUM* TdpMultPoolImpl::exponent(const uint8_t order) const
+{
+    return (order == 1) ? get_rsa_key()->e : keys_[order-2]->e;
+}
+
+void TdpMultPoolImpl::mont_exp(BIGNUM *r, const BIGNUM *a, const ExpWindows &windows, BN_CTX *ctx) const
+{
+    // table[k] = a^(k+1)
+    BIGNUM *table[(1 << kMaxWindowBits) - 1];
+    const size_t table_size = windows.max_digit;
+    
+    BN_CTX_start(ctx);
+    table[0] = BN_CTX_get(ctx);
+    BN_copy(table[0], a);
+    for (size_t k = 1; k < table_size; k++) {
+        table[k] = BN_CTX_get(ctx);
+        BN_mod_mul_montgomery(table[k], table[k-1], a, mont_ctx_, ctx);
+    }
+    
+    // the leading digit is never 0
+    BN_copy(r, table[windows.digits[0]-1]);
+    for (size_t i = 1; i < windows.digits.size(); i++) {
+        for (int b = 0; b < windows.bits; b++) {
+            BN_mod_mul_montgomery(r, r, r, mont_ctx_, ctx);
+        }
+        if (windows.digits[i] != 0) {
+            BN_mod_mul_montgomery(r, r, table[windows.digits[i]-1], mont_ctx_, ctx);
+        }
+    }
+    BN_CTX_end(ctx);
 }
 
 std::array<uint8_t, TdpImpl::kMessageSpaceSize> TdpMultPoolImpl::eval(const std::array<uint8_t, kMessageSpaceSize> &in, const uint8_t order) const
 {
     std::array<uint8_t, TdpImpl::kMessageSpaceSize> out;
 
-    if (order == 1) {
+    if (backend_ == TdpBackend::kMontgomery) {
+        if (order == 0 || order > maximum_order()) {
+            throw std::invalid_argument("Invalid order for this TDP pool. The input order must be less than the maximum order supported by the pool, and strictly positive.");
+        }
+        
+        BN_CTX* ctx = BN_CTX_new();
+        BIGNUM *x = BN_new();
+        BIGNUM *y = BN_new();
+        
+        BN_bin2bn(in.data(), (unsigned int)in.size(), x);
+        if (BN_ucmp(x, get_rsa_key()->n) >= 0) {
+            BN_free(x);
+            BN_free(y);
+            BN_CTX_free(ctx);
+            throw std::invalid_argument("Invalid TDP input. The input must be smaller than the RSA modulus.");
+        }
+        
+        BN_to_montgomery(x, x, mont_ctx_, ctx);
+        mont_exp(y, x, windows_[order-1], ctx);
+        BN_from_montgomery(y, y, mont_ctx_, ctx);
+        
+        // bn2bin returns a BIG endian array, so be careful ...
+        size_t pos = kMessageSpaceSize - BN_num_bytes(y);
+        // set the leading bytes to 0
+        std::fill(out.begin(), out.begin()+pos, 0);
+        BN_bn2bin(y, out.data()+pos);
+        
+        BN_free(x);
+        BN_free(y);
+        BN_CTX_free(ctx);
+    }else if (order == 1) {
         // regular eval
         RSA_public_encrypt((int)in.size(), (const unsigned char*)in.data(), out.data(), get_rsa_key(), RSA_NO_PADDING);
 
@@ -656,6 +889,55 @@ std::array<uint8_t, TdpImpl::kMessageSpaceSize> TdpMultPoolImpl::eval(const std:
 }
 
 
+void TdpMultPoolImpl::eval_chain(const std::array<uint8_t, kMessageSpaceSize> &in, const uint8_t order, const size_t count, std::array<uint8_t, kMessageSpaceSize> *out) const
+{
+    if (order == 0 || order > maximum_order()) {
+        throw std::invalid_argument("Invalid order for this TDP pool. The input order must be less than the maximum order supported by the pool, and strictly positive.");
+    }
+    if (count == 0) {
+        return;
+    }
+    
+    const BIGNUM *e = exponent(order);
+    
+    // the intermediate values stay as bignums, and all the steps share the
+    // same contexts (RSA_public_encrypt sets them up at every call)
+    BN_CTX* ctx = BN_CTX_new();
+    BIGNUM *x = BN_new();
+    BIGNUM *y = BN_new();
+    BIGNUM *z = BN_new();
+    
+    BN_bin2bn(in.data(), (unsigned int)in.size(), x);
+    
+    if (backend_ == TdpBackend::kMontgomery) {
+        // the chain stays in Montgomery form
+        BN_to_montgomery(x, x, mont_ctx_, ctx);
+    }
+    
+    for (size_t i = 0; i < count; i++) {
+        if (backend_ == TdpBackend::kMontgomery) {
+            mont_exp(y, x, windows_[order-1], ctx);
+            BN_swap(x, y);
+            BN_from_montgomery(z, x, mont_ctx_, ctx);
+        }else{
+            BN_mod_exp_mont(y, x, e, get_rsa_key()->n, ctx, mont_ctx_);
+            BN_swap(x, y);
+            BN_copy(z, x);
+        }
+        
+        // bn2bin returns a BIG endian array, so be careful ...
+        size_t pos = kMessageSpaceSize - BN_num_bytes(z);
+        // set the leading bytes to 0
+        std::fill(out[i].begin(), out[i].begin()+pos, 0);
+        BN_bn2bin(z, out[i].data()+pos);
+    }
+    
+    BN_free(x);
+    BN_free(y);
+    BN_free(z);
+    BN_CTX_free(ctx);
+}
+
 void TdpMultPoolImpl::eval(const std::string &in, std::string &out, const uint8_t order) const
 {
     if(in.size() != rsa_size())
@@ -681,6 +963,16 @@ uint8_t TdpMultPoolImpl::pool_size() const
     return keys_count_+1;
 }
 
+void TdpMultPoolImpl::set_backend(const TdpBackend backend)
+{
+    backend_ = backend;
+}
+
+TdpBackend TdpMultPoolImpl::backend() const
+{
+    return backend_;
+}
+
 
 Tdp::Tdp(const std::string& sk) : tdp_imp_(new TdpImpl(sk))
 {
@@ -762,6 +1054,10 @@ TdpInverse::TdpInverse() : tdp_inv_imp_(new TdpInverseImpl())
 {
 }
 
+TdpInverse::TdpInverse(const uint32_t public_exponent) : tdp_inv_imp_(new TdpInverseImpl(public_exponent))
+{
+}
+
 TdpInverse::TdpInverse(const std::string& sk) : tdp_inv_imp_(new TdpInverseImpl(sk))
 {
 }
@@ -877,6 +1173,16 @@ std::array<uint8_t, TdpInverse::kMessageSize> TdpInverse::invert_mult(const std:
     return tdp_inv_imp_->invert_mult(in, order);
 }
 
+void TdpInverse::set_backend(const TdpBackend backend)
+{
+    tdp_inv_imp_->set_backend(backend);
+}
+
+TdpBackend TdpInverse::backend() const
+{
+    return tdp_inv_imp_->backend();
+}
+
 TdpMultPool::TdpMultPool(const std::string& pk, const uint8_t size) : tdp_pool_imp_(new TdpMultPoolImpl(pk, size))
 {
 }
@@ -954,22 +1260,28 @@ std::array<uint8_t, Tdp::kMessageSize> TdpMultPool::eval(const std::array<uint8_
     return tdp_pool_imp_->eval(in, order);
 }
     
+// the order 1 evaluation of the pool follows its backend
 void TdpMultPool::eval(const std::string &in, std::string &out) const
 {
-    static_cast<TdpImpl*>(tdp_pool_imp_)->eval(in, out);
+    tdp_pool_imp_->eval(in, out, 1);
 }
 
 std::string TdpMultPool::eval(const std::string &in) const
 {
     std::string out;
-    static_cast<TdpImpl*>(tdp_pool_imp_)->eval(in, out);
+    tdp_pool_imp_->eval(in, out, 1);
     
     return out;
 }
 
+void TdpMultPool::eval_chain(const std::array<uint8_t, kMessageSize> &in, uint8_t order, size_t count, std::array<uint8_t, kMessageSize> *out) const
+{
+    tdp_pool_imp_->eval_chain(in, order, count, out);
+}
+
 std::array<uint8_t, Tdp::kMessageSize> TdpMultPool::eval(const std::array<uint8_t, kMessageSize> &in) const
 {
-    return static_cast<TdpImpl*>(tdp_pool_imp_)->eval(in);
+    return tdp_pool_imp_->eval(in, 1);
 }
 
 uint8_t TdpMultPool::maximum_order() const
@@ -982,5 +1294,15 @@ uint8_t TdpMultPool::pool_size() const
     return tdp_pool_imp_->pool_size();
 }
 
+void TdpMultPool::set_backend(const TdpBackend backend)
+{
+    tdp_pool_imp_->set_backend(backend);
+}
+
+TdpBackend TdpMultPool::backend() const
+{
+    return tdp_pool_imp_->backend();
+}
+
 }
 }
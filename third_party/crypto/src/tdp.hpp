@@ -28,6 +28,16 @@
 #include <array>
 #include <string>
 
+// Size of the RSA modulus, in bits: 2048 (default), 3072 or 4096.
+// It fixes the size of the messages, and of everything built on them, so the
+// library and the code using it must be compiled with the same value (the
+// tdp_modulus scons option).
+#ifndef SSE_CRYPTO_TDP_MODULUS_BITS
+#define SSE_CRYPTO_TDP_MODULUS_BITS 2048
+#endif
+
+static_assert(SSE_CRYPTO_TDP_MODULUS_BITS == 2048 || SSE_CRYPTO_TDP_MODULUS_BITS == 3072 || SSE_CRYPTO_TDP_MODULUS_BITS == 4096, "Unsupported RSA modulus size");
+
 namespace sse
 {
 namespace crypto
@@ -37,6 +47,24 @@ class TdpImpl; // not defined in the header
 class TdpInverseImpl; // not defined in the header
 class TdpMultPoolImpl; // not defined in the header
 
+/*****
+* TdpBackend
+*
+* Implementation of the RSA exponentiations, chosen at runtime:
+*  - kOpenSSL: RSA_public_encrypt and RSA_private_decrypt, and BN_mod_exp
+*    for the inversions of higher order;
+*  - kMontgomery: fixed-window Montgomery exponentiation by the public
+*    exponent (windows chosen once per order) for the evaluations, and CRT
+*    with precomputed powers of dP/dQ and Montgomery contexts for invert_mult
+*    (invert stays on RSA_private_decrypt, already a CRT).
+* Both backends give the same results.
+******/
+
+enum class TdpBackend {
+    kOpenSSL,
+    kMontgomery
+};
+
 /*****
 * Tdp class
 *
@@ -47,7 +75,11 @@ class TdpMultPoolImpl; // not defined in the header
 
 class Tdp{
 public:
-    static constexpr size_t kMessageSize = 256;
+    static constexpr size_t kModulusBits = SSE_CRYPTO_TDP_MODULUS_BITS;
+    static constexpr size_t kMessageSize = kModulusBits/8;
+    // 3 or 65537
+    static constexpr uint32_t kDefaultPublicExponent = 3;
+    static constexpr TdpBackend kDefaultBackend = TdpBackend::kMontgomery;
     static constexpr unsigned int kStatisticalSecurity = 64;
     static constexpr size_t kRSAPrgSize = kMessageSize + kStatisticalSecurity;
 
@@ -82,6 +114,7 @@ public:
     static constexpr size_t kMessageSize = Tdp::kMessageSize;
 
     TdpInverse();
+    explicit TdpInverse(const uint32_t public_exponent);
     TdpInverse(const std::string& sk);
     TdpInverse(const TdpInverse& tdp);
     
@@ -113,6 +146,9 @@ public:
     std::string invert_mult(const std::string &in, uint32_t order) const;
     std::array<uint8_t, kMessageSize> invert_mult(const std::array<uint8_t, kMessageSize> &in, uint32_t order) const;
     
+    void set_backend(const TdpBackend backend);
+    TdpBackend backend() const;
+    
 private:
 	TdpInverseImpl *tdp_inv_imp_; // opaque pointer
 
@@ -146,8 +182,17 @@ public:
     std::string eval(const std::string &in, uint8_t order) const;
     std::array<uint8_t, kMessageSize> eval(const std::array<uint8_t, kMessageSize> &in, uint8_t order) const;
     
+    // count successive evaluations of the given order, starting from in:
+    // out[i] = eval^(order*(i+1))(in). This is cheaper than as many calls to
+    // eval, as the steps share a bignum context and the Montgomery context
+    // of the modulus.
+    void eval_chain(const std::array<uint8_t, kMessageSize> &in, uint8_t order, size_t count, std::array<uint8_t, kMessageSize> *out) const;
+    
     uint8_t maximum_order() const;
     uint8_t pool_size() const;
+    
+    void set_backend(const TdpBackend backend);
+    TdpBackend backend() const;
 
 private:
     TdpMultPoolImpl *tdp_pool_imp_; // opaque pointer
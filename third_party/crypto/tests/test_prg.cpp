@@ -25,6 +25,7 @@
 #include <iomanip>
 #include <string>
 #include <algorithm>
+#include <vector>
 
 #include "gtest/gtest.h"
 
@@ -172,6 +173,37 @@ TEST(prg, consistency_3)
     }
 }
 
+TEST(prg, batch_consistency)
+{
+    constexpr size_t kBlock = sse::crypto::Prg::kKeySize;
+    constexpr size_t kOut = sse::crypto::Prg::kBatchOutputSize;
+    
+    // exercise both the 8-way kernel and the remaining keys
+    for (size_t count = 1; count <= 35; count++) {
+        std::vector<uint8_t> keys(count*kBlock);
+        std::vector<uint8_t> out(count*kOut);
+        
+        sse::crypto::random_bytes(keys.size(), keys.data());
+        
+        sse::crypto::Prg::derive_batch(keys.data(), count, out.data());
+        
+        for (size_t i = 0; i < count; i++) {
+            uint8_t expected[kOut];
+            sse::crypto::Prg::derive(keys.data()+i*kBlock, 0, kOut, expected);
+            
+            ASSERT_TRUE(std::equal(expected, expected+kOut, out.begin()+i*kOut));
+        }
+        
+        // in place expansion
+        std::vector<uint8_t> in_place(count*kOut);
+        std::copy(keys.begin(), keys.end(), in_place.begin());
+        
+        sse::crypto::Prg::derive_batch(in_place.data(), count, in_place.data());
+        
+        ASSERT_EQ(out, in_place);
+    }
+}
+
 TEST(prg, exceptions)
 {
     std::array<uint8_t,sse::crypto::Prg::kKeySize> k{{0x00}};
@@ -183,5 +215,7 @@ TEST(prg, exceptions)
     ASSERT_THROW(sse::crypto::Prg::derive(k.data(),0, out), std::invalid_argument);
     ASSERT_THROW(sse::crypto::Prg::derive((const uint8_t*)NULL,10, out), std::invalid_argument);
     
+    ASSERT_THROW(sse::crypto::Prg::derive_batch((const uint8_t*)NULL, 1, (unsigned char*)&k), std::invalid_argument);
+    
     ASSERT_THROW(sse::crypto::Prg p(NULL), std::invalid_argument);
 }
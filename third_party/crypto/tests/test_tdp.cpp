@@ -209,6 +209,73 @@ TEST(tdp, multiple_eval)
     }
 }
 
+TEST(tdp, eval_chain)
+{
+    for (size_t i = 0; i < TEST_COUNT; i++) {
+        sse::crypto::TdpInverse tdp_inv;
+        
+        sse::crypto::TdpMultPool pool(tdp_inv.public_key(), POOL_COUNT);
+        
+        std::array<uint8_t, sse::crypto::TdpMultPool::kMessageSize> sample = pool.sample_array();
+        std::array<std::array<uint8_t, sse::crypto::TdpMultPool::kMessageSize>, 5> chain;
+        
+        for (uint8_t order = 1; order <= pool.maximum_order(); order++) {
+            pool.eval_chain(sample, order, chain.size(), chain.data());
+            
+            std::array<uint8_t, sse::crypto::TdpMultPool::kMessageSize> v = sample;
+            for (size_t j = 0; j < chain.size(); j++) {
+                v = pool.eval(v, order);
+                ASSERT_EQ(v, chain[j]);
+            }
+        }
+        
+        ASSERT_THROW(pool.eval_chain(sample, 0, chain.size(), chain.data()), std::invalid_argument);
+        ASSERT_THROW(pool.eval_chain(sample, pool.maximum_order()+1, chain.size(), chain.data()), std::invalid_argument);
+    }
+}
+
+TEST(tdp, backends)
+{
+    const uint32_t exponents[] = {3, 65537};
+    
+    for (uint32_t e : exponents) {
+        for (size_t i = 0; i < TEST_COUNT/10; i++) {
+            sse::crypto::TdpInverse tdp_inv(e);
+            sse::crypto::TdpInverse tdp_inv_openssl(tdp_inv);
+            tdp_inv_openssl.set_backend(sse::crypto::TdpBackend::kOpenSSL);
+            
+            sse::crypto::TdpMultPool pool(tdp_inv.public_key(), POOL_COUNT);
+            sse::crypto::TdpMultPool pool_openssl(pool);
+            pool_openssl.set_backend(sse::crypto::TdpBackend::kOpenSSL);
+            
+            ASSERT_EQ(tdp_inv.backend(), sse::crypto::TdpBackend::kMontgomery);
+            ASSERT_EQ(pool.backend(), sse::crypto::TdpBackend::kMontgomery);
+            ASSERT_EQ(pool_openssl.backend(), sse::crypto::TdpBackend::kOpenSSL);
+            
+            std::array<uint8_t, sse::crypto::TdpMultPool::kMessageSize> sample = pool.sample_array();
+            std::array<std::array<uint8_t, sse::crypto::TdpMultPool::kMessageSize>, 5> chain, chain_openssl;
+            
+            ASSERT_EQ(pool.eval(sample), pool_openssl.eval(sample));
+            for (uint8_t order = 1; order <= pool.maximum_order(); order++) {
+                ASSERT_EQ(pool.eval(sample, order), pool_openssl.eval(sample, order));
+                
+                pool.eval_chain(sample, order, chain.size(), chain.data());
+                pool_openssl.eval_chain(sample, order, chain_openssl.size(), chain_openssl.data());
+                ASSERT_EQ(chain, chain_openssl);
+            }
+            
+            auto inv = tdp_inv.invert(sample);
+            ASSERT_EQ(inv, tdp_inv_openssl.invert(sample));
+            ASSERT_EQ(pool.eval(inv), sample);
+            
+            for (uint32_t order = 0; order < INV_MULT_COUNT; order += 7) {
+                ASSERT_EQ(tdp_inv.invert_mult(sample, order), tdp_inv_openssl.invert_mult(sample, order));
+            }
+            ASSERT_EQ(tdp_inv.invert_mult(sample, 0xffffffff), tdp_inv_openssl.invert_mult(sample, 0xffffffff));
+        }
+    }
+}
+
 TEST(tdp, multiple_inverse_1)
 {
     for (size_t i = 0; i < TEST_COUNT; i++) {
@@ -386,6 +453,7 @@ TEST(tdp, exceptions)
     ASSERT_THROW(sse::crypto::Tdp tdp(" "), std::runtime_error);
     ASSERT_THROW(sse::crypto::TdpInverse tdp_inv(" "), std::runtime_error);
     ASSERT_THROW(sse::crypto::TdpMultPool pool(" ",2), std::runtime_error);
+    ASSERT_THROW(sse::crypto::TdpInverse tdp_inv_e(5), std::invalid_argument);
     
     sse::crypto::TdpInverse tdp_inv;
     